@@ -0,0 +1,154 @@
+#include "Animation.h"
+#include <fstream>
+#include <sstream>
+bool loadCameraPath(const string& fileName, vector<CameraKey>& path, string& error) {
+    path.clear();
+    ifstream file(fileName);
+    if (!file) {
+        error = "Could not open " + fileName;
+        return false;
+    }
+    string line;
+    for (int lineNum = 1; getline(file, line); lineNum++) {
+        istringstream numbers(line);
+        char first;
+        if (!(numbers >> first) || first == '#') {
+            continue;
+        }
+        numbers.putback(first);
+        CameraKey key;
+        Vec3* vectors[3] = {&key.camera, &key.lookAtVec, &key.upVec};
+        for (int k = 0; k < 9; k++) {
+            if (!(numbers >> (*vectors[k / 3])[k % 3])) {
+                error = "Bad camera on line " + to_string(lineNum);
+                return false;
+            }
+        }
+        path.push_back(key);
+    }
+    return true;
+}
+bool saveCameraPath(const string& fileName, const vector<CameraKey>& path, string& error) {
+    ofstream file(fileName, ios::out | ios::trunc);
+    if (!file) {
+        error = "Could not write " + fileName;
+        return false;
+    }
+    file << "# camera x y z, look at x y z, up x y z\n";
+    // Enough digits to read back the same floats
+    file.precision(9);
+    for (int i = 0; i < path.size(); i++) {
+        const CameraKey& key = path.at(i);
+        const Vec3* vectors[3] = {&key.camera, &key.lookAtVec, &key.upVec};
+        for (int k = 0; k < 9; k++) {
+            file << (*vectors[k / 3])[k % 3] << (k == 8 ? '\n' : ' ');
+        }
+    }
+    if (!file) {
+        error = "Could not write " + fileName;
+        return false;
+    }
+    return true;
+}
+AnimationRenderer::AnimationRenderer(RayTracer &rayTracer, vector<CameraKey> path,
+                                     ImageSink &sink, int queueSize)
+        : rayTracer(rayTracer), path(move(path)), sink(sink),
+          queueSize(max(1, queueSize)), rendered(0), written(0), cancelled(false),
+          writeFailed(false), finishedFlag(false) {}
+AnimationRenderer::~AnimationRenderer() {
+    cancel();
+    wait();
+}
+void AnimationRenderer::start() {
+    startTime = chrono::steady_clock::now();
+    freeBuffers.resize(queueSize);
+    renderThread = thread(&AnimationRenderer::renderLoop, this);
+    writerThread = thread(&AnimationRenderer::writerLoop, this);
+}
+void AnimationRenderer::renderLoop() {
+    size_t frameBytes = (size_t)rayTracer.imgSizeX * rayTracer.imgSizeY * 3;
+    for (int i = 0; i < path.size() && !cancelled; i++) {
+        const CameraKey& key = path.at(i);
+        unsigned char* image = rayTracer.produceImage(key.camera, key.lookAtVec, key.upVec);
+        rendered++;
+        // Wait for the writer to free a buffer
+        unique_lock<mutex> guard(lock);
+        changed.wait(guard, [&]() { return !freeBuffers.empty() || cancelled; });
+        if (cancelled) {
+            break;
+        }
+        vector<unsigned char> frame;
+        frame.swap(freeBuffers.back());
+        freeBuffers.pop_back();
+        guard.unlock();
+        frame.assign(image, image + frameBytes);
+        guard.lock();
+        queued.push_back(move(frame));
+        changed.notify_all();
+    }
+    lock_guard<mutex> guard(lock);
+    renderingDone = true;
+    changed.notify_all();
+}
+void AnimationRenderer::writerLoop() {
+    while (true) {
+        unique_lock<mutex> guard(lock);
+        changed.wait(guard, [&]() { return !queued.empty() || renderingDone; });
+        if (queued.empty()) {
+            break;
+        }
+        vector<unsigned char> frame = move(queued.front());
+        queued.pop_front();
+        guard.unlock();
+        // The image size stays put while the animation runs
+        bool saved = sink.writeFrame(frame.data(), rayTracer.imgSizeX, rayTracer.imgSizeY);
+        guard.lock();
+        if (!saved) {
+            writeFailed = true;
+            cancelled = true;
+        }
+        else {
+            written++;
+        }
+        freeBuffers.push_back(move(frame));
+        changed.notify_all();
+    }
+    finishTime = chrono::steady_clock::now();
+    finishedFlag = true;
+}
+void AnimationRenderer::cancel() {
+    lock_guard<mutex> guard(lock);
+    cancelled = true;
+    changed.notify_all();
+}
+void AnimationRenderer::wait() {
+    if (renderThread.joinable()) {
+        renderThread.join();
+    }
+    if (writerThread.joinable()) {
+        writerThread.join();
+    }
+}
+bool AnimationRenderer::finished() const {
+    return finishedFlag;
+}
+bool AnimationRenderer::wasCancelled() const {
+    return cancelled;
+}
+bool AnimationRenderer::failed() const {
+    return writeFailed;
+}
+int AnimationRenderer::frameCount() const {
+    return (int)path.size();
+}
+int AnimationRenderer::framesRendered() const {
+    return rendered;
+}
+int AnimationRenderer::framesWritten() const {
+    return written;
+}
+double AnimationRenderer::framesPerMinute() const {
+    chrono::steady_clock::time_point end = finishedFlag ? finishTime : chrono::steady_clock::now();
+    double minutes = chrono::duration<double>(end - startTime).count() / 60.0;
+    return minutes > 0 ? written / minutes : 0.0;
+}
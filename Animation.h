@@ -0,0 +1,73 @@
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include "RayTracer.h"
+#include "ImageSink.h"
+using namespace std;
+#pragma once
+// Camera for one frame of an animation
+struct CameraKey {
+    Point camera;
+    Vec3 lookAtVec;
+    Vec3 upVec;
+};
+// Camera path files have one frame per line: camera, look at and up vectors as 9 numbers.
+// Blank lines and lines starting with '#' are skipped. Return false and set error on failure.
+bool loadCameraPath(const string& fileName, vector<CameraKey>& path, string& error);
+bool saveCameraPath(const string& fileName, const vector<CameraKey>& path, string& error);
+// Renders a camera path in the background. A render thread traces the frames in order (each
+// frame is split over the ray tracer's thread pool) and hands them to a writer thread through
+// a bounded queue, so saving one frame overlaps rendering the next and a slow disk can't pile
+// up frames in memory.
+class AnimationRenderer {
+    RayTracer& rayTracer;
+    vector<CameraKey> path;
+    ImageSink& sink;
+    int queueSize;
+    // Frames waiting to be written and buffers the render thread can fill, both guarded by lock
+    deque<vector<unsigned char>> queued;
+    vector<vector<unsigned char>> freeBuffers;
+    bool renderingDone = false;
+    mutex lock;
+    condition_variable changed;
+    atomic<int> rendered;
+    atomic<int> written;
+    atomic<bool> cancelled;
+    // Read by failed() from any thread without the lock
+    atomic<bool> writeFailed;
+    atomic<bool> finishedFlag;
+    chrono::steady_clock::time_point startTime;
+    // Set by the writer thread before finishedFlag
+    chrono::steady_clock::time_point finishTime;
+    thread renderThread;
+    thread writerThread;
+    void renderLoop();
+    void writerLoop();
+public:
+    // rayTracer and sink are used by the threads until the animation finishes, leave them
+    // alone until then. Frames reach the sink in order. queueSize is the most finished frames
+    // waiting to be written.
+    AnimationRenderer(RayTracer& rayTracer, vector<CameraKey> path, ImageSink& sink,
+                      int queueSize = 4);
+    // Cancels and waits for the threads
+    ~AnimationRenderer();
+    void start();
+    // Stops after the frame being rendered, frames already rendered are still written
+    void cancel();
+    // Blocks until every frame is written (or the render is cancelled)
+    void wait();
+    bool finished() const;
+    bool wasCancelled() const;
+    // True if the sink failed to take a frame (which cancels the rest)
+    bool failed() const;
+    int frameCount() const;
+    int framesRendered() const;
+    int framesWritten() const;
+    // Written frames per minute from start until now (or until the last frame was written)
+    double framesPerMinute() const;
+};
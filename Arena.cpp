@@ -0,0 +1,58 @@
+#include "Arena.h"
+#include <cstdint>
+#include <algorithm>
+Arena::Arena(size_t blockSize) : blockSize(blockSize) {}
+Arena::Arena(Arena&& other) noexcept
+    : blocks(move(other.blocks)), blockSize(other.blockSize), next(other.next), end(other.end),
+      used(other.used), cleanups(other.cleanups) {
+    other.blocks.clear();
+    other.next = other.end = nullptr;
+    other.used = 0;
+    other.cleanups = nullptr;
+}
+Arena& Arena::operator=(Arena&& other) noexcept {
+    if (this != &other) {
+        clear();
+        blocks = move(other.blocks);
+        blockSize = other.blockSize;
+        next = other.next;
+        end = other.end;
+        used = other.used;
+        cleanups = other.cleanups;
+        other.blocks.clear();
+        other.next = other.end = nullptr;
+        other.used = 0;
+        other.cleanups = nullptr;
+    }
+    return *this;
+}
+Arena::~Arena() {
+    clear();
+}
+void* Arena::allocate(size_t size, size_t alignment) {
+    uintptr_t address = ((uintptr_t)next + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (next == nullptr || address + size > (uintptr_t)end) {
+        // Anything bigger than a block gets a block of its own, new[] aligns for any type
+        size_t newSize = max(blockSize, size);
+        blocks.emplace_back(new char[newSize]);
+        next = blocks.back().get();
+        end = next + newSize;
+        address = (uintptr_t)next;
+    }
+    used += address + size - (uintptr_t)next;
+    next = (char*)(address + size);
+    return (void*)address;
+}
+void Arena::clear() {
+    // Newest first, like a stack unwinding
+    for (Cleanup* cleanup = cleanups; cleanup != nullptr; cleanup = cleanup->previous) {
+        cleanup->destroy(cleanup->object);
+    }
+    cleanups = nullptr;
+    blocks.clear();
+    next = end = nullptr;
+    used = 0;
+}
+size_t Arena::bytesUsed() const {
+    return used;
+}
@@ -0,0 +1,65 @@
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <utility>
+#include <type_traits>
+#include <new>
+using namespace std;
+#pragma once
+// Bump allocator for objects that all go away together. make constructs objects one after
+// another in large blocks, nothing is freed on its own, clear (or the destructor) runs the
+// destructors in reverse order and frees every block at once.
+class Arena {
+    // Destructor to run at teardown, stored in the arena next to its object
+    struct Cleanup {
+        void (*destroy)(void*);
+        void* object;
+        Cleanup* previous;
+    };
+    vector<unique_ptr<char[]>> blocks;
+    size_t blockSize;
+    // Free space left in the newest block
+    char* next = nullptr;
+    char* end = nullptr;
+    size_t used = 0;
+    // Last destructor registered, each one links to the one before
+    Cleanup* cleanups = nullptr;
+    void* allocate(size_t size, size_t alignment);
+    template <class T>
+    static void destroy(void* object);
+    template <class T>
+    void addCleanup(T*, true_type) {}
+    template <class T>
+    void addCleanup(T* object, false_type);
+public:
+    explicit Arena(size_t blockSize = 64 * 1024);
+    Arena(Arena&& other) noexcept;
+    Arena& operator=(Arena&& other) noexcept;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    ~Arena();
+    // Constructs a T in the arena, it lives until clear
+    template <class T, class... Args>
+    T* make(Args&&... args);
+    // Destroys everything made so far and frees the blocks
+    void clear();
+    // Bytes handed out, padding and cleanup records included
+    size_t bytesUsed() const;
+};
+template <class T>
+void Arena::destroy(void* object) {
+    static_cast<T*>(object)->~T();
+}
+template <class T>
+void Arena::addCleanup(T* object, false_type) {
+    Cleanup* cleanup = static_cast<Cleanup*>(allocate(sizeof(Cleanup), alignof(Cleanup)));
+    *cleanup = {&Arena::destroy<T>, object, cleanups};
+    cleanups = cleanup;
+}
+template <class T, class... Args>
+T* Arena::make(Args&&... args) {
+    T* object = new (allocate(sizeof(T), alignof(T))) T(forward<Args>(args)...);
+    // Trivially destructible types (lights) need no record
+    addCleanup(object, typename is_trivially_destructible<T>::type());
+    return object;
+}
@@ -0,0 +1,205 @@
+#include "BVH.h"
+#include <algorithm>
+void AABB::grow(const Point &point) {
+    for (int k = 0; k < 3; k++) {
+        minBound[k] = min(minBound[k], point[k]);
+        maxBound[k] = max(maxBound[k], point[k]);
+    }
+}
+void AABB::grow(const AABB &box) {
+    grow(box.minBound);
+    grow(box.maxBound);
+}
+Point AABB::center() const {
+    return {(minBound.x + maxBound.x) * 0.5f, (minBound.y + maxBound.y) * 0.5f,
+            (minBound.z + maxBound.z) * 0.5f};
+}
+float AABB::surfaceArea() const {
+    float dx = maxBound.x - minBound.x;
+    float dy = maxBound.y - minBound.y;
+    float dz = maxBound.z - minBound.z;
+    // Empty boxes have inverted bounds
+    if (dx < 0 || dy < 0 || dz < 0) {
+        return 0.0f;
+    }
+    return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+bool BVH::empty() const {
+    return nodeCount == 0;
+}
+const BVH::Node* BVH::getNodes() const {
+    return nodeData;
+}
+int BVH::getNodeCount() const {
+    return nodeCount;
+}
+const int* BVH::getOrder() const {
+    return orderData;
+}
+float BVH::cost() const {
+    if (nodeCount == 0) {
+        return 0.0f;
+    }
+    float rootArea = nodeData[0].bounds.surfaceArea();
+    if (rootArea <= 0) {
+        return 0.0f;
+    }
+    float total = 0.0f;
+    for (int i = 0; i < nodeCount; i++) {
+        const Node& node = nodeData[i];
+        total += node.bounds.surfaceArea() * (node.count > 0 ? (float)node.count : 1.0f);
+    }
+    return total / rootArea;
+}
+float BVH::getBuiltCost() const {
+    return builtCost;
+}
+void BVH::attach(const Node *nodes, int nodeCount, const int *order) {
+    this->nodes.clear();
+    this->order.clear();
+    nodeData = nodes;
+    orderData = order;
+    this->nodeCount = nodeCount;
+    builtCost = 0.0f;
+}
+void BVH::refit(const BVH &tree, const vector<AABB> &boxes) {
+    // Copied first in case tree is this BVH
+    vector<Node> fitted(tree.nodeData, tree.nodeData + tree.nodeCount);
+    vector<int> fittedOrder(tree.orderData, tree.orderData + boxes.size());
+    // An attached tree's cost wasn't worked out when it was built, it's taken as it is now
+    builtCost = tree.builtCost > 0 ? tree.builtCost : tree.cost();
+    nodes.swap(fitted);
+    order.swap(fittedOrder);
+    nodeData = nodes.data();
+    orderData = order.data();
+    nodeCount = (int)nodes.size();
+    // Children come after their parents, so going backwards fits them first
+    for (int i = nodeCount - 1; i >= 0; i--) {
+        Node& node = nodes[i];
+        AABB bounds;
+        if (node.count > 0) {
+            for (int k = node.start; k < node.start + node.count; k++) {
+                bounds.grow(boxes[order[k]]);
+            }
+        }
+        else {
+            bounds.grow(nodes[i + 1].bounds);
+            bounds.grow(nodes[node.rightChild].bounds);
+        }
+        node.bounds = bounds;
+    }
+}
+void BVH::build(const vector<AABB> &boxes) {
+    nodes.clear();
+    order.clear();
+    nodeData = nullptr;
+    orderData = nullptr;
+    nodeCount = 0;
+    builtCost = 0.0f;
+    if (boxes.empty()) {
+        return;
+    }
+    vector<Point> centers(boxes.size());
+    order.resize(boxes.size());
+    for (int i = 0; i < boxes.size(); i++) {
+        centers[i] = boxes[i].center();
+        order[i] = i;
+    }
+    nodes.reserve(2 * boxes.size());
+    buildNode(boxes, centers, 0, (int)boxes.size(), 0);
+    // Leaves usually hold a few primitives so most of the reserved space goes unused
+    nodes.shrink_to_fit();
+    nodeData = nodes.data();
+    orderData = order.data();
+    nodeCount = (int)nodes.size();
+    builtCost = cost();
+}
+int BVH::buildNode(const vector<AABB> &boxes, const vector<Point> &centers, int start,
+                   int end, int depth) {
+    int nodeIndex = (int)nodes.size();
+    nodes.emplace_back();
+    AABB bounds;
+    AABB centerBounds;
+    for (int i = start; i < end; i++) {
+        bounds.grow(boxes[order[i]]);
+        centerBounds.grow(centers[order[i]]);
+    }
+    nodes[nodeIndex].bounds = bounds;
+    int count = end - start;
+    // Small enough (or deep enough that traversal would run out of stack) to be a leaf
+    if (count <= 1 || depth >= stackSize - 2) {
+        nodes[nodeIndex].start = start;
+        nodes[nodeIndex].count = count;
+        return nodeIndex;
+    }
+    // Bin the primitive centers along each axis and find the cheapest split
+    float bestCost = numeric_limits<float>::max();
+    int bestAxis = -1;
+    int bestBin = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        float axisMin = centerBounds.minBound[axis];
+        float axisExtent = centerBounds.maxBound[axis] - axisMin;
+        if (axisExtent <= 0) {
+            continue;
+        }
+        AABB binBounds[binCount];
+        int binCounts[binCount] = {};
+        for (int i = start; i < end; i++) {
+            int bin = min(binCount - 1, (int)((centers[order[i]][axis] - axisMin) / axisExtent *
+                                              binCount));
+            binCounts[bin]++;
+            binBounds[bin].grow(boxes[order[i]]);
+        }
+        // Sweep from the right to get the area and count to the right of each split
+        float rightArea[binCount];
+        int rightCount[binCount];
+        AABB sweep;
+        int sweepCount = 0;
+        for (int bin = binCount - 1; bin > 0; bin--) {
+            sweep.grow(binBounds[bin]);
+            sweepCount += binCounts[bin];
+            rightArea[bin] = sweep.surfaceArea();
+            rightCount[bin] = sweepCount;
+        }
+        // Sweep from the left, split between bin - 1 and bin
+        sweep = AABB();
+        sweepCount = 0;
+        for (int bin = 1; bin < binCount; bin++) {
+            sweep.grow(binBounds[bin - 1]);
+            sweepCount += binCounts[bin - 1];
+            float cost = sweep.surfaceArea() * sweepCount + rightArea[bin] * rightCount[bin];
+            if (sweepCount > 0 && rightCount[bin] > 0 && cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = bin;
+            }
+        }
+    }
+    // Cost of intersecting everything here (traversal cost taken as one intersection)
+    float leafCost = bounds.surfaceArea() * count;
+    bestCost += bounds.surfaceArea();
+    if (bestAxis == -1 || (count <= maxLeafSize && bestCost >= leafCost)) {
+        if (bestAxis == -1 && count > maxLeafSize) {
+            // All centers in one spot, just split the list in half
+            int middle = start + count / 2;
+            buildNode(boxes, centers, start, middle, depth + 1);
+            nodes[nodeIndex].rightChild = buildNode(boxes, centers, middle, end, depth + 1);
+            return nodeIndex;
+        }
+        nodes[nodeIndex].start = start;
+        nodes[nodeIndex].count = count;
+        return nodeIndex;
+    }
+    float axisMin = centerBounds.minBound[bestAxis];
+    float axisExtent = centerBounds.maxBound[bestAxis] - axisMin;
+    int* middle = partition(&order[start], &order[0] + end, [&](int prim) {
+        int bin = min(binCount - 1, (int)((centers[prim][bestAxis] - axisMin) / axisExtent *
+                                          binCount));
+        return bin < bestBin;
+    });
+    int middleIndex = (int)(middle - &order[0]);
+    // Left child goes right after this node
+    buildNode(boxes, centers, start, middleIndex, depth + 1);
+    nodes[nodeIndex].rightChild = buildNode(boxes, centers, middleIndex, end, depth + 1);
+    return nodeIndex;
+}
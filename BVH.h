@@ -0,0 +1,185 @@
+#include <vector>
+#include <cmath>
+#include <limits>
+#include "Vec3.h"
+using namespace std;
+#pragma once
+// Axis aligned bounding box
+struct AABB {
+    Vec3 minBound = {numeric_limits<float>::max(), numeric_limits<float>::max(),
+                     numeric_limits<float>::max()};
+    Vec3 maxBound = {-numeric_limits<float>::max(), -numeric_limits<float>::max(),
+                     -numeric_limits<float>::max()};
+    void grow(const Point& point);
+    void grow(const AABB& box);
+    Point center() const;
+    float surfaceArea() const;
+};
+// Bounding volume hierarchy over a list of boxes, built with the surface area heuristic.
+// It only stores primitive indices, callers pass in how to intersect a primitive.
+class BVH {
+public:
+    // Leaves have count > 0 and own order[start, start + count), interior nodes have their
+    // left child right after them and their right child at rightChild
+    struct Node {
+        AABB bounds;
+        int start = 0;
+        int count = 0;
+        int rightChild = 0;
+    };
+    // Deepest traversal stack needed, the build stops splitting before reaching it
+    static const int stackSize = 64;
+private:
+    static const int binCount = 12;
+    static const int maxLeafSize = 4;
+    vector<Node> nodes;
+    vector<int> order;
+    // What traversal reads, the vectors above or a tree stored somewhere else (attach)
+    const Node* nodeData = nullptr;
+    const int* orderData = nullptr;
+    int nodeCount = 0;
+    // cost() when the tree was last built (0 if attached), refits keep it to see how far
+    // they've drifted
+    float builtCost = 0.0f;
+    int buildNode(const vector<AABB>& boxes, const vector<Point>& centers, int start,
+                  int end, int depth);
+    // Ray box slab test, gives the entry distance if the box is hit before tMax
+    static bool hitBox(const AABB& box, const Point& p, const Vec3& invD, float tMax,
+                       float& tEntry);
+    static Vec3 inverseDirection(const Vec3& d);
+public:
+    void build(const vector<AABB>& boxes);
+    // Takes tree's nodes and primitive order as they are and fits the node bounds to boxes
+    // (one per primitive, as many as tree was built over) instead of building again. Much
+    // faster than build, but the tree only stays good while the primitives stay roughly where
+    // they were, compare cost() with getBuiltCost().
+    void refit(const BVH& tree, const vector<AABB>& boxes);
+    // Traverses a tree built earlier and stored elsewhere (a mapped scene cache) without
+    // copying it, nodes and order have to outlive the BVH or the next build
+    void attach(const Node* nodes, int nodeCount, const int* order);
+    bool empty() const;
+    // Surface area heuristic cost of the tree, the expected number of nodes plus primitives a
+    // ray through the root box visits
+    float cost() const;
+    // cost() right after the build this tree's nodes came from
+    float getBuiltCost() const;
+    // Flattened tree for traversals that live outside this class (ray packets)
+    const Node* getNodes() const;
+    int getNodeCount() const;
+    // Primitive indices referenced by the leaves
+    const int* getOrder() const;
+    // Closest hit, intersect(index) returns the distance to primitive index or -1 for a miss.
+    // Returns the closest primitive index (or -1) and lowers tMax to its distance.
+    template <class Intersect>
+    int closestHit(const Point& p, const Vec3& d, float& tMax, Intersect intersect) const;
+    // Any hit, stops at the first primitive hit closer than tMax and returns its index (-1 if
+    // nothing is hit)
+    template <class Intersect>
+    int anyHit(const Point& p, const Vec3& d, float tMax, Intersect intersect) const;
+};
+inline bool BVH::hitBox(const AABB &box, const Point &p, const Vec3 &invD, float tMax,
+                        float &tEntry) {
+    float tNear = 0.0f;
+    float tFar = tMax;
+    for (int k = 0; k < 3; k++) {
+        float t1 = (box.minBound[k] - p[k]) * invD[k];
+        float t2 = (box.maxBound[k] - p[k]) * invD[k];
+        tNear = max(tNear, min(t1, t2));
+        tFar = min(tFar, max(t1, t2));
+    }
+    tEntry = tNear;
+    return tNear <= tFar;
+}
+inline Vec3 BVH::inverseDirection(const Vec3 &d) {
+    // Zero components get a tiny value instead so the slab test never sees 0 * inf
+    Vec3 invD;
+    for (int k = 0; k < 3; k++) {
+        invD[k] = 1.0f / (fabs(d[k]) > 1e-20f ? d[k] : copysign(1e-20f, d[k]));
+    }
+    return invD;
+}
+template <class Intersect>
+int BVH::closestHit(const Point &p, const Vec3 &d, float &tMax, Intersect intersect) const {
+    int closest = -1;
+    if (nodeCount == 0) {
+        return closest;
+    }
+    Vec3 invD = inverseDirection(d);
+    int stack[stackSize];
+    int stackTop = 0;
+    float tEntry;
+    if (!hitBox(nodeData[0].bounds, p, invD, tMax, tEntry)) {
+        return closest;
+    }
+    stack[stackTop++] = 0;
+    while (stackTop > 0) {
+        const Node& node = nodeData[stack[--stackTop]];
+        // Box may have been entered before a closer hit was found
+        if (!hitBox(node.bounds, p, invD, tMax, tEntry)) {
+            continue;
+        }
+        if (node.count > 0) {
+            for (int i = node.start; i < node.start + node.count; i++) {
+                float t = intersect(orderData[i]);
+                if (t != -1 && t < tMax) {
+                    tMax = t;
+                    closest = orderData[i];
+                }
+            }
+            continue;
+        }
+        // Push the farther child first so the nearer one is visited next
+        int left = (int)(&node - nodeData) + 1;
+        int right = node.rightChild;
+        float tLeft;
+        float tRight;
+        bool hitLeft = hitBox(nodeData[left].bounds, p, invD, tMax, tLeft);
+        bool hitRight = hitBox(nodeData[right].bounds, p, invD, tMax, tRight);
+        if (hitLeft && hitRight) {
+            if (tLeft <= tRight) {
+                stack[stackTop++] = right;
+                stack[stackTop++] = left;
+            }
+            else {
+                stack[stackTop++] = left;
+                stack[stackTop++] = right;
+            }
+        }
+        else if (hitLeft) {
+            stack[stackTop++] = left;
+        }
+        else if (hitRight) {
+            stack[stackTop++] = right;
+        }
+    }
+    return closest;
+}
+template <class Intersect>
+int BVH::anyHit(const Point &p, const Vec3 &d, float tMax, Intersect intersect) const {
+    if (nodeCount == 0) {
+        return -1;
+    }
+    Vec3 invD = inverseDirection(d);
+    int stack[stackSize];
+    int stackTop = 0;
+    stack[stackTop++] = 0;
+    float tEntry;
+    while (stackTop > 0) {
+        const Node& node = nodeData[stack[--stackTop]];
+        if (!hitBox(node.bounds, p, invD, tMax, tEntry)) {
+            continue;
+        }
+        if (node.count > 0) {
+            for (int i = node.start; i < node.start + node.count; i++) {
+                float t = intersect(orderData[i]);
+                if (t != -1 && t < tMax) {
+                    return orderData[i];
+                }
+            }
+            continue;
+        }
+        stack[stackTop++] = node.rightChild;
+        stack[stackTop++] = (int)(&node - nodeData) + 1;
+    }
+    return -1;
+}
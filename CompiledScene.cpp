@@ -0,0 +1,330 @@
+#include "CompiledScene.h"
+void CompiledScene::Vec3Storage::push(const Vec3 &vec) {
+    x.push_back(vec.x);
+    y.push_back(vec.y);
+    z.push_back(vec.z);
+}
+// Element i moves to where oldIndices says it came from
+template <class T>
+static void reorderArray(vector<T>& array, const vector<int>& oldIndices) {
+    vector<T> reordered(array.size());
+    for (int i = 0; i < oldIndices.size(); i++) {
+        reordered[i] = array[oldIndices[i]];
+    }
+    array.swap(reordered);
+}
+void CompiledScene::Vec3Storage::reorder(const vector<int> &oldIndices) {
+    reorderArray(x, oldIndices);
+    reorderArray(y, oldIndices);
+    reorderArray(z, oldIndices);
+}
+Vec3Array CompiledScene::Vec3Storage::view() const {
+    Vec3Array array;
+    array.x = x.data();
+    array.y = y.data();
+    array.z = z.data();
+    return array;
+}
+void CompiledScene::SphereStorage::reorder(const vector<int> &oldIndices) {
+    center.reorder(oldIndices);
+    reorderArray(radius, oldIndices);
+    reorderArray(material, oldIndices);
+    reorderArray(flags, oldIndices);
+}
+SphereBucket CompiledScene::SphereStorage::view() const {
+    SphereBucket bucket;
+    bucket.center = center.view();
+    bucket.radius = radius.data();
+    bucket.radiusSquared = radiusSquared.data();
+    bucket.material = material.data();
+    bucket.flags = flags.data();
+    bucket.count = (int)radius.size();
+    return bucket;
+}
+void CompiledScene::TriangleStorage::reorder(const vector<int> &oldIndices) {
+    // Vertices stay put, only the triangles referencing them move
+    vector<int> reordered(indices.size());
+    for (int i = 0; i < oldIndices.size(); i++) {
+        for (int k = 0; k < 3; k++) {
+            reordered[3 * i + k] = indices[3 * oldIndices[i] + k];
+        }
+    }
+    indices.swap(reordered);
+    normal.reorder(oldIndices);
+    reorderArray(material, oldIndices);
+    reorderArray(flags, oldIndices);
+}
+TriangleBucket CompiledScene::TriangleStorage::view() const {
+    TriangleBucket bucket;
+    bucket.vertices = vertices.view();
+    bucket.indices = indices.data();
+    bucket.normal = normal.view();
+    bucket.corner = corner.view();
+    bucket.edge1 = edge1.view();
+    bucket.edge2 = edge2.view();
+    bucket.minDeterminant = minDeterminant.data();
+    bucket.material = material.data();
+    bucket.flags = flags.data();
+    bucket.count = (int)material.size();
+    bucket.vertexCount = (int)vertices.x.size();
+    return bucket;
+}
+PlaneBucket CompiledScene::PlaneStorage::view() const {
+    PlaneBucket bucket;
+    bucket.a = a.view();
+    bucket.normal = normal.view();
+    bucket.offset = offset.data();
+    bucket.material = material.data();
+    bucket.flags = flags.data();
+    bucket.count = (int)material.size();
+    return bucket;
+}
+void CompiledScene::clear() {
+    sphereData = SphereStorage();
+    triangleData = TriangleStorage();
+    planeData = PlaneStorage();
+    lightData = SphereStorage();
+    boundedIds.clear();
+    leafIds.clear();
+    bvh.build({});
+    sceneView = SceneView();
+    boundedIdData = nullptr;
+}
+void CompiledScene::addSphere(const Point &center, float radius, int material,
+                              unsigned char flags) {
+    sphereData.center.push(center);
+    sphereData.radius.push_back(radius);
+    sphereData.material.push_back(material);
+    sphereData.flags.push_back(flags);
+}
+void CompiledScene::addLight(const Point &center, float radius, int material,
+                             unsigned char flags) {
+    lightData.center.push(center);
+    lightData.radius.push_back(radius);
+    lightData.material.push_back(material);
+    lightData.flags.push_back(flags);
+}
+int CompiledScene::addVertex(const Point &vertex) {
+    triangleData.vertices.push(vertex);
+    return (int)triangleData.vertices.x.size() - 1;
+}
+void CompiledScene::addTriangle(int a, int b, int c, const Vec3 &normal, int material,
+                                unsigned char flags) {
+    triangleData.indices.push_back(a);
+    triangleData.indices.push_back(b);
+    triangleData.indices.push_back(c);
+    triangleData.normal.push(normal);
+    triangleData.material.push_back(material);
+    triangleData.flags.push_back(flags);
+}
+void CompiledScene::reserveTriangles(int vertexCount, int triangleCount) {
+    Vec3Storage* arrays[2] = {&triangleData.vertices, &triangleData.normal};
+    int counts[2] = {vertexCount, triangleCount};
+    for (int k = 0; k < 2; k++) {
+        arrays[k]->x.reserve(arrays[k]->x.size() + counts[k]);
+        arrays[k]->y.reserve(arrays[k]->y.size() + counts[k]);
+        arrays[k]->z.reserve(arrays[k]->z.size() + counts[k]);
+    }
+    triangleData.indices.reserve(triangleData.indices.size() + 3 * triangleCount);
+    triangleData.material.reserve(triangleData.material.size() + triangleCount);
+    triangleData.flags.reserve(triangleData.flags.size() + triangleCount);
+}
+void CompiledScene::addPlane(const Point &a, const Vec3 &normal, int material,
+                             unsigned char flags) {
+    planeData.a.push(a);
+    planeData.normal.push(normal);
+    planeData.material.push_back(material);
+    planeData.flags.push_back(flags);
+}
+vector<AABB> CompiledScene::boundedBoxes() {
+    // Spheres and triangles go in the tree, planes and light proxies are checked directly
+    vector<AABB> boxes;
+    boundedIds.clear();
+    for (int i = 0; i < sphereData.radius.size(); i++) {
+        Point center = {sphereData.center.x[i], sphereData.center.y[i], sphereData.center.z[i]};
+        float radius = sphereData.radius[i];
+        AABB box;
+        box.minBound = {center.x - radius, center.y - radius, center.z - radius};
+        box.maxBound = {center.x + radius, center.y + radius, center.z + radius};
+        boxes.push_back(box);
+        boundedIds.push_back((SphereKind << primitiveKindShift) | i);
+    }
+    const Vec3Storage& vertices = triangleData.vertices;
+    for (int i = 0; i < triangleData.material.size(); i++) {
+        AABB box;
+        for (int k = 0; k < 3; k++) {
+            int vertex = triangleData.indices[3 * i + k];
+            box.grow(Point{vertices.x[vertex], vertices.y[vertex], vertices.z[vertex]});
+        }
+        boxes.push_back(box);
+        boundedIds.push_back((TriangleKind << primitiveKindShift) | i);
+    }
+    return boxes;
+}
+void CompiledScene::finish() {
+    bvh.build(boundedBoxes());
+    storeInLeafOrder();
+}
+bool CompiledScene::finish(const CompiledScene &previous) {
+    const SceneView& view = previous.view();
+    if (sphereData.radius.size() != view.spheres.count ||
+        triangleData.material.size() != view.triangles.count) {
+        return false;
+    }
+    // Bounded indices are in the order the primitives were added, so they line up with the
+    // previous scene's as long as its objects were added in the same order
+    bvh.refit(previous.getBVH(), boundedBoxes());
+    if (bvh.cost() > maxRefitCostGrowth * bvh.getBuiltCost()) {
+        bvh.build({});
+        return false;
+    }
+    storeInLeafOrder();
+    return true;
+}
+void CompiledScene::storeInLeafOrder() {
+    // Store the spheres and triangles in the order the leaves visit them so a leaf's
+    // primitives sit next to each other in every array
+    const int* order = bvh.getOrder();
+    int orderCount = (int)boundedIds.size();
+    vector<int> oldIndices[2];
+    vector<int> newIds(boundedIds.size());
+    for (int i = 0; i < orderCount; i++) {
+        int id = boundedIds[order[i]];
+        vector<int>& kindIndices = oldIndices[id >> primitiveKindShift];
+        newIds[order[i]] = ((id >> primitiveKindShift) << primitiveKindShift) |
+                           (int)kindIndices.size();
+        kindIndices.push_back(id & primitiveIndexMask);
+    }
+    sphereData.reorder(oldIndices[SphereKind]);
+    triangleData.reorder(oldIndices[TriangleKind]);
+    boundedIds.swap(newIds);
+    precompute();
+    leafIds.resize(orderCount);
+    for (int i = 0; i < orderCount; i++) {
+        leafIds[i] = boundedIds[order[i]];
+    }
+    sceneView = SceneView();
+    sceneView.spheres = sphereData.view();
+    sceneView.triangles = triangleData.view();
+    sceneView.planes = planeData.view();
+    sceneView.lights = lightData.view();
+    sceneView.nodes = bvh.getNodes();
+    sceneView.nodeCount = bvh.getNodeCount();
+    sceneView.leafIds = leafIds.data();
+    boundedIdData = boundedIds.data();
+}
+void CompiledScene::precompute() {
+    SphereStorage* spheres[2] = {&sphereData, &lightData};
+    for (int k = 0; k < 2; k++) {
+        vector<float>& radius = spheres[k]->radius;
+        spheres[k]->radiusSquared.resize(radius.size());
+        for (int i = 0; i < radius.size(); i++) {
+            spheres[k]->radiusSquared[i] = radius[i] * radius[i];
+        }
+    }
+    const Vec3Storage& vertices = triangleData.vertices;
+    int triangleCount = (int)triangleData.material.size();
+    Vec3Storage* triangleArrays[3] = {&triangleData.corner, &triangleData.edge1,
+                                      &triangleData.edge2};
+    for (int k = 0; k < 3; k++) {
+        triangleArrays[k]->x.resize(triangleCount);
+        triangleArrays[k]->y.resize(triangleCount);
+        triangleArrays[k]->z.resize(triangleCount);
+    }
+    triangleData.minDeterminant.resize(triangleCount);
+    for (int i = 0; i < triangleCount; i++) {
+        const int* corners = &triangleData.indices[3 * i];
+        int a = corners[0];
+        int b = corners[1];
+        int c = corners[2];
+        triangleData.corner.x[i] = vertices.x[a];
+        triangleData.corner.y[i] = vertices.y[a];
+        triangleData.corner.z[i] = vertices.z[a];
+        triangleData.edge1.x[i] = vertices.x[b] - vertices.x[a];
+        triangleData.edge1.y[i] = vertices.y[b] - vertices.y[a];
+        triangleData.edge1.z[i] = vertices.z[b] - vertices.z[a];
+        triangleData.edge2.x[i] = vertices.x[c] - vertices.x[a];
+        triangleData.edge2.y[i] = vertices.y[c] - vertices.y[a];
+        triangleData.edge2.z[i] = vertices.z[c] - vertices.z[a];
+        Vec3 e1 = {triangleData.edge1.x[i], triangleData.edge1.y[i], triangleData.edge1.z[i]};
+        Vec3 e2 = {triangleData.edge2.x[i], triangleData.edge2.y[i], triangleData.edge2.z[i]};
+        Vec3 cross = {e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z,
+                      e1.x * e2.y - e1.y * e2.x};
+        float area = sqrt(cross.x * cross.x + cross.y * cross.y + cross.z * cross.z);
+        triangleData.minDeterminant[i] = triangleParallelEpsilon * area;
+    }
+    const Vec3Storage& a = planeData.a;
+    const Vec3Storage& normal = planeData.normal;
+    planeData.offset.resize(planeData.material.size());
+    for (int i = 0; i < planeData.material.size(); i++) {
+        planeData.offset[i] = a.x[i] * normal.x[i] + a.y[i] * normal.y[i] + a.z[i] * normal.z[i];
+    }
+}
+void CompiledScene::attach(const SceneView &view, const int *order, const int *boundedIds) {
+    clear();
+    sceneView = view;
+    bvh.attach(view.nodes, view.nodeCount, order);
+    boundedIdData = boundedIds;
+}
+const SceneView& CompiledScene::view() const {
+    return sceneView;
+}
+const BVH& CompiledScene::getBVH() const {
+    return bvh;
+}
+int CompiledScene::boundedId(int bvhIndex) const {
+    return boundedIdData[bvhIndex];
+}
+const int* CompiledScene::getBoundedIds() const {
+    return boundedIdData;
+}
+Vec3 CompiledScene::getNormal(int id, const Point &x) const {
+    int i = id & primitiveIndexMask;
+    switch (id >> primitiveKindShift) {
+        case SphereKind:
+        case LightKind: {
+            // Same as Sphere::getNormal, including the double precision magnitude
+            const SphereBucket& bucket = (id >> primitiveKindShift) == SphereKind ?
+                                         sceneView.spheres : sceneView.lights;
+            Vec3 n = {x.x - bucket.center.x[i], x.y - bucket.center.y[i],
+                      x.z - bucket.center.z[i]};
+            float mag = sqrt(pow(n.x, 2) + pow(n.y, 2) + pow(n.z, 2));
+            return {n.x / mag, n.y / mag, n.z / mag};
+        }
+        case TriangleKind:
+            return {sceneView.triangles.normal.x[i], sceneView.triangles.normal.y[i],
+                    sceneView.triangles.normal.z[i]};
+        case PlaneKind:
+            return {sceneView.planes.normal.x[i], sceneView.planes.normal.y[i],
+                    sceneView.planes.normal.z[i]};
+    }
+    return {0, 0, 0};
+}
+int CompiledScene::getMaterial(int id) const {
+    int i = id & primitiveIndexMask;
+    switch (id >> primitiveKindShift) {
+        case SphereKind:
+            return sceneView.spheres.material[i];
+        case TriangleKind:
+            return sceneView.triangles.material[i];
+        case PlaneKind:
+            return sceneView.planes.material[i];
+        case LightKind:
+            return sceneView.lights.material[i];
+    }
+    return 0;
+}
+unsigned char CompiledScene::getFlags(int id) const {
+    int i = id & primitiveIndexMask;
+    switch (id >> primitiveKindShift) {
+        case SphereKind:
+            return sceneView.spheres.flags[i];
+        case TriangleKind:
+            return sceneView.triangles.flags[i];
+        case PlaneKind:
+            return sceneView.planes.flags[i];
+        case LightKind:
+            return sceneView.lights.flags[i];
+    }
+    return 0;
+}
@@ -0,0 +1,272 @@
+#include <vector>
+#include <cmath>
+#include "Vec3.h"
+#include "BVH.h"
+using namespace std;
+#pragma once
+// Which kinds of rays can hit a primitive
+enum RayVisibility : unsigned char {
+    CameraRays = 1,
+    SecondaryRays = 2,
+    ShadowRays = 4,
+    AllRays = 7
+};
+// Primitive ids keep the kind in the top bits and the index in its bucket below
+enum PrimitiveKind {
+    SphereKind = 0,
+    TriangleKind = 1,
+    PlaneKind = 2,
+    LightKind = 3
+};
+const int primitiveKindCount = 4;
+const int primitiveKindShift = 28;
+const int primitiveIndexMask = (1 << primitiveKindShift) - 1;
+// Sine of the angle under which rays count as parallel to a triangle, see intersectTriangle
+const float triangleParallelEpsilon = 1e-5f;
+// How far, relative to |p - center|^2, the discriminant of a ray that grazes a sphere can be
+// off from the exact one, see intersectSphere
+const float sphereSilhouetteTolerance = 1e-6f;
+// The views below are plain pointers into the compiled arrays so the SIMD kernels can read
+// them without calling inline library code (which could otherwise be emitted with AVX2
+// instructions from the AVX2 source file and picked by the linker for everyone)
+// Three float arrays, one per component
+struct Vec3Array {
+    const float* x = nullptr;
+    const float* y = nullptr;
+    const float* z = nullptr;
+};
+// Spheres, also used for the light proxies
+struct SphereBucket {
+    Vec3Array center;
+    const float* radius = nullptr;
+    const float* radiusSquared = nullptr;
+    const int* material = nullptr;
+    const unsigned char* flags = nullptr;
+    int count = 0;
+};
+// Triangles as 3 indices each into a shared vertex array, with their normals worked out
+// ahead of time. Intersection reads the first corner and the edges from it to the other two,
+// also worked out ahead of time, and not the vertices. minDeterminant is
+// triangleParallelEpsilon times the length of edge1 cross edge2.
+struct TriangleBucket {
+    Vec3Array vertices;
+    const int* indices = nullptr;
+    Vec3Array normal;
+    Vec3Array corner;
+    Vec3Array edge1;
+    Vec3Array edge2;
+    const float* minDeterminant = nullptr;
+    const int* material = nullptr;
+    const unsigned char* flags = nullptr;
+    int count = 0;
+    int vertexCount = 0;
+};
+// Planes through point a, offset is a dot normal
+struct PlaneBucket {
+    Vec3Array a;
+    Vec3Array normal;
+    const float* offset = nullptr;
+    const int* material = nullptr;
+    const unsigned char* flags = nullptr;
+    int count = 0;
+};
+struct SceneView {
+    SphereBucket spheres;
+    TriangleBucket triangles;
+    PlaneBucket planes;
+    SphereBucket lights;
+    // BVH over the spheres and triangles, leaves list primitive ids in leafIds
+    const BVH::Node* nodes = nullptr;
+    int nodeCount = 0;
+    const int* leafIds = nullptr;
+};
+// Scene compiled into one structure of arrays bucket per primitive kind, so tracing walks
+// contiguous memory with no virtual calls or casts
+class CompiledScene {
+    struct Vec3Storage {
+        vector<float> x;
+        vector<float> y;
+        vector<float> z;
+        void push(const Vec3& vec);
+        void reorder(const vector<int>& oldIndices);
+        Vec3Array view() const;
+    };
+    struct SphereStorage {
+        Vec3Storage center;
+        vector<float> radius;
+        vector<float> radiusSquared;
+        vector<int> material;
+        vector<unsigned char> flags;
+        void reorder(const vector<int>& oldIndices);
+        SphereBucket view() const;
+    };
+    struct TriangleStorage {
+        Vec3Storage vertices;
+        vector<int> indices;
+        Vec3Storage normal;
+        Vec3Storage corner;
+        Vec3Storage edge1;
+        Vec3Storage edge2;
+        vector<float> minDeterminant;
+        vector<int> material;
+        vector<unsigned char> flags;
+        void reorder(const vector<int>& oldIndices);
+        TriangleBucket view() const;
+    };
+    struct PlaneStorage {
+        Vec3Storage a;
+        Vec3Storage normal;
+        vector<float> offset;
+        vector<int> material;
+        vector<unsigned char> flags;
+        PlaneBucket view() const;
+    };
+    SphereStorage sphereData;
+    TriangleStorage triangleData;
+    PlaneStorage planeData;
+    SphereStorage lightData;
+    BVH bvh;
+    // Bounded primitive ids (what the BVH indexes) and the same ids in leaf order
+    vector<int> boundedIds;
+    vector<int> leafIds;
+    // Everything tracing reads goes through these pointers, into the arrays above or into
+    // arrays stored elsewhere (attach)
+    SceneView sceneView;
+    const int* boundedIdData = nullptr;
+    // A refit tree this much more costly than a fresh build is thrown away and built again
+    static constexpr float maxRefitCostGrowth = 1.5f;
+    // Box around each sphere and triangle, filling boundedIds with their ids
+    vector<AABB> boundedBoxes();
+    // Puts the spheres and triangles in BVH leaf order and makes the views, once the tree is
+    // built
+    void storeInLeafOrder();
+    // Works out what intersection reads from the primitives (radius squared, triangle edges and
+    // plane offsets) once they are in their final order
+    void precompute();
+    static float intersectSphere(const SphereBucket& bucket, int i, const Point& p, const Vec3& d);
+    static float intersectTriangle(const TriangleBucket& bucket, int i, const Point& p,
+                                   const Vec3& d, float& u, float& v);
+public:
+    void clear();
+    void addSphere(const Point& center, float radius, int material, unsigned char flags);
+    void addLight(const Point& center, float radius, int material, unsigned char flags);
+    // Triangles index vertices added with addVertex, which returns the new vertex's index
+    int addVertex(const Point& vertex);
+    void addTriangle(int a, int b, int c, const Vec3& normal, int material, unsigned char flags);
+    void reserveTriangles(int vertexCount, int triangleCount);
+    void addPlane(const Point& a, const Vec3& normal, int material, unsigned char flags);
+    // Builds the BVH and the views, call once everything is added
+    void finish();
+    // Same as finish but refits previous's BVH to the primitives rather than building one,
+    // for objects that moved or changed shape, added in the same order as previous's. Returns
+    // false, finishing nothing, if previous has a different number of spheres or triangles or
+    // the refit tree would be much worse than a new one, call finish() then.
+    bool finish(const CompiledScene& previous);
+    // Uses a scene finished earlier and stored elsewhere (a mapped scene cache) without
+    // copying it. The arrays have to outlive the scene or the next clear. order is the BVH's
+    // primitive order and boundedIds what boundedId gives for each BVH index, one per sphere
+    // and triangle.
+    void attach(const SceneView& view, const int* order, const int* boundedIds);
+    const SceneView& view() const;
+    const BVH& getBVH() const;
+    int boundedId(int bvhIndex) const;
+    // boundedId for every BVH index, for saving the scene
+    const int* getBoundedIds() const;
+    // Distance along the ray to primitive id, -1 for a miss
+    float intersect(int id, const Point& p, const Vec3& d) const;
+    // Distance to triangle index (not id), -1 for a miss. u and v get the barycentric weights
+    // of its second and third corners at the hit.
+    float intersectTriangle(int index, const Point& p, const Vec3& d, float& u, float& v) const;
+    Vec3 getNormal(int id, const Point& x) const;
+    int getMaterial(int id) const;
+    unsigned char getFlags(int id) const;
+};
+inline float CompiledScene::intersectSphere(const SphereBucket &bucket, int i, const Point &p,
+                                            const Vec3 &d) {
+    // Same math as Sphere::intersection, with the radius squared ahead of time. It stays in
+    // float where Sphere::intersection squares through double, so rays whose discriminant is
+    // within sphereSilhouetteTolerance times xDotX of 0 can hit here and miss there or the
+    // other way round, a fraction of a pixel along the silhouette.
+    Vec3 x = {p.x - bucket.center.x[i], p.y - bucket.center.y[i], p.z - bucket.center.z[i]};
+    float dDotX = d.x * x.x + d.y * x.y + d.z * x.z;
+    float xDotX = x.x * x.x + x.y * x.y + x.z * x.z;
+    float underRoot = dDotX * dDotX - xDotX + bucket.radiusSquared[i];
+    if (underRoot < 0) {
+        return -1;
+    }
+    float root = sqrt(underRoot);
+    float tStart = -1.0f * dDotX;
+    float t1 = tStart + root;
+    float t2 = tStart - root;
+    if (t1 > 0 && t2 > 0) {
+        return min(t1, t2);
+    }
+    else if (t1 > 0) {
+        return t1;
+    }
+    else if (t2 > 0) {
+        return t2;
+    }
+    return -1;
+}
+// Moller Trumbore: solves p + t d = corner + u edge1 + v edge2 with Cramer's rule. Points on
+// the edges hit, like Triangle::intersection. Rays parallel to the triangle miss, and so do
+// rays within about triangleParallelEpsilon radians of its plane (for unit d), where the
+// determinant is down in its rounding error and 1 / det would make up hits.
+inline float CompiledScene::intersectTriangle(const TriangleBucket &bucket, int i,
+                                              const Point &p, const Vec3 &d, float &u,
+                                              float &v) {
+    Vec3 e1 = {bucket.edge1.x[i], bucket.edge1.y[i], bucket.edge1.z[i]};
+    Vec3 e2 = {bucket.edge2.x[i], bucket.edge2.y[i], bucket.edge2.z[i]};
+    // d cross edge2
+    Vec3 s = {d.y * e2.z - d.z * e2.y, d.z * e2.x - d.x * e2.z, d.x * e2.y - d.y * e2.x};
+    float det = e1.x * s.x + e1.y * s.y + e1.z * s.z;
+    if (fabs(det) <= bucket.minDeterminant[i]) {
+        return -1;
+    }
+    float invDet = 1.0f / det;
+    Vec3 o = {p.x - bucket.corner.x[i], p.y - bucket.corner.y[i], p.z - bucket.corner.z[i]};
+    u = (o.x * s.x + o.y * s.y + o.z * s.z) * invDet;
+    // (p - corner) cross edge1
+    Vec3 q = {o.y * e1.z - o.z * e1.y, o.z * e1.x - o.x * e1.z, o.x * e1.y - o.y * e1.x};
+    v = (d.x * q.x + d.y * q.y + d.z * q.z) * invDet;
+    float t = (e2.x * q.x + e2.y * q.y + e2.z * q.z) * invDet;
+    if (u < 0 || v < 0 || u + v > 1 || t < 0) {
+        return -1;
+    }
+    return t;
+}
+inline float CompiledScene::intersect(int id, const Point &p, const Vec3 &d) const {
+    int i = id & primitiveIndexMask;
+    switch (id >> primitiveKindShift) {
+        case SphereKind:
+            return intersectSphere(sceneView.spheres, i, p, d);
+        case LightKind:
+            return intersectSphere(sceneView.lights, i, p, d);
+        case TriangleKind: {
+            float u;
+            float v;
+            return intersectTriangle(sceneView.triangles, i, p, d, u, v);
+        }
+        case PlaneKind: {
+            // Plane::intersection's ((a - p) dot n) / (d dot n) with a dot n ahead of time
+            const PlaneBucket& planes = sceneView.planes;
+            Vec3 n = {planes.normal.x[i], planes.normal.y[i], planes.normal.z[i]};
+            float topT = planes.offset[i] - (p.x * n.x + p.y * n.y + p.z * n.z);
+            float bottomT = d.x * n.x + d.y * n.y + d.z * n.z;
+            if (bottomT == 0) {
+                return -1;
+            }
+            float t = topT / bottomT;
+            if (t < 0) {
+                return -1;
+            }
+            return t;
+        }
+    }
+    return -1;
+}
+inline float CompiledScene::intersectTriangle(int index, const Point &p, const Vec3 &d, float &u,
+                                              float &v) const {
+    return intersectTriangle(sceneView.triangles, index, p, d, u, v);
+}
@@ -0,0 +1,179 @@
+#include "ImageSink.h"
+#include <cstring>
+#include <algorithm>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+// Copies the image into out with the rows flipped to top first
+static unsigned char* copyRowsFlipped(const unsigned char* image, int width, int height,
+                                      unsigned char* out) {
+    size_t rowBytes = (size_t)width * 3;
+    for (int row = height - 1; row >= 0; row--) {
+        memcpy(out, image + row * rowBytes, rowBytes);
+        out += rowBytes;
+    }
+    return out;
+}
+static bool writeWhole(FILE* file, const vector<unsigned char>& buffer) {
+    return fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+}
+// Header and flipped pixels into buffer, then the whole file in one write
+static bool writePPMFile(const string& fileName, const unsigned char* image, int width,
+                         int height, vector<unsigned char>& buffer) {
+    string header = "P6\n" + to_string(width) + "\n" + to_string(height) + "\n255\n";
+    buffer.resize(header.size() + (size_t)width * height * 3);
+    memcpy(buffer.data(), header.data(), header.size());
+    copyRowsFlipped(image, width, height, buffer.data() + header.size());
+    FILE* file = fopen(fileName.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool written = writeWhole(file, buffer);
+    return fclose(file) == 0 && written;
+}
+string frameFileName(const string& pattern, int frame) {
+    size_t found = pattern.find("%d");
+    if (found != string::npos) {
+        return pattern.substr(0, found) + to_string(frame) + pattern.substr(found + 2);
+    }
+    size_t dot = pattern.rfind('.');
+    if (dot == string::npos || pattern.find('/', dot) != string::npos) {
+        dot = pattern.size();
+    }
+    return pattern.substr(0, dot) + to_string(frame) + pattern.substr(dot);
+}
+PPMSink::PPMSink(string pattern) : pattern(move(pattern)) {}
+bool PPMSink::writeFrame(const unsigned char *image, int width, int height) {
+    return writePPMFile(frameFileName(pattern, frame++), image, width, height, buffer);
+}
+bool StreamSink::open(const string &fileName) {
+    if (fileName == "-") {
+#ifdef _WIN32
+        // Stop Windows from turning every 0x0A byte into 0x0D 0x0A
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        file = stdout;
+        return true;
+    }
+    file = fopen(fileName.c_str(), "wb");
+    ownsFile = true;
+    return file != nullptr;
+}
+bool StreamSink::writeBuffer() {
+    return writeWhole(file, buffer);
+}
+StreamSink::~StreamSink() {
+    if (file != nullptr && ownsFile) {
+        fclose(file);
+    }
+    else if (file != nullptr) {
+        fflush(file);
+    }
+}
+unique_ptr<RawSink> RawSink::create(const string &fileName) {
+    unique_ptr<RawSink> sink(new RawSink());
+    if (!sink->open(fileName)) {
+        return nullptr;
+    }
+    return sink;
+}
+bool RawSink::writeFrame(const unsigned char *image, int width, int height) {
+    buffer.resize((size_t)width * height * 3);
+    copyRowsFlipped(image, width, height, buffer.data());
+    return writeBuffer();
+}
+Y4MSink::Y4MSink(int framesPerSecond) : framesPerSecond(framesPerSecond) {}
+unique_ptr<Y4MSink> Y4MSink::create(const string &fileName, int framesPerSecond) {
+    unique_ptr<Y4MSink> sink(new Y4MSink(max(1, framesPerSecond)));
+    if (!sink->open(fileName)) {
+        return nullptr;
+    }
+    return sink;
+}
+bool Y4MSink::writeFrame(const unsigned char *image, int width, int height) {
+    // The stream header goes in front of the first frame and fixes the size
+    string header;
+    if (streamWidth == 0) {
+        streamWidth = width;
+        streamHeight = height;
+        header = "YUV4MPEG2 W" + to_string(width) + " H" + to_string(height) + " F" +
+                 to_string(framesPerSecond) + ":1 Ip A1:1 C420jpeg\n";
+    }
+    else if (width != streamWidth || height != streamHeight) {
+        return false;
+    }
+    header += "FRAME\n";
+    int chromaWidth = (width + 1) / 2;
+    int chromaHeight = (height + 1) / 2;
+    size_t lumaBytes = (size_t)width * height;
+    size_t chromaBytes = (size_t)chromaWidth * chromaHeight;
+    buffer.resize(header.size() + lumaBytes + 2 * chromaBytes);
+    memcpy(buffer.data(), header.data(), header.size());
+    unsigned char* lumaPlane = buffer.data() + header.size();
+    unsigned char* uPlane = lumaPlane + lumaBytes;
+    unsigned char* vPlane = uPlane + chromaBytes;
+    // BT.601 in 8 bit fixed point, chroma from the average of each 2x2 block
+    for (int y = 0; y < height; y++) {
+        const unsigned char* pixel = image + (size_t)(height - 1 - y) * width * 3;
+        unsigned char* luma = lumaPlane + (size_t)y * width;
+        for (int x = 0; x < width; x++, pixel += 3) {
+            luma[x] = (unsigned char)(((66 * pixel[0] + 129 * pixel[1] + 25 * pixel[2] + 128) >> 8) + 16);
+        }
+    }
+    for (int y = 0; y < chromaHeight; y++) {
+        int top = 2 * y;
+        int bottom = min(top + 1, height - 1);
+        const unsigned char* rows[2] = {image + (size_t)(height - 1 - top) * width * 3,
+                                        image + (size_t)(height - 1 - bottom) * width * 3};
+        for (int x = 0; x < chromaWidth; x++) {
+            int left = 2 * x;
+            int right = min(left + 1, width - 1);
+            int sum[3];
+            for (int k = 0; k < 3; k++) {
+                sum[k] = rows[0][left * 3 + k] + rows[0][right * 3 + k] + rows[1][left * 3 + k] +
+                         rows[1][right * 3 + k];
+            }
+            // Sums are 4x the average, the rounding constant and shift account for it
+            int u = ((-38 * sum[0] - 74 * sum[1] + 112 * sum[2] + 512) >> 10) + 128;
+            int v = ((112 * sum[0] - 94 * sum[1] - 18 * sum[2] + 512) >> 10) + 128;
+            uPlane[(size_t)y * chromaWidth + x] = (unsigned char)u;
+            vPlane[(size_t)y * chromaWidth + x] = (unsigned char)v;
+        }
+    }
+    return writeBuffer();
+}
+static bool endsWith(const string& text, const string& suffix) {
+    return text.size() >= suffix.size() &&
+           text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+static bool isY4MOutput(const string& output) {
+    return output == "-" || endsWith(output, ".y4m");
+}
+static bool isRawOutput(const string& output) {
+    return endsWith(output, ".rgb") || endsWith(output, ".raw");
+}
+bool isPPMOutput(const string& output) {
+    return !isY4MOutput(output) && !isRawOutput(output);
+}
+unique_ptr<ImageSink> openImageSink(const string& output, int framesPerSecond, string& error) {
+    if (isPPMOutput(output)) {
+        // PPM files are opened per frame
+        return unique_ptr<ImageSink>(new PPMSink(output));
+    }
+    unique_ptr<ImageSink> sink;
+    if (isY4MOutput(output)) {
+        sink = Y4MSink::create(output, framesPerSecond);
+    }
+    else {
+        sink = RawSink::create(output);
+    }
+    if (sink == nullptr) {
+        error = "Could not open " + output;
+    }
+    return sink;
+}
+bool writePPM(const string& fileName, const unsigned char* image, int width, int height) {
+    vector<unsigned char> buffer;
+    return writePPMFile(fileName, image, width, height, buffer);
+}
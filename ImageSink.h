@@ -0,0 +1,66 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdio>
+using namespace std;
+#pragma once
+// Somewhere to put rendered frames. Frames are RGB bytes as the ray tracer stores them, with
+// the bottom row first, every sink flips them to the usual top row first.
+class ImageSink {
+public:
+    virtual ~ImageSink() = default;
+    // Returns false if the frame couldn't be written
+    virtual bool writeFrame(const unsigned char* image, int width, int height) = 0;
+};
+// Frame file name, the first %d in pattern becomes the frame number (added before the
+// extension if there isn't one)
+string frameFileName(const string& pattern, int frame);
+// One PPM file per frame named by frameFileName, frames count from 0. Each file is put
+// together in memory and written in one go.
+class PPMSink : public ImageSink {
+    string pattern;
+    int frame = 0;
+    vector<unsigned char> buffer;
+public:
+    explicit PPMSink(string pattern);
+    bool writeFrame(const unsigned char* image, int width, int height) override;
+};
+// Frames written one after the other to a single file (or stdout), the sink owns the file
+class StreamSink : public ImageSink {
+protected:
+    FILE* file = nullptr;
+    bool ownsFile = false;
+    vector<unsigned char> buffer;
+    StreamSink() = default;
+    // Opens fileName for writing, "-" is stdout. Returns false if it can't be opened.
+    bool open(const string& fileName);
+    bool writeBuffer();
+public:
+    ~StreamSink() override;
+};
+// Raw RGB, 3 bytes per pixel with no header (ffmpeg -f rawvideo -pix_fmt rgb24 -s WxH)
+class RawSink : public StreamSink {
+public:
+    // Returns nullptr if the file can't be opened
+    static unique_ptr<RawSink> create(const string& fileName);
+    bool writeFrame(const unsigned char* image, int width, int height) override;
+};
+// YUV4MPEG2 stream (BT.601 limited range, 4:2:0) that video encoders read directly, every
+// frame must be the same size
+class Y4MSink : public StreamSink {
+    int framesPerSecond;
+    int streamWidth = 0;
+    int streamHeight = 0;
+    explicit Y4MSink(int framesPerSecond);
+public:
+    // Returns nullptr if the file can't be opened
+    static unique_ptr<Y4MSink> create(const string& fileName, int framesPerSecond);
+    bool writeFrame(const unsigned char* image, int width, int height) override;
+};
+// Picks a sink from the output name: "-" or .y4m for Y4M, .rgb or .raw for raw RGB and PPM
+// files for anything else (isPPMOutput). Returns nullptr and sets error if the output can't
+// be opened.
+bool isPPMOutput(const string& output);
+unique_ptr<ImageSink> openImageSink(const string& output, int framesPerSecond, string& error);
+// Single PPM file
+bool writePPM(const string& fileName, const unsigned char* image, int width, int height);
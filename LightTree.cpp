@@ -0,0 +1,144 @@
+#include "LightTree.h"
+#include <algorithm>
+static float dot(const Vec3& a, const Vec3& b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+// Cosine of the smallest angle between a unit vector and any direction in a cone around a
+// unit vector, given the cosine between the two and the cone's half angle
+static float widenedCosine(float cosAngle, float sinSpread, float cosSpread) {
+    if (cosAngle >= cosSpread) {
+        return 1.0f;
+    }
+    float sinAngle = sqrt(max(0.0f, 1.0f - cosAngle * cosAngle));
+    // cos(angle - spread)
+    return cosAngle * cosSpread + sinAngle * sinSpread;
+}
+// pow is most of importance's time, whole exponents can be squared instead
+static float power(float c, float exponent) {
+    int whole = (int)exponent;
+    if (whole != exponent || whole < 0 || whole > 256) {
+        return pow(c, exponent);
+    }
+    return wholePower(c, whole);
+}
+// Small integer hash (lowbias32), good enough to turn seeds into uniform random numbers
+static unsigned int hashBits(unsigned int x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+void LightTree::build(const vector<Point> &locations, const vector<float> &intensities) {
+    nodes.clear();
+    if (locations.empty()) {
+        return;
+    }
+    order.resize(locations.size());
+    for (int i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    nodes.reserve(2 * locations.size());
+    buildNode(locations, intensities, 0, (int)locations.size());
+}
+int LightTree::buildNode(const vector<Point> &locations, const vector<float> &intensities,
+                         int start, int end) {
+    int nodeIndex = (int)nodes.size();
+    nodes.emplace_back();
+    AABB bounds;
+    float intensity = 0.0f;
+    for (int i = start; i < end; i++) {
+        bounds.grow(locations[order[i]]);
+        intensity += max(intensities[order[i]], 0.0f);
+    }
+    Point center = bounds.center();
+    Vec3 halfSize = {bounds.maxBound.x - center.x, bounds.maxBound.y - center.y,
+                     bounds.maxBound.z - center.z};
+    nodes[nodeIndex].center = center;
+    nodes[nodeIndex].radius = sqrt(dot(halfSize, halfSize));
+    nodes[nodeIndex].intensity = intensity;
+    if (end - start == 1) {
+        nodes[nodeIndex].light = order[start];
+        return nodeIndex;
+    }
+    // Median split along the widest axis keeps the tree balanced, about log2(lights) deep
+    int axis = 0;
+    for (int k = 1; k < 3; k++) {
+        if (halfSize[k] > halfSize[axis]) {
+            axis = k;
+        }
+    }
+    int middle = start + (end - start) / 2;
+    nth_element(order.begin() + start, order.begin() + middle, order.begin() + end,
+                [&](int a, int b) { return locations[a][axis] < locations[b][axis]; });
+    buildNode(locations, intensities, start, middle);
+    nodes[nodeIndex].rightChild = buildNode(locations, intensities, middle, end);
+    return nodeIndex;
+}
+bool LightTree::empty() const {
+    return nodes.empty();
+}
+int LightTree::getNodeCount() const {
+    return (int)nodes.size();
+}
+float LightTree::importance(const Node &node, const LightQuery &query) const {
+    Vec3 toCenter = {node.center.x - query.x.x, node.center.y - query.x.y,
+                     node.center.z - query.x.z};
+    float distanceSquared = dot(toCenter, toCenter);
+    // Inside the sphere lights can be in any direction
+    float diffuseCos = 1.0f;
+    float specularCos = 1.0f;
+    if (distanceSquared > node.radius * node.radius) {
+        float distance = sqrt(distanceSquared);
+        Vec3 l = {toCenter.x / distance, toCenter.y / distance, toCenter.z / distance};
+        // Every light is within spread of l
+        float sinSpread = node.radius / distance;
+        float cosSpread = sqrt(max(0.0f, 1.0f - sinSpread * sinSpread));
+        diffuseCos = widenedCosine(dot(query.normal, l), sinSpread, cosSpread);
+        // The half vector between eye and a light turns by at most the light's angle from l
+        // while the two are under 120 degrees apart, past that it can point anywhere
+        float eyeCos = dot(query.eye, l);
+        float eyeSin = sqrt(max(0.0f, 1.0f - eyeCos * eyeCos));
+        if (eyeCos * cosSpread - eyeSin * sinSpread > -0.5f) {
+            Vec3 h = {query.eye.x + l.x, query.eye.y + l.y, query.eye.z + l.z};
+            float length = sqrt(dot(h, h));
+            specularCos = widenedCosine(dot(query.normal, h) / length, sinSpread, cosSpread);
+        }
+    }
+    return node.intensity * (query.diffuse * max(0.0f, diffuseCos) +
+                             query.specular * power(max(0.0f, specularCos), query.exponent));
+}
+int LightTree::sample(const LightQuery &query, float cullThreshold, unsigned int seed,
+                      float &pmf) const {
+    pmf = 1.0f;
+    if (nodes.empty() || importance(nodes[0], query) <= 0.0f) {
+        return -1;
+    }
+    int nodeIndex = 0;
+    unsigned int random = hashBits(seed);
+    while (nodes[nodeIndex].light == -1) {
+        int left = nodeIndex + 1;
+        int right = nodes[nodeIndex].rightChild;
+        float leftWeight = importance(nodes[left], query);
+        float rightWeight = importance(nodes[right], query);
+        leftWeight = leftWeight < cullThreshold * rightWeight ? 0.0f : leftWeight;
+        rightWeight = rightWeight < cullThreshold * leftWeight ? 0.0f : rightWeight;
+        float total = leftWeight + rightWeight;
+        if (total <= 0.0f) {
+            return -1;
+        }
+        random = hashBits(random + 0x9e3779b9u);
+        float u = (float)(random >> 8) * (1.0f / 16777216.0f);
+        float leftChance = leftWeight / total;
+        if (u < leftChance) {
+            nodeIndex = left;
+            pmf *= leftChance;
+        }
+        else {
+            nodeIndex = right;
+            pmf *= 1.0f - leftChance;
+        }
+    }
+    return nodes[nodeIndex].light;
+}
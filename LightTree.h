@@ -0,0 +1,50 @@
+#include <vector>
+#include "Vec3.h"
+#include "BVH.h"
+using namespace std;
+#pragma once
+// A shading point as the light tree sees it
+struct LightQuery {
+    Point x;
+    Vec3 normal;
+    // Unit vector from x towards where the ray came from
+    Vec3 eye;
+    // Largest channel of the diffuse and specular colors, and the Phong exponent
+    float diffuse;
+    float specular;
+    float exponent;
+};
+// Binary tree over point lights for picking a few of many lights at a shading point. Every
+// node has a sphere around its lights and their summed intensity, which bounds the light they
+// can add at a point (RayTracer::addLight before shadows): the intensity times the diffuse and
+// specular terms for the most favourable direction into the sphere.
+class LightTree {
+public:
+    // Leaves hold one light, interior nodes have their left child right after them and their
+    // right child at rightChild
+    struct Node {
+        Point center;
+        float radius = 0.0f;
+        float intensity = 0.0f;
+        // Light index for leaves, -1 for interior nodes
+        int light = -1;
+        int rightChild = 0;
+    };
+private:
+    vector<Node> nodes;
+    vector<int> order;
+    int buildNode(const vector<Point>& locations, const vector<float>& intensities, int start,
+                  int end);
+public:
+    void build(const vector<Point>& locations, const vector<float>& intensities);
+    bool empty() const;
+    int getNodeCount() const;
+    // Upper bound on the light the node's lights add at the query point
+    float importance(const Node& node, const LightQuery& query) const;
+    // Walks down from the root picking a child in proportion to its importance, a child under
+    // cullThreshold times its sibling's importance counts as 0. seed picks the random numbers
+    // (one per level), the same seed and query always give the same light. Returns the light
+    // (-1 if none can add light) and the probability it had of being picked in pmf.
+    int sample(const LightQuery& query, float cullThreshold, unsigned int seed,
+               float& pmf) const;
+};
@@ -0,0 +1,24 @@
+#include <string>
+#include <cstddef>
+using namespace std;
+#pragma once
+// Read only view of a whole file mapped into memory. Pages are read in as they're touched
+// and processes mapping the same file share them.
+class MappedFile {
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+    void close();
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+    // Returns false and sets error if the file can't be opened or mapped
+    bool open(const string& fileName, string& error);
+    const unsigned char* bytes() const;
+    size_t length() const;
+};
@@ -0,0 +1,99 @@
+#include "ObjLoader.h"
+#include "TextParser.h"
+namespace {
+// Parser state carried from one chunk to the next
+struct ObjParser {
+    vector<Point>& vertices;
+    vector<int>& indices;
+    string& error;
+    int line = 0;
+    ObjParser(vector<Point>& vertices, vector<int>& indices, string& error)
+            : vertices(vertices), indices(indices), error(error) {}
+    bool fail(const char* message) {
+        error = string(message) + " on line " + to_string(line);
+        return false;
+    }
+    // Parses every line in [c, end), end must be just past a '\n'
+    bool parse(const char* c, const char* end) {
+        while (c < end) {
+            line++;
+            c = skipSpaces(c);
+            if (c[0] == 'v' && (c[1] == ' ' || c[1] == '\t')) {
+                Point vertex;
+                for (int k = 0; k < 3; k++) {
+                    c = parseFloat(skipSpaces(c + (k == 0 ? 1 : 0)), vertex[k]);
+                    if (c == nullptr) {
+                        return fail("Bad vertex");
+                    }
+                }
+                vertices.push_back(vertex);
+            }
+            else if (c[0] == 'f' && (c[1] == ' ' || c[1] == '\t')) {
+                c = parseFace(c + 1);
+                if (c == nullptr) {
+                    return false;
+                }
+            }
+            c = skipLine(c);
+        }
+        return true;
+    }
+    // Corners look like v, v/vt, v/vt/vn or v//vn, only v is used. Negative indices count
+    // back from the last vertex read so far.
+    const char* parseFace(const char* c) {
+        int first = -1;
+        int previous = -1;
+        int corners = 0;
+        while (true) {
+            c = skipSpaces(c);
+            if (*c == '\n' || *c == '\r' || *c == '#') {
+                break;
+            }
+            int index;
+            c = parseInt(c, index);
+            if (c == nullptr) {
+                fail("Bad face");
+                return nullptr;
+            }
+            index = index < 0 ? (int)vertices.size() + index : index - 1;
+            if (index < 0 || index >= (int)vertices.size()) {
+                fail("Face index out of range");
+                return nullptr;
+            }
+            while (*c != ' ' && *c != '\t' && *c != '\r' && *c != '\n') {
+                c++;
+            }
+            // Fan out from the first corner
+            if (corners == 0) {
+                first = index;
+            }
+            else if (corners >= 2) {
+                indices.push_back(first);
+                indices.push_back(previous);
+                indices.push_back(index);
+            }
+            previous = index;
+            corners++;
+        }
+        if (corners < 3) {
+            fail("Face with fewer than 3 corners");
+            return nullptr;
+        }
+        return c;
+    }
+};
+}
+bool loadObj(const string& fileName, vector<Point>& vertices, vector<int>& indices,
+             string& error) {
+    vertices.clear();
+    indices.clear();
+    ObjParser parser(vertices, indices, error);
+    if (!readTextChunks(fileName, [&](const char* begin, const char* end) {
+        return parser.parse(begin, end);
+    }, error)) {
+        return false;
+    }
+    vertices.shrink_to_fit();
+    indices.shrink_to_fit();
+    return true;
+}
@@ -0,0 +1,12 @@
+#include <string>
+#include <vector>
+#include "Vec3.h"
+using namespace std;
+#pragma once
+// Reads the vertices and faces of a Wavefront OBJ file into a vertex list and a triangle index
+// list (3 per triangle, ready for RayTracer::Mesh). Faces with more than 3 corners become a fan
+// of triangles, everything else (normals, texture coordinates, groups, materials) is skipped.
+// The file is read in fixed size chunks and parsed in place without making a string per line.
+// Returns false and sets error if the file can't be read or a face is malformed.
+bool loadObj(const string& fileName, vector<Point>& vertices, vector<int>& indices,
+             string& error);
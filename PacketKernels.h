@@ -0,0 +1,301 @@
+#include "RayPacket.h"
+#pragma once
+// Packet kernels written once against a lane type L, each instruction set's source file
+// supplies L (see PacketKernelsSSE.cpp and PacketKernelsAVX2.cpp).
+// The math follows the scalar CompiledScene::intersect code operation for operation so
+// triangles and planes give the same distances as the scalar path.
+namespace {
+template <class L>
+struct PacketKernelsT {
+    typedef typename L::V V;
+    struct Rays {
+        V ox, oy, oz;
+        V dx, dy, dz;
+        V invDx, invDy, invDz;
+    };
+    static Rays loadRays(const RayPacket& packet) {
+        Rays rays;
+        rays.ox = L::load(packet.ox);
+        rays.oy = L::load(packet.oy);
+        rays.oz = L::load(packet.oz);
+        rays.dx = L::load(packet.dx);
+        rays.dy = L::load(packet.dy);
+        rays.dz = L::load(packet.dz);
+        // Same tiny value trick as BVH::inverseDirection
+        alignas(32) float inv[3][RayPacket::maxWidth];
+        const float* dirs[3] = {packet.dx, packet.dy, packet.dz};
+        for (int k = 0; k < 3; k++) {
+            for (int lane = 0; lane < L::width; lane++) {
+                float d = dirs[k][lane];
+                inv[k][lane] = 1.0f / (d > 1e-20f || d < -1e-20f ? d : (d < 0 ? -1e-20f : 1e-20f));
+            }
+        }
+        rays.invDx = L::load(inv[0]);
+        rays.invDy = L::load(inv[1]);
+        rays.invDz = L::load(inv[2]);
+        return rays;
+    }
+    // Distance to sphere i per lane, valid gets set for lanes that hit
+    static V intersectSphere(const SphereBucket& spheres, int i, const Rays& rays, V& valid) {
+        V zero = L::set(0.0f);
+        // x = p - center
+        V xx = L::sub(rays.ox, L::set(spheres.center.x[i]));
+        V xy = L::sub(rays.oy, L::set(spheres.center.y[i]));
+        V xz = L::sub(rays.oz, L::set(spheres.center.z[i]));
+        V dDotX = L::add(L::add(L::mul(rays.dx, xx), L::mul(rays.dy, xy)), L::mul(rays.dz, xz));
+        V xDotX = L::add(L::add(L::mul(xx, xx), L::mul(xy, xy)), L::mul(xz, xz));
+        // (d dot x)^2 - x dot x + R^2
+        V underRoot = L::add(L::sub(L::mul(dDotX, dDotX), xDotX),
+                             L::set(spheres.radiusSquared[i]));
+        valid = L::greaterEqual(underRoot, zero);
+        V root = L::sqrt(L::max(underRoot, zero));
+        V tStart = L::sub(zero, dDotX);
+        V t1 = L::add(tStart, root);
+        V t2 = L::sub(tStart, root);
+        // Lowest positive solution, t2 is never bigger than t1
+        V t = L::select(L::greater(t2, zero), t2, t1);
+        valid = L::andMask(valid, L::greater(t, zero));
+        return t;
+    }
+    // Plane intersection: (offset - p dot n) / (d dot n), offset is a dot n
+    static V intersectPlane(const PlaneBucket& planes, int i, const Rays& rays, V& valid) {
+        V zero = L::set(0.0f);
+        V nx = L::set(planes.normal.x[i]);
+        V ny = L::set(planes.normal.y[i]);
+        V nz = L::set(planes.normal.z[i]);
+        V pDotN = L::add(L::add(L::mul(rays.ox, nx), L::mul(rays.oy, ny)), L::mul(rays.oz, nz));
+        V topT = L::sub(L::set(planes.offset[i]), pDotN);
+        V bottomT = L::add(L::add(L::mul(rays.dx, nx), L::mul(rays.dy, ny)), L::mul(rays.dz, nz));
+        valid = L::notEqual(bottomT, zero);
+        V t = L::div(topT, bottomT);
+        valid = L::andNot(L::less(t, zero), valid);
+        return t;
+    }
+    // Moller Trumbore against the corner and edges worked out ahead of time
+    static V intersectTriangle(const TriangleBucket& tris, int i, const Rays& rays, V& valid) {
+        V zero = L::set(0.0f);
+        V e1x = L::set(tris.edge1.x[i]);
+        V e1y = L::set(tris.edge1.y[i]);
+        V e1z = L::set(tris.edge1.z[i]);
+        V e2x = L::set(tris.edge2.x[i]);
+        V e2y = L::set(tris.edge2.y[i]);
+        V e2z = L::set(tris.edge2.z[i]);
+        // d cross edge2
+        V sx = L::sub(L::mul(rays.dy, e2z), L::mul(rays.dz, e2y));
+        V sy = L::sub(L::mul(rays.dz, e2x), L::mul(rays.dx, e2z));
+        V sz = L::sub(L::mul(rays.dx, e2y), L::mul(rays.dy, e2x));
+        V det = L::add(L::add(L::mul(e1x, sx), L::mul(e1y, sy)), L::mul(e1z, sz));
+        // |det| > minDeterminant, rays closer to parallel miss
+        V minDet = L::set(tris.minDeterminant[i]);
+        valid = L::orMask(L::greater(det, minDet), L::less(det, L::sub(zero, minDet)));
+        V invDet = L::div(L::set(1.0f), det);
+        V ox = L::sub(rays.ox, L::set(tris.corner.x[i]));
+        V oy = L::sub(rays.oy, L::set(tris.corner.y[i]));
+        V oz = L::sub(rays.oz, L::set(tris.corner.z[i]));
+        V u = L::mul(L::add(L::add(L::mul(ox, sx), L::mul(oy, sy)), L::mul(oz, sz)), invDet);
+        // (p - corner) cross edge1
+        V qx = L::sub(L::mul(oy, e1z), L::mul(oz, e1y));
+        V qy = L::sub(L::mul(oz, e1x), L::mul(ox, e1z));
+        V qz = L::sub(L::mul(ox, e1y), L::mul(oy, e1x));
+        V v = L::mul(L::add(L::add(L::mul(rays.dx, qx), L::mul(rays.dy, qy)),
+                            L::mul(rays.dz, qz)), invDet);
+        V t = L::mul(L::add(L::add(L::mul(e2x, qx), L::mul(e2y, qy)), L::mul(e2z, qz)), invDet);
+        valid = L::andNot(L::less(u, zero), valid);
+        valid = L::andNot(L::less(v, zero), valid);
+        valid = L::andNot(L::greater(L::add(u, v), L::set(1.0f)), valid);
+        valid = L::andNot(L::less(t, zero), valid);
+        return t;
+    }
+    // BVH leaves only hold spheres and triangles
+    static V intersectBounded(const SceneView& scene, int id, const Rays& rays, V& valid) {
+        int i = id & primitiveIndexMask;
+        if ((id >> primitiveKindShift) == SphereKind) {
+            return intersectSphere(scene.spheres, i, rays, valid);
+        }
+        return intersectTriangle(scene.triangles, i, rays, valid);
+    }
+    static unsigned char boundedFlags(const SceneView& scene, int id) {
+        int i = id & primitiveIndexMask;
+        if ((id >> primitiveKindShift) == SphereKind) {
+            return scene.spheres.flags[i];
+        }
+        return scene.triangles.flags[i];
+    }
+    // Ray box slab test per lane against the current tMax
+    static V hitBox(const AABB& box, const Rays& rays, V tMax) {
+        V t1 = L::mul(L::sub(L::set(box.minBound.x), rays.ox), rays.invDx);
+        V t2 = L::mul(L::sub(L::set(box.maxBound.x), rays.ox), rays.invDx);
+        V tNear = L::max(L::set(0.0f), L::min(t1, t2));
+        V tFar = L::min(tMax, L::max(t1, t2));
+        t1 = L::mul(L::sub(L::set(box.minBound.y), rays.oy), rays.invDy);
+        t2 = L::mul(L::sub(L::set(box.maxBound.y), rays.oy), rays.invDy);
+        tNear = L::max(tNear, L::min(t1, t2));
+        tFar = L::min(tFar, L::max(t1, t2));
+        t1 = L::mul(L::sub(L::set(box.minBound.z), rays.oz), rays.invDz);
+        t2 = L::mul(L::sub(L::set(box.maxBound.z), rays.oz), rays.invDz);
+        tNear = L::max(tNear, L::min(t1, t2));
+        tFar = L::min(tFar, L::max(t1, t2));
+        return L::lessEqual(tNear, tFar);
+    }
+    static void closestHitSpheres(const SphereBucket& spheres, int kind,
+                                  unsigned char visibility, const Rays& rays, V active,
+                                  V& tMax, V& hit) {
+        for (int i = 0; i < spheres.count; i++) {
+            if ((spheres.flags[i] & visibility) == 0) {
+                continue;
+            }
+            V valid;
+            V t = intersectSphere(spheres, i, rays, valid);
+            V closer = L::andMask(L::andMask(valid, active), L::less(t, tMax));
+            tMax = L::select(closer, t, tMax);
+            hit = L::select(closer, L::indexBits((kind << primitiveKindShift) | i), hit);
+        }
+    }
+    static void closestHit(const SceneView& scene, RayPacket& packet, unsigned char visibility,
+                           bool includeLights) {
+        Rays rays = loadRays(packet);
+        V active = L::laneMask(packet.activeMask);
+        V tMax = L::load(packet.tMax);
+        V hit = L::loadIndices(packet.hit);
+        RAYTRACER_STAT(int activeLanes = laneCount(packet.activeMask));
+        RAYTRACER_STAT(for (int kind = 0; kind < primitiveKindCount; kind++) {
+            packet.kindTests[kind] = 0;
+        })
+        if (scene.nodeCount > 0) {
+            const BVH::Node* nodes = scene.nodes;
+            const int* leafIds = scene.leafIds;
+            int stack[BVH::stackSize];
+            int stackTop = 0;
+            stack[stackTop++] = 0;
+            while (stackTop > 0) {
+                int nodeIndex = stack[--stackTop];
+                const BVH::Node& node = nodes[nodeIndex];
+                // Visit the node if any active lane enters it
+                V entered = L::andMask(hitBox(node.bounds, rays, tMax), active);
+                if (L::mask(entered) == 0) {
+                    continue;
+                }
+                if (node.count > 0) {
+                    for (int i = node.start; i < node.start + node.count; i++) {
+                        int id = leafIds[i];
+                        if ((boundedFlags(scene, id) & visibility) == 0) {
+                            continue;
+                        }
+                        RAYTRACER_STAT(packet.kindTests[id >> primitiveKindShift] +=
+                                               laneCount(L::mask(entered)));
+                        V valid;
+                        V t = intersectBounded(scene, id, rays, valid);
+                        V closer = L::andMask(L::andMask(valid, entered), L::less(t, tMax));
+                        tMax = L::select(closer, t, tMax);
+                        hit = L::select(closer, L::indexBits(id), hit);
+                    }
+                    continue;
+                }
+                stack[stackTop++] = node.rightChild;
+                stack[stackTop++] = nodeIndex + 1;
+            }
+        }
+        const PlaneBucket& planes = scene.planes;
+        for (int i = 0; i < planes.count; i++) {
+            if ((planes.flags[i] & visibility) == 0) {
+                continue;
+            }
+            RAYTRACER_STAT(packet.kindTests[PlaneKind] += activeLanes);
+            V valid;
+            V t = intersectPlane(planes, i, rays, valid);
+            V closer = L::andMask(L::andMask(valid, active), L::less(t, tMax));
+            tMax = L::select(closer, t, tMax);
+            hit = L::select(closer, L::indexBits((PlaneKind << primitiveKindShift) | i), hit);
+        }
+        if (includeLights) {
+            closestHitSpheres(scene.lights, LightKind, visibility, rays, active, tMax, hit);
+            RAYTRACER_STAT(for (int i = 0; i < scene.lights.count; i++) {
+                if (scene.lights.flags[i] & visibility) {
+                    packet.kindTests[LightKind] += activeLanes;
+                }
+            })
+        }
+        L::store(packet.tMax, tMax);
+        L::storeIndices(packet.hit, hit);
+    }
+    static int laneCount(int bits) {
+        int count = 0;
+        for (; bits != 0; bits &= bits - 1) {
+            count++;
+        }
+        return count;
+    }
+    // Tests primitive id for the lanes in active, blocked lanes leave active and record id
+    static void occlude(const SceneView& scene, int id, const Rays& rays, V tMax, V& active,
+                        V& blocked, V& blocker, RayPacket& packet) {
+        int lanes = laneCount(L::mask(active));
+        packet.tests += lanes;
+        RAYTRACER_STAT(packet.kindTests[id >> primitiveKindShift] += lanes);
+        V valid;
+        V t;
+        if ((id >> primitiveKindShift) == PlaneKind) {
+            int i = id & primitiveIndexMask;
+            t = intersectPlane(scene.planes, i, rays, valid);
+        }
+        else {
+            t = intersectBounded(scene, id, rays, valid);
+        }
+        V hit = L::andMask(L::andMask(valid, active), L::less(t, tMax));
+        blocked = L::orMask(blocked, hit);
+        blocker = L::select(hit, L::indexBits(id), blocker);
+        active = L::andNot(hit, active);
+    }
+    static void occluded(const SceneView& scene, RayPacket& packet) {
+        Rays rays = loadRays(packet);
+        V active = L::laneMask(packet.activeMask);
+        V tMax = L::load(packet.tMax);
+        V blocked = L::set(0.0f);
+        V blocker = L::indexBits(-1);
+        packet.tests = 0;
+        RAYTRACER_STAT(for (int kind = 0; kind < primitiveKindCount; kind++) {
+            packet.kindTests[kind] = 0;
+        })
+        // Planes first, they block a lot of light and are cheap
+        const PlaneBucket& planes = scene.planes;
+        for (int i = 0; i < planes.count && L::mask(active) != 0; i++) {
+            if ((planes.flags[i] & ShadowRays) == 0) {
+                continue;
+            }
+            occlude(scene, (PlaneKind << primitiveKindShift) | i, rays, tMax, active, blocked,
+                    blocker, packet);
+        }
+        if (scene.nodeCount > 0 && L::mask(active) != 0) {
+            const BVH::Node* nodes = scene.nodes;
+            const int* leafIds = scene.leafIds;
+            int stack[BVH::stackSize];
+            int stackTop = 0;
+            stack[stackTop++] = 0;
+            // Lanes drop out as soon as they are blocked, stop once none are left
+            while (stackTop > 0 && L::mask(active) != 0) {
+                int nodeIndex = stack[--stackTop];
+                const BVH::Node& node = nodes[nodeIndex];
+                V entered = L::andMask(hitBox(node.bounds, rays, tMax), active);
+                if (L::mask(entered) == 0) {
+                    continue;
+                }
+                if (node.count > 0) {
+                    V outside = L::andNot(entered, active);
+                    for (int i = node.start; i < node.start + node.count && L::mask(entered) != 0; i++) {
+                        int id = leafIds[i];
+                        if ((boundedFlags(scene, id) & ShadowRays) == 0) {
+                            continue;
+                        }
+                        occlude(scene, id, rays, tMax, entered, blocked, blocker, packet);
+                    }
+                    active = L::orMask(outside, entered);
+                    continue;
+                }
+                stack[stackTop++] = node.rightChild;
+                stack[stackTop++] = nodeIndex + 1;
+            }
+        }
+        L::storeIndices(packet.hit, blocker);
+        packet.blockedMask = L::mask(blocked) & packet.activeMask;
+    }
+};
+}
@@ -0,0 +1,54 @@
+#include "PacketKernels.h"
+// Only has kernels when this file is built with AVX2 enabled (see CMakeLists.txt), the CPU
+// is checked at runtime before they get used
+#if defined(__AVX2__)
+#include <immintrin.h>
+// 8 wide lanes
+namespace {
+struct AVX2Lanes {
+    typedef __m256 V;
+    static const int width = 8;
+    static V load(const float* p) { return _mm256_load_ps(p); }
+    static void store(float* p, V v) { _mm256_store_ps(p, v); }
+    static V set(float f) { return _mm256_set1_ps(f); }
+    static V add(V a, V b) { return _mm256_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+    static V div(V a, V b) { return _mm256_div_ps(a, b); }
+    static V sqrt(V a) { return _mm256_sqrt_ps(a); }
+    static V min(V a, V b) { return _mm256_min_ps(a, b); }
+    static V max(V a, V b) { return _mm256_max_ps(a, b); }
+    static V less(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static V lessEqual(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    static V greater(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static V greaterEqual(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    static V notEqual(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_NEQ_UQ); }
+    static V andMask(V a, V b) { return _mm256_and_ps(a, b); }
+    static V orMask(V a, V b) { return _mm256_or_ps(a, b); }
+    // b with the lanes set in a cleared
+    static V andNot(V a, V b) { return _mm256_andnot_ps(a, b); }
+    // mask ? a : b
+    static V select(V mask, V a, V b) { return _mm256_blendv_ps(b, a, mask); }
+    static int mask(V m) { return _mm256_movemask_ps(m); }
+    static V laneMask(int bits) {
+        __m256i laneBits = _mm256_set_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+        return _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(bits), laneBits),
+                                                      laneBits));
+    }
+    // Integers travel through the float registers as raw bits
+    static V indexBits(int index) { return _mm256_castsi256_ps(_mm256_set1_epi32(index)); }
+    static V loadIndices(const int* p) { return _mm256_castsi256_ps(_mm256_load_si256((const __m256i*)p)); }
+    static void storeIndices(int* p, V v) { _mm256_store_si256((__m256i*)p, _mm256_castps_si256(v)); }
+};
+}
+static const PacketKernels avx2Kernels = {"avx2", AVX2Lanes::width,
+                                          &PacketKernelsT<AVX2Lanes>::closestHit,
+                                          &PacketKernelsT<AVX2Lanes>::occluded};
+const PacketKernels* avx2PacketKernels() {
+    return &avx2Kernels;
+}
+#else
+const PacketKernels* avx2PacketKernels() {
+    return nullptr;
+}
+#endif
@@ -0,0 +1,51 @@
+#include "PacketKernels.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+// 4 wide lanes, SSE2 only so it runs on any x86-64 CPU
+namespace {
+struct SSELanes {
+    typedef __m128 V;
+    static const int width = 4;
+    static V load(const float* p) { return _mm_load_ps(p); }
+    static void store(float* p, V v) { _mm_store_ps(p, v); }
+    static V set(float f) { return _mm_set1_ps(f); }
+    static V add(V a, V b) { return _mm_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+    static V div(V a, V b) { return _mm_div_ps(a, b); }
+    static V sqrt(V a) { return _mm_sqrt_ps(a); }
+    static V min(V a, V b) { return _mm_min_ps(a, b); }
+    static V max(V a, V b) { return _mm_max_ps(a, b); }
+    static V less(V a, V b) { return _mm_cmplt_ps(a, b); }
+    static V lessEqual(V a, V b) { return _mm_cmple_ps(a, b); }
+    static V greater(V a, V b) { return _mm_cmpgt_ps(a, b); }
+    static V greaterEqual(V a, V b) { return _mm_cmpge_ps(a, b); }
+    static V notEqual(V a, V b) { return _mm_cmpneq_ps(a, b); }
+    static V andMask(V a, V b) { return _mm_and_ps(a, b); }
+    static V orMask(V a, V b) { return _mm_or_ps(a, b); }
+    // b with the lanes set in a cleared
+    static V andNot(V a, V b) { return _mm_andnot_ps(a, b); }
+    // mask ? a : b (no blendv before SSE4.1)
+    static V select(V mask, V a, V b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+    static int mask(V m) { return _mm_movemask_ps(m); }
+    static V laneMask(int bits) {
+        __m128i laneBits = _mm_set_epi32(8, 4, 2, 1);
+        return _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(bits), laneBits), laneBits));
+    }
+    // Integers travel through the float registers as raw bits
+    static V indexBits(int index) { return _mm_castsi128_ps(_mm_set1_epi32(index)); }
+    static V loadIndices(const int* p) { return _mm_castsi128_ps(_mm_load_si128((const __m128i*)p)); }
+    static void storeIndices(int* p, V v) { _mm_store_si128((__m128i*)p, _mm_castps_si128(v)); }
+};
+}
+static const PacketKernels sseKernels = {"sse", SSELanes::width,
+                                         &PacketKernelsT<SSELanes>::closestHit,
+                                         &PacketKernelsT<SSELanes>::occluded};
+const PacketKernels* ssePacketKernels() {
+    return &sseKernels;
+}
+#else
+const PacketKernels* ssePacketKernels() {
+    return nullptr;
+}
+#endif
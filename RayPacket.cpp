@@ -0,0 +1,49 @@
+#include "RayPacket.h"
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+void RayPacket::setRay(int lane, const Point &p, const Vec3 &d, float maxT) {
+    ox[lane] = p.x;
+    oy[lane] = p.y;
+    oz[lane] = p.z;
+    dx[lane] = d.x;
+    dy[lane] = d.y;
+    dz[lane] = d.z;
+    tMax[lane] = maxT;
+    hit[lane] = -1;
+}
+// True if the CPU (and OS) can run AVX2 code
+static bool cpuHasAVX2() {
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int info[4];
+    __cpuid(info, 1);
+    // OSXSAVE and AVX, then check the OS saves the YMM registers
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 ||
+        (_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return false;
+#endif
+}
+const PacketKernels* selectPacketKernels(int width) {
+    static const bool hasAVX2 = cpuHasAVX2();
+    const PacketKernels* avx2 = hasAVX2 ? avx2PacketKernels() : nullptr;
+    const PacketKernels* sse = ssePacketKernels();
+    if (width == 8) {
+        return avx2;
+    }
+    if (width == 4) {
+        return sse;
+    }
+    if (width == 0) {
+        return avx2 != nullptr ? avx2 : sse;
+    }
+    return nullptr;
+}
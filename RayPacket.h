@@ -0,0 +1,46 @@
+#include "Vec3.h"
+#include "CompiledScene.h"
+#include "RenderStats.h"
+#pragma once
+// Up to 8 rays traced together, stored one array per component so SIMD lanes line up
+struct RayPacket {
+    static const int maxWidth = 8;
+    alignas(32) float ox[maxWidth];
+    alignas(32) float oy[maxWidth];
+    alignas(32) float oz[maxWidth];
+    alignas(32) float dx[maxWidth];
+    alignas(32) float dy[maxWidth];
+    alignas(32) float dz[maxWidth];
+    // Closest hit so far for primary rays, distance to the light for shadow rays
+    alignas(32) float tMax[maxWidth];
+    // Id of the primitive hit (-1 for none), for shadow rays the one blocking the light
+    alignas(32) int hit[maxWidth];
+    // Bit per lane, only set lanes are traced
+    int activeMask = 0;
+    // Bit per lane, set for shadow rays that are blocked
+    int blockedMask = 0;
+    // Primitive tests summed over the lanes
+    int tests = 0;
+#ifdef RAYTRACER_STATS
+    // Primitive tests summed over the lanes by PrimitiveKind, set by each kernel call
+    int kindTests[primitiveKindCount];
+#endif
+    void setRay(int lane, const Point& p, const Vec3& d, float maxT);
+};
+// One instruction set's kernels
+struct PacketKernels {
+    const char* name;
+    int width;
+    // Finds the closest hit among primitives visible to the given RayVisibility for every
+    // active lane, lowering tMax and setting hit to the primitive id
+    void (*closestHit)(const SceneView& scene, RayPacket& packet, unsigned char visibility,
+                       bool includeLights);
+    // Sets blockedMask (and hit) for active lanes that hit a shadow casting primitive closer
+    // than tMax
+    void (*occluded)(const SceneView& scene, RayPacket& packet);
+};
+// Kernels for each instruction set, nullptr when not compiled in
+const PacketKernels* ssePacketKernels();
+const PacketKernels* avx2PacketKernels();
+// Picks kernels for the requested width (0 for the widest the CPU supports), nullptr if none
+const PacketKernels* selectPacketKernels(int width);
@@ -1,233 +1,1314 @@
 #include "RayTracer.h"
-vector<float> RayTracer::addVec(const vector<float> &a, const vector<float> &b) {
-    return {a[0] + b[0], a[1] + b[1], a[2] + b[2]};
+#include "ImageSink.h"
+#include <map>
+#include <chrono>
+#include <cstring>
+void RayTracer::assignMaterials(vector<ColorPack>& materials) const {
+    materials.clear();
+    objectMaterials.resize(objects.size());
+    // Objects with the same colors share a material
+    map<string, int> materialLookup;
+    for (int k = 0; k < objects.size(); k++) {
+        const ColorPack& color = objects.at(k)->color;
+        string key((const char*)&color.ambientConstant, sizeof(ByteColor));
+        key.append((const char*)&color.diffuseConstant, sizeof(ByteColor));
+        key.append((const char*)&color.specularConstant, sizeof(ByteColor));
+        key.append((const char*)&color.phongExponent, sizeof(float));
+        key.push_back(color.reflect ? 1 : 0);
+        auto found = materialLookup.find(key);
+        if (found == materialLookup.end()) {
+            found = materialLookup.insert({key, (int)materials.size()}).first;
+            materials.push_back(color);
+        }
+        objectMaterials[k] = found->second;
+    }
 }
-vector<float> RayTracer::scalarVec(float scalar, const vector<float> &a) {
-    return {a[0] * scalar, a[1] * scalar, a[2] * scalar};
+void RayTracer::compileObjects() const {
+    shared_ptr<CompiledScene> geometry = make_shared<CompiledScene>();
+    vector<ColorPack> materials;
+    assignMaterials(materials);
+    for (int k = 0; k < objects.size(); k++) {
+        objects.at(k)->compile(*geometry, objectMaterials[k]);
+    }
+    if (!refitPending || !geometry->finish(*scene->compiled)) {
+        geometry->finish();
+    }
+    refitPending = false;
+    makeScene(move(geometry), nullptr, move(materials));
+    accelerationBuilt = true;
 }
-float RayTracer::dotVec(const vector<float> &a, const vector<float> &b) {
-    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+void RayTracer::buildAcceleration() {
+    refitPending = false;
+    compileObjects();
+    fixedScene = false;
 }
-vector<float> RayTracer::crossVec(const vector<float> &a, const vector<float> &b) {
-    return {a[1]*b[2] - a[2]*b[1], a[2]*b[0]-a[0]*b[2], a[0]*b[1]-a[1]*b[0]};
+void RayTracer::invalidateAcceleration() {
+    accelerationBuilt = false;
+    refitPending = false;
 }
-float RayTracer::vecMag(const vector<float> &a) {
-    return sqrt(pow(a[0], 2) + pow(a[1], 2) + pow(a[2], 2));
+void RayTracer::refitAcceleration() {
+    // Only a scene compiled from these objects has its primitives in the same order
+    if (accelerationBuilt && !fixedScene && scene->mapped == nullptr) {
+        refitPending = true;
+    }
+    accelerationBuilt = false;
 }
-vector<float> RayTracer::normalizeVec(const vector<float> &a) {
-    float mag = vecMag(a);
-    return {a[0] / mag, a[1] / mag, a[2] / mag};
+void RayTracer::updateMaterials() {
+    // The next frame builds everything anyway, and mapped scenes keep their own materials
+    if (fixedScene || !accelerationBuilt || scene->mapped != nullptr) {
+        return;
+    }
+    if (objectMaterials.size() != objects.size()) {
+        buildAcceleration();
+        return;
+    }
+    // The compiled primitives keep their material indices as long as the objects are grouped
+    // into materials the same way
+    vector<int> oldMaterials = objectMaterials;
+    vector<ColorPack> materials;
+    assignMaterials(materials);
+    if (objectMaterials != oldMaterials) {
+        buildAcceleration();
+        return;
+    }
+    makeScene(scene->compiled, nullptr, move(materials));
 }
-vector<float> RayTracer::multiplyVec(const vector<float> &a, const vector<float>
-&b) {
-    return {a[0] * b[0], a[1] * b[1], a[2] * b[2]};
+void RayTracer::makeScene(shared_ptr<const CompiledScene> geometry,
+                          shared_ptr<const MappedFile> mapped,
+                          vector<ColorPack> materials) const {
+    shared_ptr<Scene> next = make_shared<Scene>();
+    next->mapped = move(mapped);
+    next->compiled = move(geometry);
+    next->materials = move(materials);
+    next->backgroundColor = backgroundColor;
+    next->ambientIntensity = ambientIntensity;
+    next->shadingMaterials.resize(next->materials.size());
+    for (int i = 0; i < next->materials.size(); i++) {
+        const ColorPack& color = next->materials[i];
+        ShadingMaterial& material = next->shadingMaterials[i];
+        material.ambientColor = scaleColor(color.ambientConstant);
+        material.ambientLight = scalarVec(ambientIntensity, material.ambientColor);
+        material.diffuseColor = scaleColor(color.diffuseConstant);
+        material.specularColor = scaleColor(color.specularConstant);
+        material.phongExponent = color.phongExponent;
+        int whole = (int)color.phongExponent;
+        bool isWhole = (float)whole == color.phongExponent && whole >= 0 && whole <= 256;
+        material.wholeExponent = isWhole ? whole : -1;
+        material.reflect = color.reflect;
+    }
+    vector<Point> locations(lights.size());
+    vector<float> intensities(lights.size());
+    next->lights.reserve(lights.size());
+    for (int i = 0; i < lights.size(); i++) {
+        next->lights.push_back(*lights[i]);
+        locations[i] = lights[i]->location;
+        intensities[i] = lights[i]->intensity;
+        next->lightIntensitySum += lights[i]->intensity;
+    }
+    next->lightTree.build(locations, intensities);
+    next->treeCost = scene != nullptr && scene->compiled == next->compiled ?
+                     scene->treeCost : next->compiled->getBVH().cost();
+    scene = move(next);
 }
-vector<float> RayTracer::scaleColor(const vector<unsigned char> &a) {
-    return {a[0] / 255.0f, a[1] / 255.0f, a[2] / 255.0f};
+void RayTracer::updateScene() const {
+    if (!accelerationBuilt) {
+        compileObjects();
+        return;
+    }
+    // Lights and settings are cheap to compare every frame, the compiled objects are kept
+    bool changed = scene->backgroundColor != backgroundColor ||
+                   scene->ambientIntensity != ambientIntensity ||
+                   scene->lights.size() != lights.size();
+    for (int i = 0; !changed && i < lights.size(); i++) {
+        const Light& light = *lights[i];
+        const Light& old = scene->lights[i];
+        changed = light.location.x != old.location.x || light.location.y != old.location.y ||
+                  light.location.z != old.location.z || light.intensity != old.intensity;
+    }
+    if (changed) {
+        makeScene(scene->compiled, scene->mapped, scene->materials);
+    }
 }
-vector<float> RayTracer::findColor(vector<float> p, vector<float> d, int num, int
-limit) {
-    // Iterate through all objects, finding closest one the ray hits
-    float minT = -1;
-    Object* hitObject;
-    for (int k = 0; k < objects.size(); k++) {
-        if (dynamic_cast<LightObj*>(objects.at(k)) != nullptr) {
-            if (!lightVisualization || num > 0) {
-                continue;
+shared_ptr<const RayTracer::Scene> RayTracer::getScene() const {
+    lock_guard<mutex> guard(sceneLock);
+    if (!fixedScene) {
+        updateScene();
+    }
+    return scene;
+}
+int RayTracer::closestHit(const Point &p, const Vec3 &d, unsigned char visibility,
+                          bool includeLights, float &minT, TraceContext &context) {
+    // Only stats builds read context, to time the traversal
+    (void)context;
+    RAYTRACER_STAT(StageScope stage(context.clock, TraversalStage));
+    const SceneView& view = compiled->view();
+    int hit = -1;
+    float tMax = numeric_limits<float>::max();
+    if (useBVH) {
+        // Spheres and triangles through the tree
+        hit = compiled->getBVH().closestHit(p, d, tMax, [&](int index) {
+            int id = compiled->boundedId(index);
+            if ((compiled->getFlags(id) & visibility) == 0) {
+                return -1.0f;
+            }
+            RAYTRACER_STAT(context.counters.tests[id >> primitiveKindShift]++);
+            return compiled->intersect(id, p, d);
+        });
+        if (hit != -1) {
+            hit = compiled->boundedId(hit);
+        }
+    }
+    else {
+        // Iterate through all spheres and triangles, finding closest one the ray hits
+        for (int i = 0; i < view.spheres.count; i++) {
+            int id = (SphereKind << primitiveKindShift) | i;
+            RAYTRACER_STAT(context.counters.tests[SphereKind] +=
+                               (view.spheres.flags[i] & visibility) != 0);
+            float t = (view.spheres.flags[i] & visibility) ? compiled->intersect(id, p, d) : -1;
+            if (t != -1 && t < tMax) {
+                tMax = t;
+                hit = id;
             }
         }
-        float t = objects.at(k)->intersection(p, d);
-        if (t == -1) {
+        for (int i = 0; i < view.triangles.count; i++) {
+            int id = (TriangleKind << primitiveKindShift) | i;
+            RAYTRACER_STAT(context.counters.tests[TriangleKind] +=
+                               (view.triangles.flags[i] & visibility) != 0);
+            float t = (view.triangles.flags[i] & visibility) ? compiled->intersect(id, p, d) : -1;
+            if (t != -1 && t < tMax) {
+                tMax = t;
+                hit = id;
+            }
+        }
+    }
+    // Planes (and lights when visible) have to be checked directly
+    for (int i = 0; i < view.planes.count; i++) {
+        int id = (PlaneKind << primitiveKindShift) | i;
+        RAYTRACER_STAT(context.counters.tests[PlaneKind] +=
+                           (view.planes.flags[i] & visibility) != 0);
+        float t = (view.planes.flags[i] & visibility) ? compiled->intersect(id, p, d) : -1;
+        if (t != -1 && t < tMax) {
+            tMax = t;
+            hit = id;
+        }
+    }
+    for (int i = 0; includeLights && i < view.lights.count; i++) {
+        int id = (LightKind << primitiveKindShift) | i;
+        RAYTRACER_STAT(context.counters.tests[LightKind] +=
+                           (view.lights.flags[i] & visibility) != 0);
+        float t = (view.lights.flags[i] & visibility) ? compiled->intersect(id, p, d) : -1;
+        if (t != -1 && t < tMax) {
+            tMax = t;
+            hit = id;
+        }
+    }
+    minT = hit != -1 ? tMax : -1;
+    RAYTRACER_STAT((hit != -1 ? context.counters.hits : context.counters.misses)++);
+    return hit;
+}
+bool RayTracer::occluded(const Point &p, const Vec3 &d, float maxT, TraceContext &context) {
+    RAYTRACER_STAT(StageScope stage(context.clock, TraversalStage));
+    ShadowStats& stats = context.stats;
+    stats.rays++;
+    const SceneView& view = compiled->view();
+    int blocker = -1;
+    for (int i = 0; i < view.planes.count && blocker == -1; i++) {
+        if ((view.planes.flags[i] & ShadowRays) == 0) {
             continue;
         }
-        if (minT == -1 || t < minT) {
-            minT = t;
-            hitObject = objects.at(k);
-        }
-    }
-    // If an object was found
-    if (minT != -1) {
-        // Hit location
-        vector<float> x = addVec(p, scalarVec(minT, d));
-        // Color and normal of surface
-        vector<float> ambientColor = scaleColor(hitObject->color.ambientConstant);
-        vector<float> diffuseColor = scaleColor(hitObject->color.diffuseConstant);
-        vector<float> specularColor = scaleColor(hitObject->color.specularConstant);
-        vector<float> normal = hitObject->getNormal(x);
-        // For lights, just give full ambient color
-        if (dynamic_cast<LightObj*>(hitObject) != nullptr) {
-            return ambientColor;
-        }
-        vector<float> totalLight = {0, 0, 0};
-        // Ambient Lighting
-        // Adds Ambient Intensity * Ambient Color Constant
-        totalLight = scalarVec(ambientIntensity, ambientColor);
-        // Vector from surface to current light
-        for (int lightNum = 0; lightNum < lights.size(); lightNum++) {
-            // Vector from surface to light
-            vector<float> lightVec = normalizeVec(addVec(lights.at(lightNum)->location, scalarVec(-1, x)));
-            vector<float> rayPoint = addVec(x, scalarVec(distanceAwayConstant,
-                                                         lightVec));
-            float lightT = vecMag(addVec(lights.at(lightNum)->location, scalarVec(-
-                                                                                          1, rayPoint)));
-            // Ray trace to find any objects blocking light
-            bool inShadow = false;
-            for (int k = 0; k < objects.size(); k++) {
-                if (dynamic_cast<LightObj*>(objects.at(k)) != nullptr) {
+        int id = (PlaneKind << primitiveKindShift) | i;
+        stats.tests++;
+        RAYTRACER_STAT(context.counters.tests[PlaneKind]++);
+        float foundT = compiled->intersect(id, p, d);
+        // If found and not past the light
+        if (foundT != -1 && foundT < maxT) {
+            blocker = id;
+        }
+    }
+    if (blocker == -1 && useBVH) {
+        int index = compiled->getBVH().anyHit(p, d, maxT, [&](int index) {
+            int id = compiled->boundedId(index);
+            if ((compiled->getFlags(id) & ShadowRays) == 0) {
+                return -1.0f;
+            }
+            stats.tests++;
+            RAYTRACER_STAT(context.counters.tests[id >> primitiveKindShift]++);
+            return compiled->intersect(id, p, d);
+        });
+        blocker = index != -1 ? compiled->boundedId(index) : -1;
+    }
+    else if (blocker == -1) {
+        const int kinds[2] = {SphereKind, TriangleKind};
+        const unsigned char* flags[2] = {view.spheres.flags, view.triangles.flags};
+        const int counts[2] = {view.spheres.count, view.triangles.count};
+        for (int kind = 0; kind < 2 && blocker == -1; kind++) {
+            for (int i = 0; i < counts[kind] && blocker == -1; i++) {
+                if ((flags[kind][i] & ShadowRays) == 0) {
                     continue;
                 }
-                float foundT = objects.at(k)->intersection(rayPoint, lightVec);
-                // If found and not past the light
-                if (foundT != -1 && foundT < lightT) {
-                    inShadow = true;
-                    break;
+                int id = (kinds[kind] << primitiveKindShift) | i;
+                stats.tests++;
+                RAYTRACER_STAT(context.counters.tests[kinds[kind]]++);
+                float foundT = compiled->intersect(id, p, d);
+                if (foundT != -1 && foundT < maxT) {
+                    blocker = id;
                 }
             }
-            // If not in shadow, add contributing light
-            if (!inShadow) {
-                // Diffuse
-                // Adds Intensity * max(0, n dot l) * Diffuse Constant
-                totalLight = addVec(scalarVec(lights.at(lightNum)->intensity,scalarVec(max(0.0f, dotVec(normal, lightVec)), diffuseColor)),
-                                    totalLight);
-                // Specular
-                vector<float> eyeVec = normalizeVec(addVec(p, scalarVec(-1, x)));
-                vector<float> h = normalizeVec(addVec(eyeVec, lightVec));
-                // Adds Intensity * max(0, (n dot h)^p) * Specular Constant
-                totalLight = addVec(scalarVec(lights.at(lightNum)->intensity,scalarVec(pow(max(0.0f, dotVec(normal, h)), hitObject->color.phongExponent), specularColor)), totalLight);
-            }
-            // Reflective
-            if (hitObject->color.reflect && num < limit) {
-                vector<float> r = addVec(d, scalarVec(-2 * dotVec(d, normal),
-                                                      normal));
-                vector<float> reflectRayPoint = addVec(x,
-                                                       scalarVec(distanceAwayConstant, r));
-                // Adds Intensity * findColor(reflectRayPoint, r, num + 1, limit) * specularColor
-                        totalLight = addVec(scalarVec(lights.at(lightNum)->intensity,multiplyVec(findColor(reflectRayPoint, r, num + 1, limit),specularColor)), totalLight);
-            }
         }
-        // Clamp any values higher than 1 to 1
-        return {min(totalLight[0], 1.0f), min(totalLight[1], 1.0f),
-                min(totalLight[2], 1.0f)};
     }
+    if (blocker == -1) {
+        return false;
+    }
+    RAYTRACER_STAT(context.counters.shadowEarlyOuts++);
+    return true;
+}
+void RayTracer::startShading(const Point &p, const Vec3 &d, int hit, float minT,
+                             TraceContext &context, Shading &shading) {
+    const ShadingMaterial& material = frameScene->shadingMaterials[compiled->getMaterial(hit)];
+    shading.p = p;
+    shading.d = d;
+    shading.context = &context;
+    shading.hit = hit;
+    shading.material = &material;
+    // Hit location
+    shading.x = addVec(p, scalarVec(minT, d));
+    // Normal of surface
+    shading.normal = compiled->getNormal(hit, shading.x);
+    shading.eye = normalizeVec(addVec(p, scalarVec(-1, shading.x)));
+    // Ambient Lighting
+    // Adds Ambient Intensity * Ambient Color Constant
+    shading.totalLight = material.ambientLight;
+}
+void RayTracer::shadowRay(const Shading &shading, const Light &light, Point &rayPoint,
+                          Vec3 &lightVec, float &lightT) {
+    const Point& x = shading.x;
+    // Vector from surface to light
+    lightVec = normalizeVec(addVec(light.location, scalarVec(-1, x)));
+    rayPoint = addVec(x, scalarVec(distanceAwayConstant, lightVec));
+    lightT = vecMag(addVec(light.location, scalarVec(-1, rayPoint)));
+}
+void RayTracer::addLight(Shading &shading, const Light &light, const Vec3 &lightVec,
+                         bool inShadow, float scale) {
+    const ShadingMaterial& material = *shading.material;
+    const Vec3& normal = shading.normal;
+    Color& totalLight = shading.totalLight;
+    float intensity = light.intensity * scale;
+    // If not in shadow, add contributing light
+    if (!inShadow) {
+        // Diffuse
+        // Adds Intensity * max(0, n dot l) * Diffuse Constant
+        totalLight = addVec(scalarVec(intensity,scalarVec(max(0.0f, dotVec(normal, lightVec)), material.diffuseColor)),
+                            totalLight);
+        // Specular
+        Vec3 h = normalizeVec(addVec(shading.eye, lightVec));
+        // Adds Intensity * max(0, (n dot h)^p) * Specular Constant
+        float cosine = max(0.0f, dotVec(normal, h));
+        float phong = material.wholeExponent != -1 ? wholePower(cosine, material.wholeExponent) :
+                      pow(cosine, material.phongExponent);
+        totalLight = addVec(scalarVec(intensity, scalarVec(phong, material.specularColor)),
+                            totalLight);
+    }
+}
+// Seed for a shading point's light samples, from the bits of its coordinates
+static unsigned int pointSeed(const Point& x) {
+    unsigned int bits[3];
+    memcpy(bits, &x, sizeof(bits));
+    return bits[0] * 0x9e3779b1u ^ bits[1] * 0x85ebca77u ^ bits[2] * 0xc2b2ae3du;
+}
+void RayTracer::sampleLights(Shading &shading) {
+    TraceContext& context = *shading.context;
+    LightQuery query;
+    query.x = shading.x;
+    query.normal = shading.normal;
+    query.eye = shading.eye;
+    const Color& diffuse = shading.material->diffuseColor;
+    const Color& specular = shading.material->specularColor;
+    query.diffuse = max(diffuse.x, max(diffuse.y, diffuse.z));
+    query.specular = max(specular.x, max(specular.y, specular.z));
+    query.exponent = shading.material->phongExponent;
+    unsigned int seed = pointSeed(shading.x);
+    for (int n = 0; n < lightSamples; n++) {
+        float pmf;
+        int lightNum = frameScene->lightTree.sample(query, lightCullThreshold,
+                                                    seed + n * 0x68e31da4u, pmf);
+        if (lightNum == -1) {
+            continue;
+        }
+        const Light& light = frameScene->lights[lightNum];
+        Point rayPoint;
+        Vec3 lightVec;
+        float lightT;
+        shadowRay(shading, light, rayPoint, lightVec, lightT);
+        bool inShadow = occluded(rayPoint, lightVec, lightT, context);
+        addLight(shading, light, lightVec, inShadow, 1.0f / (pmf * (float)lightSamples));
+    }
+}
+// Clamp any values higher than 1 to 1
+static Color clampColor(const Color& color) {
+    return {min(color[0], 1.0f), min(color[1], 1.0f), min(color[2], 1.0f)};
+}
+Color RayTracer::traceReflection(const Shading &shading) {
+    TraceContext& context = *shading.context;
+    // Light from each hit along the path and the weight its reflection gets, combined from the
+    // last hit back so every hit is clamped on its own like it used to be
+    struct Bounce {
+        Color light;
+        Vec3 weight;
+    };
+    Bounce path[maxReflectionDepth];
+    int depth = 0;
+    int limit = min(reflectionDepth, maxReflectionDepth);
+    Point x = shading.x;
+    Vec3 normal = shading.normal;
+    Vec3 d = shading.d;
+    // What the next hit's color is multiplied by on its way to the pixel
+    Vec3 throughput = scalarVec(frameScene->lightIntensitySum, shading.material->specularColor);
+    while (depth < limit) {
+        // Stop once the rest of the path can't change the pixel or the frame is out of rays
+        if (max(throughput.x, max(throughput.y, throughput.z)) < minReflectionWeight ||
+            reflectionRaysLeft.fetch_sub(1, memory_order_relaxed) <= 0) {
+            break;
+        }
+        context.reflectionRays++;
+        Vec3 r = addVec(d, scalarVec(-2 * dotVec(d, normal), normal));
+        Point p = addVec(x, scalarVec(distanceAwayConstant, r));
+        float minT;
+        int hit = closestHit(p, r, SecondaryRays, false, minT, context);
+        Bounce& bounce = path[depth++];
+        bounce.weight = {0, 0, 0};
+        if (hit == -1) {
+            bounce.light = scaleColor(frameScene->backgroundColor);
+            break;
+        }
+        if ((hit >> primitiveKindShift) == LightKind) {
+            bounce.light = frameScene->shadingMaterials[compiled->getMaterial(hit)].ambientColor;
+            break;
+        }
+        Shading next;
+        startShading(p, r, hit, minT, context, next);
+        if (samplingLights) {
+            sampleLights(next);
+        }
+        for (int lightNum = 0; !samplingLights && lightNum < frameScene->lights.size();
+             lightNum++) {
+            Point rayPoint;
+            Vec3 lightVec;
+            float lightT;
+            shadowRay(next, frameScene->lights[lightNum], rayPoint, lightVec, lightT);
+            bool inShadow = occluded(rayPoint, lightVec, lightT, context);
+            addLight(next, frameScene->lights[lightNum], lightVec, inShadow);
+        }
+        bounce.light = next.totalLight;
+        if (!next.material->reflect) {
+            break;
+        }
+        bounce.weight = scalarVec(frameScene->lightIntensitySum, next.material->specularColor);
+        throughput = multiplyVec(throughput, bounce.weight);
+        x = next.x;
+        normal = next.normal;
+        d = r;
+    }
+    Color reflected = {0, 0, 0};
+    for (int k = depth - 1; k >= 0; k--) {
+        reflected = clampColor(addVec(path[k].light, multiplyVec(path[k].weight, reflected)));
+    }
+    return reflected;
+}
+template <int flags> bool RayTracer::orthogonalMode() const {
+    return flags & GenericKernel ? orthogonal : (flags & OrthogonalKernel) != 0;
+}
+template <int flags> bool RayTracer::lightVisualizationMode() const {
+    return flags & GenericKernel ? lightVisualization : (flags & LightVisualizationKernel) != 0;
+}
+template <int flags> bool RayTracer::reflectionMode() const {
+    return flags & GenericKernel ? reflectionDepth > 0 : (flags & ReflectionKernel) != 0;
+}
+template <int flags> Color RayTracer::finishShading(const Shading &shading) {
+    Color totalLight = shading.totalLight;
+    // Reflective, the reflection is traced once and lit by every light's intensity
+    // Adds Sum of Intensities * traceReflection * specularColor
+    if (reflectionMode<flags>() && shading.material->reflect) {
+        totalLight = addVec(scalarVec(frameScene->lightIntensitySum,
+                                      multiplyVec(traceReflection(shading),
+                                                  shading.material->specularColor)),
+                            totalLight);
+    }
+    return clampColor(totalLight);
+}
+template <int flags>
+Color RayTracer::findColor(Point p, Vec3 d, TraceContext &context, int pixel, int* primitive) {
+    RAYTRACER_STAT(StageScope stage(context.clock, ShadingStage));
+    // Find closest object the ray hits
+    float minT;
+    int hit = closestHit(p, d, CameraRays, lightVisualizationMode<flags>(), minT, context);
+    if (primitive != nullptr) {
+        *primitive = hit;
+    }
+    bool recording = recordingPixels && pixel != -1;
     // Return background color for no objects found
-    return scaleColor(backgroundColor);
+    if (hit == -1) {
+        if (recording) {
+            pixelRecords[pixel] = {p, -1, 0};
+        }
+        return scaleColor(frameScene->backgroundColor);
+    }
+    // For lights, just give full ambient color
+    if ((hit >> primitiveKindShift) == LightKind) {
+        if (recording) {
+            pixelRecords[pixel] = {p, hit, 0};
+        }
+        return frameScene->shadingMaterials[compiled->getMaterial(hit)].ambientColor;
+    }
+    Shading shading;
+    startShading(p, d, hit, minT, context, shading);
+    unsigned int shadowMask = 0;
+    bool reused = recording && reprojectShadows(hit, shading.x, shadowMask);
+    if (samplingLights) {
+        sampleLights(shading);
+    }
+    for (int lightNum = 0; !samplingLights && lightNum < frameScene->lights.size();
+         lightNum++) {
+        Point rayPoint;
+        Vec3 lightVec;
+        float lightT;
+        shadowRay(shading, frameScene->lights[lightNum], rayPoint, lightVec, lightT);
+        bool inShadow;
+        if (reused) {
+            context.stats.reused++;
+            inShadow = (shadowMask >> lightNum) & 1;
+        }
+        else {
+            // Ray trace to find any objects blocking light
+            inShadow = occluded(rayPoint, lightVec, lightT, context);
+            shadowMask |= (unsigned int)inShadow << lightNum;
+        }
+        addLight(shading, frameScene->lights[lightNum], lightVec, inShadow);
+    }
+    if (recording) {
+        pixelRecords[pixel] = {shading.x, hit, shadowMask};
+    }
+    return finishShading<flags>(shading);
 }
-unsigned char * RayTracer::produceImage(vector<float> camera, vector<float>
-lookAtVec, vector<float> upVec) {
-    if (image != nullptr) {
-        delete image;
+bool RayTracer::reprojectShadows(int hit, const Point &x, unsigned int &shadowMask) const {
+    if (!reprojecting) {
+        return false;
     }
-    image = new unsigned char[imgSizeX * imgSizeY * 3];
-    // Define Camera Basis
-    vector<float> w = normalizeVec(scalarVec(-1, lookAtVec));
-    vector<float> u = normalizeVec(crossVec(upVec, w));
-    vector<float> v = normalizeVec(crossVec(w, u));
-    // Loop for every pixel in the image
-    for (int i = 0; i < imgSizeX; i++) {
-        for (int j = 0; j < imgSizeY; j++) {
-            // Adjusts u and v to be -1 to 1
-            float uScale = 2.0f * (((float) i + 0.5f) / (float) imgSizeX) - 1.0f;
-            float vScale = 2.0f * (((float) j + 0.5f) / (float) imgSizeY) - 1.0f;
-            // p = camera
-            vector<float> p = camera;
-            if (orthogonal) {
-                // p = camera + uScale * u + vScale * v
-                p = addVec(scalarVec(uScale, scalarVec((float) imgSizeX / 2.0f,
-                                                       u)), p);
-                p = addVec(scalarVec(vScale, scalarVec((float) imgSizeY / 2.0f,
-                                                       v)), p);
+    // Inverse of primaryRay for the last camera (the other settings are the same)
+    const CameraBasis& basis = lastView.basis;
+    Vec3 relative = addVec(x, scalarVec(-1, basis.camera));
+    float depth = -dotVec(relative, basis.w);
+    if (depth <= 0) {
+        return false;
+    }
+    float scale = orthogonal ? 1.0f : projectionDistance / depth;
+    float pixelX = dotVec(relative, basis.u) * scale + (float) imgSizeX / 2.0f;
+    float pixelY = dotVec(relative, basis.v) * scale + (float) imgSizeY / 2.0f;
+    if (!(pixelX >= 0 && pixelX < (float) imgSizeX && pixelY >= 0 && pixelY < (float) imgSizeY)) {
+        return false;
+    }
+    int i = (int) pixelX;
+    int j = (int) pixelY;
+    const PixelRecord& record = lastPixelRecords[j * imgSizeX + i];
+    // Tolerance is in pixels, a pixel covers 1 / scale units at this depth. Only the point
+    // matters for the shadow rays, so a neighbouring triangle of the same mesh (or anything else
+    // with the same material) is as good as the same primitive.
+    Vec3 offset = addVec(record.x, scalarVec(-1, x));
+    float tolerance = reprojectionTolerance / scale;
+    if (record.hit == -1 || dotVec(offset, offset) > tolerance * tolerance) {
+        return false;
+    }
+    if (record.hit != hit && compiled->getMaterial(record.hit) != compiled->getMaterial(hit)) {
+        return false;
+    }
+    // Pixels next to a shadow edge or the background are traced again
+    const int offsets[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+    for (int k = 0; k < 4; k++) {
+        int neighbourX = i + offsets[k][0];
+        int neighbourY = j + offsets[k][1];
+        if (neighbourX < 0 || neighbourX >= imgSizeX || neighbourY < 0 || neighbourY >= imgSizeY) {
+            continue;
+        }
+        const PixelRecord& neighbour = lastPixelRecords[neighbourY * imgSizeX + neighbourX];
+        if (neighbour.hit == -1 || neighbour.shadowMask != record.shadowMask) {
+            return false;
+        }
+    }
+    shadowMask = record.shadowMask;
+    return true;
+}
+RayTracer::CameraBasis RayTracer::makeBasis(Point camera, Vec3 lookAtVec, Vec3 upVec) {
+    CameraBasis basis;
+    basis.camera = camera;
+    basis.w = normalizeVec(scalarVec(-1, lookAtVec));
+    basis.u = normalizeVec(crossVec(upVec, basis.w));
+    basis.v = normalizeVec(crossVec(basis.w, basis.u));
+    basis.sizeX = (float)imgSizeX;
+    basis.sizeY = (float)imgSizeY;
+    basis.halfU = scalarVec(basis.sizeX / 2.0f, basis.u);
+    basis.halfV = scalarVec(basis.sizeY / 2.0f, basis.v);
+    basis.orthogonalForward = scalarVec(-1, basis.w);
+    basis.perspectiveForward = scalarVec(-1 * projectionDistance, basis.w);
+    return basis;
+}
+template <int flags>
+void RayTracer::primaryRay(const CameraBasis &basis, float pixelX, float pixelY, Point &p,
+                           Vec3 &d) {
+    // Adjusts u and v to be -1 to 1
+    float uScale = 2.0f * (pixelX / basis.sizeX) - 1.0f;
+    float vScale = 2.0f * (pixelY / basis.sizeY) - 1.0f;
+    if (orthogonalMode<flags>()) {
+        // p = camera + uScale * u + vScale * v, d = -w
+        p = addVec(scalarVec(uScale, basis.halfU), basis.camera);
+        p = addVec(scalarVec(vScale, basis.halfV), p);
+        d = basis.orthogonalForward;
+    }
+    else {
+        // p = camera, d = -w * projectionDistance + uScale * u + vScale * v
+        p = basis.camera;
+        d = addVec(scalarVec(uScale, basis.halfU), basis.perspectiveForward);
+        d = addVec(scalarVec(vScale, basis.halfV), d);
+        d = normalizeVec(d);
+    }
+}
+void RayTracer::traceRun(const CameraBasis &basis, int startX, int stride, int count, int y,
+                         TraceContext &context, Color *colors, int* hits) {
+    float sampleX[tileSize];
+    float sampleY[tileSize];
+    int pixels[tileSize];
+    for (int n = 0; n < count; n++) {
+        int pixelX = startX + n * stride;
+        sampleX[n] = (float) pixelX + 0.5f;
+        sampleY[n] = (float) y + 0.5f;
+        pixels[n] = y * imgSizeX + pixelX;
+    }
+    traceSamples(basis, count, sampleX, sampleY, pixels, context, colors, hits);
+}
+#ifdef RAYTRACER_STATS
+// Adds a packet kernel call's primitive tests to a thread's counters
+static void addPacketTests(RenderStats& counters, const RayPacket& packet) {
+    for (int kind = 0; kind < primitiveKindCount; kind++) {
+        counters.tests[kind] += packet.kindTests[kind];
+    }
+}
+#endif
+#ifdef RAYTRACER_STATS
+RayTracer::CostMark RayTracer::costMark(const TraceContext &context) const {
+    CostMark mark;
+    mark.rays = context.cameraRays + context.stats.rays + context.reflectionRays;
+    mark.tests = 0;
+    for (int kind = 0; kind < primitiveKindCount; kind++) {
+        mark.tests += context.counters.tests[kind];
+    }
+    mark.ticks = stageTicks();
+    return mark;
+}
+void RayTracer::recordPixelCost(int pixel, const CostMark &start, const TraceContext &context) {
+    CostMark end = costMark(context);
+    PixelCost& cost = pixelCosts[pixel];
+    // The camera ray was counted before the mark
+    cost.rays += (float)(end.rays - start.rays + 1);
+    cost.tests += (float)(end.tests - start.tests);
+    cost.nanoseconds += (float)((double)(end.ticks - start.ticks) / costTicksPerNs);
+}
+#endif
+void RayTracer::traceSamples(const CameraBasis &basis, int count, const float *sampleX,
+                             const float *sampleY, const int *pixels, TraceContext &context,
+                             Color *colors, int *hits, const int *costPixels) {
+    (this->*samplesKernel)(basis, count, sampleX, sampleY, pixels, context, colors, hits,
+                           costPixels);
+}
+template <int flags>
+void RayTracer::traceSamplesKernel(const CameraBasis &basis, int count, const float *sampleX,
+                                   const float *sampleY, const int *pixels,
+                                   TraceContext &context, Color *colors, int *hits,
+                                   const int *costPixels) {
+    // Only stats builds record pixel costs
+    (void)costPixels;
+    context.cameraRays += count;
+    // Stages are switched as the work moves along, whatever ran before is back on return
+    RAYTRACER_STAT(StageScope stage(context.clock, RayGenerationStage));
+    if (packetKernels == nullptr) {
+        for (int n = 0; n < count; n++) {
+            Point p;
+            Vec3 d;
+            RAYTRACER_STAT(CostMark mark);
+            RAYTRACER_STAT(if (recordingCosts) {
+                mark = costMark(context);
+            })
+            RAYTRACER_STAT(context.clock.enter(RayGenerationStage));
+            primaryRay<flags>(basis, sampleX[n], sampleY[n], p, d);
+            // Get the color
+            colors[n] = findColor<flags>(p, d, context, pixels != nullptr ? pixels[n] : -1,
+                                  hits != nullptr ? hits + n : nullptr);
+            RAYTRACER_STAT(if (recordingCosts) {
+                recordPixelCost(costPixels != nullptr ? costPixels[n] : pixels[n], mark, context);
+            })
+        }
+        return;
+    }
+    int width = packetKernels->width;
+    RayPacket packet;
+    RayPacket shadowPacket;
+    Point origins[RayPacket::maxWidth];
+    Vec3 directions[RayPacket::maxWidth];
+    Shading shadings[RayPacket::maxWidth];
+    for (int first = 0; first < count; first += width) {
+        int lanes = min(width, count - first);
+        packet.activeMask = (1 << lanes) - 1;
+        RAYTRACER_STAT(context.clock.enter(RayGenerationStage));
+        for (int lane = 0; lane < width; lane++) {
+            // Spare lanes repeat the last ray so they hold sensible numbers
+            if (lane < lanes) {
+                primaryRay<flags>(basis, sampleX[first + lane], sampleY[first + lane],
+                                  origins[lane], directions[lane]);
             }
-            vector<float> d;
-            if (orthogonal) {
-                // d = -w
-                d = scalarVec(-1, w);
+            int source = min(lane, lanes - 1);
+            packet.setRay(lane, origins[source], directions[source],
+                          numeric_limits<float>::max());
+        }
+        RAYTRACER_STAT(context.clock.enter(TraversalStage));
+        packetKernels->closestHit(compiled->view(), packet, CameraRays,
+                                  lightVisualizationMode<flags>());
+        RAYTRACER_STAT(context.clock.enter(ShadingStage));
+        RAYTRACER_STAT(addPacketTests(context.counters, packet));
+        Color* laneColors = colors + first;
+        if (hits != nullptr) {
+            for (int lane = 0; lane < lanes; lane++) {
+                hits[first + lane] = packet.hit[lane];
             }
-            else {
-                // d = -w * projectionDistance + uScale * u + vScale * v
-                d = scalarVec(-1 * projectionDistance, w);
-                d = addVec(scalarVec(uScale, scalarVec((float) imgSizeX / 2.0f,
-                                                       u)), d);
-                d = addVec(scalarVec(vScale, scalarVec((float) imgSizeY / 2.0f,
-                                                       v)), d);
-                d = normalizeVec(d);
+        }
+        // Only a pixel's one sample is recorded for (or reuses) reprojection
+        bool recording = recordingPixels && pixels != nullptr;
+        int shadeMask = 0;
+        // Lanes whose shadows come from the last frame, and every lane's blocked lights
+        int reusedMask = 0;
+        unsigned int shadowMasks[RayPacket::maxWidth];
+        for (int lane = 0; lane < lanes; lane++) {
+            int hit = packet.hit[lane];
+            shadowMasks[lane] = 0;
+            RAYTRACER_STAT((hit != -1 ? context.counters.hits : context.counters.misses)++);
+            if (hit == -1) {
+                laneColors[lane] = scaleColor(frameScene->backgroundColor);
+                continue;
             }
-            // Get the color
-            vector<float> scaleColor = findColor(p, d, 0, 1);
-            vector<unsigned char> color;
-            for (int k = 0; k < scaleColor.size(); k++) {
-                color.push_back(scaleColor.at(k)*255);
+            if ((hit >> primitiveKindShift) == LightKind) {
+                laneColors[lane] = frameScene->shadingMaterials[compiled->getMaterial(hit)].ambientColor;
+                continue;
+            }
+            startShading(origins[lane], directions[lane], hit, packet.tMax[lane], context,
+                         shadings[lane]);
+            shadeMask |= 1 << lane;
+            if (recording && reprojectShadows(hit, shadings[lane].x, shadowMasks[lane])) {
+                reusedMask |= 1 << lane;
+            }
+            // Sampled lights differ from lane to lane, so their shadow rays go one at a time
+            if (samplingLights) {
+                sampleLights(shadings[lane]);
+            }
+        }
+        int traceMask = shadeMask & ~reusedMask;
+        // One shadow packet per light for every lane that hit something
+        for (int lightNum = 0;
+             !samplingLights && shadeMask != 0 && lightNum < frameScene->lights.size();
+             lightNum++) {
+            const Light& light = frameScene->lights[lightNum];
+            Vec3 lightVecs[RayPacket::maxWidth];
+            int blockedMask = 0;
+            for (int lane = 0; lane < width; lane++) {
+                if (shadeMask & (1 << lane)) {
+                    Point rayPoint;
+                    float lightT;
+                    shadowRay(shadings[lane], light, rayPoint, lightVecs[lane], lightT);
+                    shadowPacket.setRay(lane, rayPoint, lightVecs[lane], lightT);
+                    if (reusedMask & (1 << lane)) {
+                        context.stats.reused++;
+                        blockedMask |= (int)((shadowMasks[lane] >> lightNum) & 1) << lane;
+                    }
+                    else {
+                        context.stats.rays++;
+                    }
+                }
+                else {
+                    shadowPacket.setRay(lane, origins[0], directions[0], 0.0f);
+                }
+            }
+            if (traceMask != 0) {
+                shadowPacket.activeMask = traceMask;
+                RAYTRACER_STAT(context.clock.enter(TraversalStage));
+                packetKernels->occluded(compiled->view(), shadowPacket);
+                RAYTRACER_STAT(context.clock.enter(ShadingStage));
+                context.stats.tests += shadowPacket.tests;
+                RAYTRACER_STAT(addPacketTests(context.counters, shadowPacket));
+                // Every blocked lane stopped at its first blocker
+                RAYTRACER_STAT(for (int bits = shadowPacket.blockedMask; bits != 0;
+                                    bits &= bits - 1) {
+                    context.counters.shadowEarlyOuts++;
+                })
+                blockedMask |= shadowPacket.blockedMask;
             }
+            // Shading (and any reflection rays, which go back to scalar tracing) per lane
+            for (int lane = 0; lane < lanes; lane++) {
+                if (shadeMask & (1 << lane)) {
+                    addLight(shadings[lane], light, lightVecs[lane],
+                             (blockedMask & (1 << lane)) != 0);
+                    shadowMasks[lane] |= (unsigned int)((blockedMask >> lane) & 1) << lightNum;
+                }
+            }
+        }
+        for (int lane = 0; lane < lanes; lane++) {
+            if (shadeMask & (1 << lane)) {
+                laneColors[lane] = finishShading<flags>(shadings[lane]);
+            }
+            if (recording) {
+                int hit = packet.hit[lane];
+                bool shaded = (shadeMask & (1 << lane)) != 0;
+                pixelRecords[pixels[first + lane]] =
+                        {shaded ? shadings[lane].x : origins[lane], hit, shadowMasks[lane]};
+            }
+        }
+    }
+}
+void RayTracer::fillBlock(int x, int y, int endX, int endY, const Color &color) {
+    unsigned char pixel[3];
+    for (int k = 0; k < 3; k++) {
+        pixel[k] = (unsigned char)(color[k] * 255);
+    }
+    for (int j = y; j < endY; j++) {
+        unsigned char* row = image + (j * imgSizeX + x) * 3;
+        for (int i = x; i < endX; i++, row += 3) {
+            row[0] = pixel[0];
+            row[1] = pixel[1];
+            row[2] = pixel[2];
+        }
+    }
+}
+void RayTracer::renderTile(const CameraBasis &basis, int tile, TraceContext &context) {
+    int tilesX = (imgSizeX + tileSize - 1) / tileSize;
+    int startX = (tile % tilesX) * tileSize;
+    int startY = (tile / tilesX) * tileSize;
+    int endX = min(startX + tileSize, imgSizeX);
+    int endY = min(startY + tileSize, imgSizeY);
+    Color colors[tileSize];
+    int hits[tileSize];
+    // Adaptive anti-aliasing compares the centers once every tile is done
+    bool keepCenters = antialiasLevels > 0;
+    for (int j = startY; j < endY; j++) {
+        traceRun(basis, startX, 1, endX - startX, j, context, colors, keepCenters ? hits : nullptr);
+        RAYTRACER_STAT(StageScope stage(context.clock, OutputStage));
+        for (int i = startX; i < endX; i++) {
             // Set pixel value
-            int index = (j * imgSizeX + i) * 3;
-            image[index] = color[0];
-            image[index + 1] = color[1];
-            image[index + 2] = color[2];
+            fillBlock(i, j, i + 1, j + 1, colors[i - startX]);
+            if (keepCenters) {
+                workers->centerColors[j * imgSizeX + i] = colors[i - startX];
+                workers->centerHits[j * imgSizeX + i] = hits[i - startX];
+            }
+        }
+    }
+}
+// Largest difference between two colors in any channel
+static float colorDifference(const Color& a, const Color& b) {
+    return max(fabs(a.x - b.x), max(fabs(a.y - b.y), fabs(a.z - b.z)));
+}
+bool RayTracer::onEdge(int i, int j) const {
+    int pixel = j * imgSizeX + i;
+    const vector<Color>& centerColors = workers->centerColors;
+    const vector<int>& centerHits = workers->centerHits;
+    for (int k = 0; k < 9; k++) {
+        int neighbourX = i + k % 3 - 1;
+        int neighbourY = j + k / 3 - 1;
+        if (neighbourX < 0 || neighbourX >= imgSizeX || neighbourY < 0 || neighbourY >= imgSizeY) {
+            continue;
+        }
+        int neighbour = neighbourY * imgSizeX + neighbourX;
+        if (centerHits[neighbour] != centerHits[pixel] ||
+            colorDifference(centerColors[neighbour], centerColors[pixel]) > antialiasThreshold) {
+            return true;
+        }
+    }
+    return false;
+}
+void RayTracer::antialiasTile(const CameraBasis &basis, int tile, TraceContext &context) {
+    int tilesX = (imgSizeX + tileSize - 1) / tileSize;
+    int startX = (tile % tilesX) * tileSize;
+    int startY = (tile / tilesX) * tileSize;
+    int endX = min(startX + tileSize, imgSizeX);
+    int endY = min(startY + tileSize, imgSizeY);
+    // Each region is replaced by split x split smaller ones, uniform mode goes straight to the
+    // finest grid
+    bool adaptive = adaptiveAntialiasing;
+    int split = adaptive ? 2 : 1 << antialiasLevels;
+    int levels = adaptive ? antialiasLevels : 1;
+    vector<AntialiasRegion>& regions = context.regions;
+    regions.clear();
+    bool refined[tileSize * tileSize];
+    for (int j = startY; j < endY; j++) {
+        for (int i = startX; i < endX; i++) {
+            int pixel = (j - startY) * tileSize + (i - startX);
+            refined[pixel] = !adaptive || onEdge(i, j);
+            if (refined[pixel]) {
+                int center = j * imgSizeX + i;
+                regions.push_back({pixel, (float) i + 0.5f, (float) j + 0.5f, 1.0f,
+                                   adaptive ? workers->centerColors[center] : Color{0, 0, 0},
+                                   adaptive ? workers->centerHits[center] : -1});
+            }
+        }
+    }
+    if (regions.empty()) {
+        return;
+    }
+    // Area weighted sums of the final samples, the sizes are powers of 2 so the weights add up
+    // to exactly 1
+    Color sums[tileSize * tileSize];
+    for (int k = 0; k < tileSize * tileSize; k++) {
+        sums[k] = {0, 0, 0};
+    }
+    // Samples are traced in batches of whole regions
+    const int maxBatch = 1 << (2 * maxAntialiasLevels);
+    float sampleX[maxBatch];
+    float sampleY[maxBatch];
+    // Image index of each sample's pixel, only filled in for recording costs
+    int samplePixels[maxBatch];
+    Color colors[maxBatch];
+    int hits[maxBatch];
+    int children = split * split;
+    for (int level = 0; !regions.empty(); level++) {
+        bool splitAgain = level + 1 < levels;
+        vector<AntialiasRegion>& next = context.nextRegions;
+        next.clear();
+        for (int first = 0; first < regions.size();) {
+            int batch = min((int) regions.size() - first, maxBatch / children);
+            int count = 0;
+            for (int r = first; r < first + batch; r++) {
+                const AntialiasRegion& region = regions[r];
+                float step = region.size / (float) split;
+                float left = region.x - 0.5f * region.size;
+                float bottom = region.y - 0.5f * region.size;
+                RAYTRACER_STAT(int imagePixel = (startY + region.pixel / tileSize) * imgSizeX +
+                                                startX + region.pixel % tileSize);
+                for (int b = 0; b < split; b++) {
+                    for (int a = 0; a < split; a++) {
+                        sampleX[count] = left + ((float) a + 0.5f) * step;
+                        sampleY[count] = bottom + ((float) b + 0.5f) * step;
+                        RAYTRACER_STAT(samplePixels[count] = imagePixel);
+                        count++;
+                    }
+                }
+            }
+            traceSamples(basis, count, sampleX, sampleY, nullptr, context, colors, hits,
+                         samplePixels);
+            for (int r = 0; r < batch; r++) {
+                const AntialiasRegion& region = regions[first + r];
+                float size = region.size / (float) split;
+                int firstChild = r * children;
+                // An edge can cross a quarter without touching its center, so all of them are
+                // split again if any differs from the region's sample. Edge pixels had a
+                // neighbour differ, so their quarters are split at least once whatever they saw.
+                bool differs = level == 0 && adaptive && splitAgain;
+                for (int k = firstChild; splitAgain && !differs && k < firstChild + children; k++) {
+                    differs = hits[k] != region.hit ||
+                              colorDifference(colors[k], region.color) > antialiasThreshold;
+                }
+                for (int k = firstChild; k < firstChild + children; k++) {
+                    if (differs) {
+                        next.push_back({region.pixel, sampleX[k], sampleY[k], size, colors[k],
+                                        hits[k]});
+                    }
+                    else {
+                        sums[region.pixel] = addVec(sums[region.pixel],
+                                                    scalarVec(size * size, colors[k]));
+                    }
+                }
+            }
+            first += batch;
+        }
+        regions.swap(next);
+    }
+    RAYTRACER_STAT(StageScope stage(context.clock, OutputStage));
+    for (int j = startY; j < endY; j++) {
+        for (int i = startX; i < endX; i++) {
+            int pixel = (j - startY) * tileSize + (i - startX);
+            if (refined[pixel]) {
+                fillBlock(i, j, i + 1, j + 1, sums[pixel]);
+            }
         }
     }
+}
+int RayTracer::progressiveTileSize(int block) {
+    // A whole number of the previous pass's blocks, so which pixels it traced lines up with
+    // the tile's corner
+    return max(tileSize, 2 * block);
+}
+int RayTracer::progressiveTileCount(int block) const {
+    int size = progressiveTileSize(block);
+    return ((imgSizeX + size - 1) / size) * ((imgSizeY + size - 1) / size);
+}
+void RayTracer::renderProgressiveTile(int tile, TraceContext &context) {
+    int block = progressive.block;
+    int size = progressiveTileSize(block);
+    int tilesX = (imgSizeX + size - 1) / size;
+    int startX = (tile % tilesX) * size;
+    int startY = (tile / tilesX) * size;
+    int endX = min(startX + size, imgSizeX);
+    int endY = min(startY + size, imgSizeY);
+    // At most tileSize pixels of a row are traced (2 per row once blocks outgrow the tile)
+    Color colors[tileSize];
+    for (int j = startY; j < endY; j += block) {
+        // Pixels on the coarser pass's grid were traced already, which leaves every other
+        // pixel on rows it covered and all of them on the rows in between
+        bool tracedRow = !progressive.firstPass && (j - startY) % (2 * block) == 0;
+        int x = tracedRow ? startX + block : startX;
+        int stride = tracedRow ? 2 * block : block;
+        if (x >= endX) {
+            continue;
+        }
+        int count = (endX - x + stride - 1) / stride;
+        traceRun(progressive.basis, x, stride, count, j, context, colors);
+        RAYTRACER_STAT(StageScope stage(context.clock, OutputStage));
+        for (int n = 0; n < count; n++) {
+            int i = x + n * stride;
+            fillBlock(i, j, min(i + block, endX), min(j + block, endY), colors[n]);
+        }
+    }
+}
+void RayTracer::startFrame() {
+    // The frame holds on to its scene even if getScene makes a new one meanwhile
+    frameScene = getScene();
+    // Primitive ids change when the objects are compiled again, so the last frame's pixels
+    // can't be matched up any more
+    if (frameScene->compiled.get() != compiled) {
+        lastView.valid = false;
+    }
+    compiled = frameScene->compiled.get();
+    // Own workers are only remade when the thread count setting changes, borrowed ones (set by
+    // render, never ownWorkers) are used as they are
+    if (workers == ownWorkers.get()) {
+        if (ownWorkers == nullptr || ownWorkers->pool.size() != max(1, threadCount)) {
+            ownWorkers.reset(new Workers(threadCount));
+        }
+        workers = ownWorkers.get();
+    }
+    // Whole frames and every progressive pass have at most one job per tileSize tile
+    workers->pool.reserve(((imgSizeX + tileSize - 1) / tileSize) *
+                          ((imgSizeY + tileSize - 1) / tileSize));
+    // Packets when the CPU has SIMD kernels for the chosen width
+    packetKernels = selectPacketKernels(packetWidth);
+    // Tracing kernel compiled for this frame's settings
+    static const SamplesKernel kernels[GenericKernel + 1] = {
+        &RayTracer::traceSamplesKernel<0>, &RayTracer::traceSamplesKernel<1>,
+        &RayTracer::traceSamplesKernel<2>, &RayTracer::traceSamplesKernel<3>,
+        &RayTracer::traceSamplesKernel<4>, &RayTracer::traceSamplesKernel<5>,
+        &RayTracer::traceSamplesKernel<6>, &RayTracer::traceSamplesKernel<7>,
+        &RayTracer::traceSamplesKernel<GenericKernel>};
+    int flags = (orthogonal ? OrthogonalKernel : 0) |
+                (lightVisualization ? LightVisualizationKernel : 0) |
+                (reflectionDepth > 0 ? ReflectionKernel : 0);
+    samplesKernel = kernels[specializedKernels ? flags : GenericKernel];
+    // One trace context per worker, counted from zero for each frame
+    vector<TraceContext>& contexts = workers->contexts;
+    contexts.resize(workers->pool.size());
+    for (int i = 0; i < contexts.size(); i++) {
+        contexts[i].stats = ShadowStats();
+        contexts[i].cameraRays = 0;
+        contexts[i].reflectionRays = 0;
+        RAYTRACER_STAT(contexts[i].counters = RenderStats());
+        RAYTRACER_STAT(contexts[i].clock.reset());
+    }
+    RAYTRACER_STAT(lastFrameMs = 0.0);
+    recordingCosts = false;
+    // Sampling only pays off with many more lights than samples
+    samplingLights = lightSamples > 0 &&
+                     frameScene->lights.size() > lightSamples * max(1, lightSampleCost);
+    reflectionRaysLeft = reflectionRayBudget > 0 ? reflectionRayBudget :
+                         numeric_limits<long long>::max();
+}
+void RayTracer::sizeFramebuffer() {
+    if (image == nullptr || framebufferSizeX != imgSizeX || framebufferSizeY != imgSizeY) {
+        // Starts black so a progressive pass cut short by the budget doesn't show garbage.
+        // Shrinking keeps the capacity, so only growing past the largest size so far allocates.
+        framebuffer.assign((size_t)imgSizeX * imgSizeY * 3, 0);
+        framebufferSizeX = imgSizeX;
+        framebufferSizeY = imgSizeY;
+    }
+    image = framebuffer.data();
+}
+unsigned char * RayTracer::produceImage(Point camera, Vec3 lookAtVec, Vec3 upVec,
+                                        RenderStats* stats) {
+    sizeFramebuffer();
+    renderFrame(camera, lookAtVec, upVec, stats);
     return image;
 }
-RayTracer::~RayTracer() {
-    for (int i = 0; i < objects.size(); i++) {
-        delete objects.at(i);
+RayTracer::RayTracer(shared_ptr<const Scene> scene) : objects(), lights() {
+    this->scene = move(scene);
+    fixedScene = true;
+    accelerationBuilt = true;
+}
+void RayTracer::render(const shared_ptr<const Scene> &scene, const RenderRequest &request,
+                       Workers &workers) {
+    // The frame's own state lives in this RayTracer and what it traces with in workers, the
+    // scene is only read
+    RayTracer renderer(scene);
+    static_cast<RenderSettings&>(renderer) = request.settings;
+    renderer.image = request.image;
+    renderer.workers = &workers;
+    renderer.renderFrame(request.camera, request.lookAtVec, request.upVec, request.stats);
+}
+void RayTracer::produceImage(const RenderRequest &request, Workers &workers) const {
+    render(getScene(), request, workers);
+}
+RayTracer::Workers::Workers(int threadCount) : pool(threadCount) {
+}
+const vector<RayTracer::TraceContext>& RayTracer::frameContexts() const {
+    static const vector<TraceContext> none;
+    return workers != nullptr ? workers->contexts : none;
+}
+void RayTracer::renderFrame(Point camera, Vec3 lookAtVec, Vec3 upVec, RenderStats* stats) {
+    RAYTRACER_STAT(auto frameStart = chrono::steady_clock::now());
+    RAYTRACER_STAT(TraceScope frameTrace(traceEvents(frameEvents), "produceImage", 0));
+    // Define Camera Basis
+    CameraBasis basis = makeBasis(camera, lookAtVec, upVec);
+    startFrame();
+    // A finished frame makes any progressive refinement in flight stale
+    progressive.block = 0;
+    // Costs are told apart per pixel by tracing one ray at a time
+    RAYTRACER_STAT(recordingCosts = recordPixelCosts);
+    if (recordingCosts) {
+        pixelCosts.assign(imgSizeX * imgSizeY, PixelCost());
+        packetKernels = nullptr;
+        RAYTRACER_STAT(costTicksPerNs = stageTicksPerMs() / 1e6);
     }
-    for (int i = 0; i < lights.size(); i++) {
-        delete lights.at(i);
+    else {
+        pixelCosts.clear();
     }
-    if (image != nullptr) {
-        delete image;
+    // Each anti-aliasing level splits pixels into 4
+    antialiasLevels = 0;
+    while (antialiasLevels < maxAntialiasLevels && 4 << (2 * antialiasLevels) <= antialiasSamples) {
+        antialiasLevels++;
     }
+    // Uniform anti-aliasing has no one sample per pixel pass
+    bool uniform = antialiasLevels > 0 && !adaptiveAntialiasing;
+    if (antialiasLevels > 0 && !uniform) {
+        workers->centerColors.resize(imgSizeX * imgSizeY);
+        workers->centerHits.resize(imgSizeX * imgSizeY);
+    }
+    // Last frame's pixels can be reused if only the camera moved
+    recordingPixels = reprojection && frameScene->treeCost >= reprojectionMinTreeCost &&
+                      frameScene->lights.size() <= 32 && !uniform && !samplingLights;
+    reprojecting = false;
+    if (recordingPixels) {
+        pixelRecords.resize(imgSizeX * imgSizeY);
+        reprojecting = lastView.valid && lastView.orthogonal == orthogonal &&
+                       lastView.projectionDistance == projectionDistance &&
+                       lastView.sizeX == imgSizeX && lastView.sizeY == imgSizeY &&
+                       lastView.lightLocations.size() == frameScene->lights.size();
+        for (int i = 0; reprojecting && i < frameScene->lights.size(); i++) {
+            const Point& location = frameScene->lights[i].location;
+            const Point& last = lastView.lightLocations[i];
+            reprojecting = location.x == last.x && location.y == last.y && location.z == last.z;
+        }
+    }
+    // Split the image into tiles, idle threads steal tiles from busy ones
+    int tilesX = (imgSizeX + tileSize - 1) / tileSize;
+    int tilesY = (imgSizeY + tileSize - 1) / tileSize;
+    if (!uniform) {
+        workers->pool.parallelFor(tilesX * tilesY, [&](int tile, int worker) {
+            RAYTRACER_STAT(TraceScope trace(traceEvents(workers->contexts[worker].events), "tile",
+                                            worker));
+            renderTile(basis, tile, workers->contexts[worker]);
+        });
+    }
+    // Edges are found by comparing with neighbouring tiles, so only after all of them are done
+    if (antialiasLevels > 0) {
+        RAYTRACER_STAT(TraceScope passTrace(traceEvents(frameEvents), "antialiasing", 0));
+        workers->pool.parallelFor(tilesX * tilesY, [&](int tile, int worker) {
+            RAYTRACER_STAT(TraceScope trace(traceEvents(workers->contexts[worker].events),
+                                            "antialias tile", worker));
+            antialiasTile(basis, tile, workers->contexts[worker]);
+        });
+    }
+    lastView.valid = recordingPixels;
+    if (recordingPixels) {
+        pixelRecords.swap(lastPixelRecords);
+        lastView.basis = basis;
+        lastView.orthogonal = orthogonal;
+        lastView.projectionDistance = projectionDistance;
+        lastView.sizeX = imgSizeX;
+        lastView.sizeY = imgSizeY;
+        lastView.lightLocations.resize(frameScene->lights.size());
+        for (int i = 0; i < frameScene->lights.size(); i++) {
+            lastView.lightLocations[i] = frameScene->lights[i].location;
+        }
+        recordingPixels = false;
+        reprojecting = false;
+    }
+    RAYTRACER_STAT(lastFrameMs = chrono::duration<double, milli>(chrono::steady_clock::now() -
+                                                                 frameStart).count());
+    if (stats != nullptr) {
+        *stats = getRenderStats();
+    }
+}
+// Pixels a progressive pass traces per tile
+static double progressiveSamples(int size, int block, bool firstPass) {
+    double blocks = (double)(size / block) * (double)(size / block);
+    return firstPass ? blocks : blocks * 0.75;
+}
+void RayTracer::startProgressive(Point camera, Vec3 lookAtVec, Vec3 upVec) {
+    sizeFramebuffer();
+    progressive.basis = makeBasis(camera, lookAtVec, upVec);
+    startFrame();
+    // Start at 8x8 blocks, coarser if the last measured speed says that pass wouldn't fit in
+    // the budget (large images, slow scenes)
+    progressive.block = 8;
+    while (progressive.block < maxProgressiveBlock &&
+           progressiveTileCount(progressive.block) *
+           progressiveSamples(progressiveTileSize(progressive.block), progressive.block, true) *
+           progressive.msPerSample > progressiveBudgetMs) {
+        progressive.block *= 2;
+    }
+    progressive.firstPass = true;
+    progressive.nextTile = 0;
+}
+bool RayTracer::refineProgressive() {
+    if (progressive.block == 0) {
+        return true;
+    }
+    RAYTRACER_STAT(TraceScope frameTrace(traceEvents(frameEvents), "refineProgressive", 0));
+    auto start = chrono::steady_clock::now();
+    double elapsedMs = 0.0;
+    while (true) {
+        // Tiles for half of what's left of the budget at the measured speed (cost varies over
+        // the image, so the estimate is refreshed before spending the rest), but always enough
+        // to keep every thread busy
+        int tileCount = progressiveTileCount(progressive.block);
+        double samples = progressiveSamples(progressiveTileSize(progressive.block),
+                                            progressive.block, progressive.firstPass);
+        double tileMs = samples * progressive.msPerSample;
+        int batch = (int)(0.5 * (progressiveBudgetMs - elapsedMs) / tileMs);
+        batch = min(max(batch, workers->pool.size()), tileCount - progressive.nextTile);
+        int firstTile = progressive.nextTile;
+        auto batchStart = chrono::steady_clock::now();
+        workers->pool.parallelFor(batch, [&](int tile, int worker) {
+            RAYTRACER_STAT(TraceScope trace(traceEvents(workers->contexts[worker].events),
+                                            "progressive tile", worker));
+            renderProgressiveTile(firstTile + tile, workers->contexts[worker]);
+        });
+        auto now = chrono::steady_clock::now();
+        double batchMs = chrono::duration<double, milli>(now - batchStart).count();
+        elapsedMs = chrono::duration<double, milli>(now - start).count();
+        // Smoothed so one slow batch (or a page fault) doesn't swing the next estimate
+        progressive.msPerSample = 0.5 * progressive.msPerSample +
+                                  0.5 * batchMs / (batch * samples);
+        progressive.nextTile += batch;
+        if (progressive.nextTile == tileCount) {
+            progressive.nextTile = 0;
+            progressive.firstPass = false;
+            progressive.block /= 2;
+            if (progressive.block == 0) {
+                return true;
+            }
+        }
+        samples = progressiveSamples(progressiveTileSize(progressive.block),
+                                     progressive.block, progressive.firstPass);
+        tileMs = samples * progressive.msPerSample;
+        // Stop before a batch that would run over the budget
+        if (elapsedMs + tileMs * workers->pool.size() > progressiveBudgetMs) {
+            return false;
+        }
+    }
+}
+int RayTracer::progressiveBlock() const {
+    return progressive.block;
+}
+long long RayTracer::getCameraRays() const {
+    long long rays = 0;
+    const vector<TraceContext>& contexts = frameContexts();
+    for (int i = 0; i < contexts.size(); i++) {
+        rays += contexts[i].cameraRays;
+    }
+    return rays;
+}
+long long RayTracer::getReflectionRays() const {
+    long long rays = 0;
+    const vector<TraceContext>& contexts = frameContexts();
+    for (int i = 0; i < contexts.size(); i++) {
+        rays += contexts[i].reflectionRays;
+    }
+    return rays;
+}
+RenderStats RayTracer::getRenderStats() const {
+    RenderStats total;
+    RAYTRACER_STAT(total.enabled = true);
+    RAYTRACER_STAT(total.frameMs = lastFrameMs);
+    RAYTRACER_STAT(double ticksPerMs = stageTicksPerMs());
+    const vector<TraceContext>& contexts = frameContexts();
+    for (int i = 0; i < contexts.size(); i++) {
+        const TraceContext& context = contexts[i];
+        total.cameraRays += context.cameraRays;
+        total.shadowRays += context.stats.rays;
+        total.reflectionRays += context.reflectionRays;
+        RAYTRACER_STAT(total.add(context.counters));
+        RAYTRACER_STAT(for (int stage = 0; stage < StageCount; stage++) {
+            total.stageMs[stage] += (double)context.clock.ticks[stage] / ticksPerMs;
+        })
+    }
+    return total;
+}
+#ifdef RAYTRACER_STATS
+vector<TraceEvent>* RayTracer::traceEvents(vector<TraceEvent> &events) {
+    return traceTimeline ? &events : nullptr;
+}
+#endif
+const vector<PixelCost>& RayTracer::getPixelCosts() const {
+    return pixelCosts;
+}
+bool RayTracer::writeTrace(const string &fileName, string &error) const {
+#ifdef RAYTRACER_STATS
+    vector<TraceEvent> events = frameEvents;
+    const vector<TraceContext>& contexts = frameContexts();
+    for (int i = 0; i < contexts.size(); i++) {
+        events.insert(events.end(), contexts[i].events.begin(), contexts[i].events.end());
+    }
+    return writeChromeTrace(fileName, events, error);
+#else
+    (void)fileName;
+    error = "traces need a build configured with -DRAYTRACER_STATS=ON";
+    return false;
+#endif
+}
+RayTracer::ShadowStats RayTracer::getShadowStats() const {
+    ShadowStats total;
+    const vector<TraceContext>& contexts = frameContexts();
+    for (int i = 0; i < contexts.size(); i++) {
+        total.rays += contexts[i].stats.rays;
+        total.tests += contexts[i].stats.tests;
+        total.reused += contexts[i].stats.reused;
+    }
+    return total;
 }
-vector<float> RayTracer::transformVector(vector<float> vec, float pitch, float yaw,
-                                         float roll) {
+Vec3 RayTracer::transformVector(Vec3 vec, float pitch, float yaw, float roll) {
     // Roll is disabled but figured I'd include the code anyway
     float a = 0.0f * (float)M_PI / 180.0f;
     float b = pitch * (float)M_PI / 180.0f;
     float c = yaw * (float)M_PI / 180.0f;
     // Roll Matrix
-    vector<float> rolledVec = {cos(a) * vec[0] + sin(a) * vec[1], -1 * sin(a) *
+    Vec3 rolledVec = {cos(a) * vec[0] + sin(a) * vec[1], -1 * sin(a) *
                                                                   vec[0] + cos(a) * vec[1], vec[2]};
     vec = rolledVec;
     // Pitch Matrix
-    vector<float> pitchedVec = {vec[0], cos(b) * vec[1] + sin(b) * vec[2], -1 *
+    Vec3 pitchedVec = {vec[0], cos(b) * vec[1] + sin(b) * vec[2], -1 *
                                                                            sin(b) * vec[1] + cos(b) * vec[2]};
     vec = pitchedVec;
     // Yaw Matrix
-    vector<float> yawedVec = {cos(c) * vec[0] + -1 * sin(c) * vec[2], vec[1],
+    Vec3 yawedVec = {cos(c) * vec[0] + -1 * sin(c) * vec[2], vec[1],
                               sin(c) * vec[0] + cos(c) * vec[2]};
     vec = yawedVec;
     return vec;
 }
 void RayTracer::takePicture(string fileName, unsigned char* image) {
-    ofstream file(fileName, ios::out | ios::binary | ios::trunc);
-    // PPM Magic Number
-    char magicNumber[3] = {'P', '6', '\n'};
-    file.write(magicNumber, 3);
-    // Width
-    string widthString = to_string(imgSizeX);
-    file.write(widthString.c_str(), widthString.size());
-    char newLine = '\n';
-    // Height
-    file.write(&newLine, sizeof(newLine));
-    string heightString = to_string(imgSizeY);
-    file.write(heightString.c_str(), heightString.size());
-    file.write(&newLine, sizeof(newLine));
-    // Max Color
-    char maxColor[4] = {'2', '5', '5', '\n'};
-    file.write(maxColor, 4);
-    // Write the pixels
-    for (int i = imgSizeY - 1; i >= 0; i--) {
-        for (int j = 0; j < imgSizeX; j++) {
-            int index = (i * imgSizeX + j) * 3;
-            unsigned char currChar[3] = {image[index], image[index + 1],
-                                         image[index + 2]};
-            file.write((char*)currChar, 3);
-        }
-    }
-}
-RayTracer::ColorPack::ColorPack(vector<unsigned char> ambientConstant,
-                                vector<unsigned char> diffuseConstant,
-                                vector<unsigned char> specularConstant, float
-                                phongExponent, bool reflect) {
+    writePPM(fileName, image, imgSizeX, imgSizeY);
+}
+RayTracer::ColorPack::ColorPack(ByteColor ambientConstant, ByteColor diffuseConstant,
+                                ByteColor specularConstant, float phongExponent,
+                                bool reflect) {
     this->ambientConstant = ambientConstant;
     this->diffuseConstant = diffuseConstant;
     this->specularConstant = specularConstant;
@@ -237,15 +1318,15 @@ RayTracer::ColorPack::ColorPack(vector<unsigned char> ambientConstant,
 RayTracer::Object::Object(RayTracer::ColorPack color) {
     this->color = color;
 }
-RayTracer::Sphere::Sphere(vector<float> center, float radius, RayTracer::ColorPack
+RayTracer::Sphere::Sphere(Point center, float radius, RayTracer::ColorPack
 color) : Object(color) {
     this->center = center;
     this->radius = radius;
 }
 // Calculates ray sphere intersection using -d dot x +- sqrt((d dot x)^2 - x dot x + R^2)
-float RayTracer::Sphere::intersection(vector<float> p, vector<float> d) {
+float RayTracer::Sphere::intersection(Point p, Vec3 d) {
     // Vector from center to point
-    vector<float> x = addVec(p, scalarVec(-1, center));
+    Vec3 x = addVec(p, scalarVec(-1, center));
     // (d dot x)^2 - x dot x + R^2
     float underRoot = pow(dotVec(d, x), 2) - dotVec(x, x) + pow(radius, 2);
     // If value is negative, doesn't exist
@@ -272,19 +1353,27 @@ float RayTracer::Sphere::intersection(vector<float> p, vector<float> d) {
         return -1;
     }
 }
-vector<float> RayTracer::Sphere::getNormal(const vector<float> &x) {
+Vec3 RayTracer::Sphere::getNormal(const Point &x) {
     return normalizeVec(addVec(x, scalarVec(-1, center)));
 }
-RayTracer::Plane::Plane(vector<float> point1, vector<float> point2, vector<float>
-point3, RayTracer::ColorPack color) : Object(color) {
+bool RayTracer::Sphere::getBounds(AABB &bounds) {
+    bounds.minBound = {center[0] - radius, center[1] - radius, center[2] - radius};
+    bounds.maxBound = {center[0] + radius, center[1] + radius, center[2] + radius};
+    return true;
+}
+void RayTracer::Sphere::compile(CompiledScene &scene, int material) {
+    scene.addSphere(center, radius, material, AllRays);
+}
+RayTracer::Plane::Plane(Point point1, Point point2, Point point3,
+                        RayTracer::ColorPack color) : Object(color) {
     this->a = point1;
     this->b = point2;
     this->c = point3;
 }
 // Calculates plane ray intersection using ((a - p) dot n) / (d dot n)
-float RayTracer::Plane::intersection(vector<float> p, vector<float> d) {
-    vector<float> normalVec = getNormal(p);
-    vector<float> aMinusP = addVec(a, scalarVec(-1, p));
+float RayTracer::Plane::intersection(Point p, Vec3 d) {
+    Vec3 normalVec = getNormal(p);
+    Vec3 aMinusP = addVec(a, scalarVec(-1, p));
     // Top and bottom of formula
     float topT = dotVec(aMinusP, normalVec);
     float bottomT = dotVec(d, normalVec);
@@ -299,21 +1388,33 @@ float RayTracer::Plane::intersection(vector<float> p, vector<float> d) {
     }
     return t;
 }
-vector<float> RayTracer::Plane::getNormal(const vector<float> &x) {
-    vector<float> subPoint2 = scalarVec(-1, b);
+Vec3 RayTracer::Plane::getNormal(const Point &x) {
+    Vec3 subPoint2 = scalarVec(-1, b);
     return normalizeVec(crossVec(addVec(a, subPoint2), addVec(c, subPoint2)));
 }
-RayTracer::Triangle::Triangle(vector<float> point1, vector<float> point2,
-                              vector<float> point3, RayTracer::ColorPack color) : Object(color) {
+bool RayTracer::Plane::getBounds(AABB &) {
+    // Planes go on forever
+    return false;
+}
+void RayTracer::Plane::compile(CompiledScene &scene, int material) {
+    scene.addPlane(a, getNormal(a), material, AllRays);
+}
+RayTracer::Triangle::Triangle(Point point1, Point point2, Point point3,
+                              RayTracer::ColorPack color) : Object(color) {
     this->a = point1;
     this->b = point2;
     this->c = point3;
 }
+Vec3 RayTracer::triangleNormal(const Point &a, const Point &b, const Point &c) {
+    Vec3 subPoint2 = scalarVec(-1, b);
+    return normalizeVec(crossVec(addVec(a, subPoint2), addVec(c, subPoint2)));
+}
 // Calculates ray triangle intersection using plane intersection and checking edge vectors
-float RayTracer::Triangle::intersection(vector<float> p, vector<float> d) {
-    vector<float> normalVec = getNormal(p);
+float RayTracer::triangleIntersection(const Point &a, const Point &b, const Point &c,
+                                      const Point &p, const Vec3 &d) {
+    Vec3 normalVec = triangleNormal(a, b, c);
     // Plane intersection method
-    vector<float> aMinusP = addVec(a, scalarVec(-1, p));
+    Vec3 aMinusP = addVec(a, scalarVec(-1, p));
     float topT = dotVec(aMinusP, normalVec);
     float bottomT = dotVec(d, normalVec);
     if (bottomT == 0) {
@@ -324,14 +1425,14 @@ float RayTracer::Triangle::intersection(vector<float> p, vector<float> d) {
         return -1;
     }
     // If on plane, get that point
-    vector<float> x = addVec(p, scalarVec(t, d));
+    Point x = addVec(p, scalarVec(t, d));
     // Edge vectors
-    vector<float> bMinusA = addVec(b, scalarVec(-1, a));
-    vector<float> cMinusB = addVec(c, scalarVec(-1, b));
-    vector<float> aMinusC = addVec(a, scalarVec(-1, c));
-    vector<float> xMinusA = addVec(x, scalarVec(-1, a));
-    vector<float> xMinusB = addVec(x, scalarVec(-1, b));
-    vector<float> xMinusC = addVec(x, scalarVec(-1, c));
+    Vec3 bMinusA = addVec(b, scalarVec(-1, a));
+    Vec3 cMinusB = addVec(c, scalarVec(-1, b));
+    Vec3 aMinusC = addVec(a, scalarVec(-1, c));
+    Vec3 xMinusA = addVec(x, scalarVec(-1, a));
+    Vec3 xMinusB = addVec(x, scalarVec(-1, b));
+    Vec3 xMinusC = addVec(x, scalarVec(-1, c));
     // Traverse, if inside all 3 then inside triangle
     if (dotVec(crossVec(bMinusA, xMinusA), normalVec) > 0 ||
         dotVec(crossVec(cMinusB, xMinusB), normalVec) > 0 ||
@@ -341,15 +1442,88 @@ float RayTracer::Triangle::intersection(vector<float> p, vector<float> d) {
         return t;
     }
 }
-vector<float> RayTracer::Triangle::getNormal(const vector<float> &x) {
-    vector<float> subPoint2 = scalarVec(-1, b);
-    return normalizeVec(crossVec(addVec(a, subPoint2), addVec(c, subPoint2)));
+float RayTracer::Triangle::intersection(Point p, Vec3 d) {
+    return triangleIntersection(a, b, c, p, d);
+}
+Vec3 RayTracer::Triangle::getNormal(const Point &x) {
+    return triangleNormal(a, b, c);
+}
+bool RayTracer::Triangle::getBounds(AABB &bounds) {
+    bounds = AABB();
+    bounds.grow(a);
+    bounds.grow(b);
+    bounds.grow(c);
+    return true;
+}
+void RayTracer::Triangle::compile(CompiledScene &scene, int material) {
+    int first = scene.addVertex(a);
+    scene.addVertex(b);
+    scene.addVertex(c);
+    scene.addTriangle(first, first + 1, first + 2, getNormal(a), material, AllRays);
 }
-RayTracer::Light::Light(vector<float> location, float intensity) {
+RayTracer::Mesh::Mesh(vector<Point> vertices, vector<int> indices, RayTracer::ColorPack color)
+        : Object(color) {
+    this->vertices = move(vertices);
+    this->indices = move(indices);
+}
+float RayTracer::Mesh::intersection(Point p, Vec3 d) {
+    float minT = -1;
+    for (int i = 0; i + 2 < indices.size(); i += 3) {
+        float t = triangleIntersection(vertices.at(indices[i]), vertices.at(indices[i + 1]),
+                                       vertices.at(indices[i + 2]), p, d);
+        if (t != -1 && (minT == -1 || t < minT)) {
+            minT = t;
+        }
+    }
+    return minT;
+}
+Vec3 RayTracer::Mesh::getNormal(const Point &x) {
+    // Triangle whose plane passes closest to x
+    Vec3 normal = {0, 0, 0};
+    float minDistance = numeric_limits<float>::max();
+    for (int i = 0; i + 2 < indices.size(); i += 3) {
+        const Point& a = vertices.at(indices[i]);
+        Vec3 triNormal = triangleNormal(a, vertices.at(indices[i + 1]), vertices.at(indices[i + 2]));
+        float distance = fabs(dotVec(addVec(x, scalarVec(-1, a)), triNormal));
+        if (distance < minDistance) {
+            minDistance = distance;
+            normal = triNormal;
+        }
+    }
+    return normal;
+}
+bool RayTracer::Mesh::getBounds(AABB &bounds) {
+    bounds = AABB();
+    for (int i = 0; i < indices.size(); i++) {
+        bounds.grow(vertices.at(indices[i]));
+    }
+    return !indices.empty();
+}
+void RayTracer::Mesh::compile(CompiledScene &scene, int material) {
+    scene.reserveTriangles((int)vertices.size(), (int)indices.size() / 3);
+    int first = 0;
+    for (int i = 0; i < vertices.size(); i++) {
+        int index = scene.addVertex(vertices[i]);
+        if (i == 0) {
+            first = index;
+        }
+    }
+    for (int i = 0; i + 2 < indices.size(); i += 3) {
+        Vec3 normal = triangleNormal(vertices[indices[i]], vertices[indices[i + 1]],
+                                     vertices[indices[i + 2]]);
+        scene.addTriangle(first + indices[i], first + indices[i + 1], first + indices[i + 2],
+                          normal, material, AllRays);
+    }
+}
+RayTracer::Light::Light(Point location, float intensity) {
     this->location = location;
     this->intensity = intensity;
 }
-RayTracer::LightObj::LightObj(vector<float> center, float radius,
+RayTracer::LightObj::LightObj(Point center, float radius,
                               RayTracer::ColorPack color) : Sphere(center, radius, color) {
     // Just calls parent constructor
-}
\ No newline at end of file
+}
+void RayTracer::LightObj::compile(CompiledScene &scene, int material) {
+    // Only seen by camera rays, and only when lights are visualized
+    scene.addLight(center, radius, material, CameraRays);
+}
@@ -2,20 +2,36 @@
 #include <cmath>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include "Vec3.h"
+#include "ThreadPool.h"
+#include "BVH.h"
+#include "CompiledScene.h"
+#include "RayPacket.h"
+#include "MappedFile.h"
+#include "Arena.h"
+#include "RenderStats.h"
+#include "LightTree.h"
+#include "RenderSettings.h"
 using namespace std;
 #pragma once
-class RayTracer {
+// Scene, settings and per frame state of the renderer. Settings are the RenderSettings it
+// inherits, what it renders is a Scene made from its objects and lights.
+class RayTracer : public RenderSettings {
+public:
     // Class to hold color info about a material
     struct ColorPack {
-        vector<unsigned char> ambientConstant;
-        vector<unsigned char> diffuseConstant;
-        vector<unsigned char> specularConstant;
+        ByteColor ambientConstant;
+        ByteColor diffuseConstant;
+        ByteColor specularConstant;
         float phongExponent = 1.0f;
         bool reflect = false;
         ColorPack() = default;
-        ColorPack(vector<unsigned char> ambientConstant, vector<unsigned char>
-        diffuseConstant, vector<unsigned char> specularConstant, float phongExponent, bool
-                  reflect = false);
+        ColorPack(ByteColor ambientConstant, ByteColor diffuseConstant, ByteColor
+        specularConstant, float phongExponent, bool reflect = false);
     };
     // Abstract object class
     struct Object {
@@ -23,103 +39,562 @@ class RayTracer {
         Object(ColorPack color);
         virtual ~Object() = default;
         // All objects check for intersection and can tell you their normal vector
-        virtual float intersection(vector<float> p, vector<float> d) = 0;
-        virtual vector<float> getNormal(const vector<float>& x) = 0;
+        virtual float intersection(Point p, Vec3 d) = 0;
+        virtual Vec3 getNormal(const Point& x) = 0;
+        // Gives the bounding box, returns false for objects without one
+        virtual bool getBounds(AABB& bounds) = 0;
+        // Adds the object to the compiled scene that rendering traces against
+        virtual void compile(CompiledScene& scene, int material) = 0;
     };
     // Sphere Class
     struct Sphere : public Object {
-        vector<float> center;
+        Point center;
         float radius;
-        Sphere(vector<float> center, float radius, ColorPack color);
-        float intersection(vector<float> p, vector<float> d) override;
-        vector<float> getNormal(const vector<float>& x) override;
+        Sphere(Point center, float radius, ColorPack color);
+        float intersection(Point p, Vec3 d) override;
+        Vec3 getNormal(const Point& x) override;
+        bool getBounds(AABB& bounds) override;
+        void compile(CompiledScene& scene, int material) override;
     };
     // Light Object Class
     struct LightObj : public Sphere {
-        LightObj(vector<float> center, float radius, ColorPack color);
+        LightObj(Point center, float radius, ColorPack color);
+        void compile(CompiledScene& scene, int material) override;
     };
     // Plane Class
     struct Plane : public Object {
-        vector<float> a;
-        vector<float> b;
-        vector<float> c;
-        Plane(vector<float> point1, vector<float> point2, vector<float> point3,
-              ColorPack color);
-        float intersection(vector<float> p, vector<float> d) override;
-        vector<float> getNormal(const vector<float>& x) override;
+        Point a;
+        Point b;
+        Point c;
+        Plane(Point point1, Point point2, Point point3, ColorPack color);
+        float intersection(Point p, Vec3 d) override;
+        Vec3 getNormal(const Point& x) override;
+        bool getBounds(AABB& bounds) override;
+        void compile(CompiledScene& scene, int material) override;
     };
     // Triangle Class
     struct Triangle : public Object {
-        vector<float> a;
-        vector<float> b;
-        vector<float> c;
-        Triangle(vector<float> point1, vector<float> point2, vector<float> point3,
-                 ColorPack color);
-        float intersection(vector<float> p, vector<float> d) override;
-        vector<float> getNormal(const vector<float> &x) override;
+        Point a;
+        Point b;
+        Point c;
+        Triangle(Point point1, Point point2, Point point3, ColorPack color);
+        float intersection(Point p, Vec3 d) override;
+        Vec3 getNormal(const Point& x) override;
+        bool getBounds(AABB& bounds) override;
+        void compile(CompiledScene& scene, int material) override;
+    };
+    // Triangle mesh sharing its vertices between triangles, every 3 indices make a triangle
+    // (loadObj in ObjLoader.h reads them from OBJ files)
+    struct Mesh : public Object {
+        vector<Point> vertices;
+        vector<int> indices;
+        Mesh(vector<Point> vertices, vector<int> indices, ColorPack color);
+        // Closest triangle, tested one by one
+        float intersection(Point p, Vec3 d) override;
+        // Normal of the triangle x lies on
+        Vec3 getNormal(const Point& x) override;
+        bool getBounds(AABB& bounds) override;
+        void compile(CompiledScene& scene, int material) override;
     };
     // Light Class
     struct Light {
-        vector<float> location;
+        Point location;
         float intensity;
-        Light(vector<float> location, float intensity);
+        Light(Point location, float intensity);
+    };
+    // A material's constants as shading uses them, so hits don't convert bytes to floats
+    struct ShadingMaterial {
+        // Ambient constant as a color, and times ambientIntensity (the light every hit starts
+        // with)
+        Color ambientColor;
+        Color ambientLight;
+        Color diffuseColor;
+        Color specularColor;
+        float phongExponent;
+        // phongExponent if it's a whole number up to 256, raised with wholePower instead of pow,
+        // -1 otherwise
+        int wholeExponent;
+        bool reflect;
+    };
+    // Everything a frame reads about what it renders, made by getScene from objects, lights,
+    // backgroundColor and ambientIntensity and never changed after. Frames only read it, so any
+    // number of them can render one scene at once on any threads (render, or RayTracers made
+    // from it), and a frame keeps the scene it started with while the objects are edited.
+    struct Scene {
+        // Scene cache compiled points into, null when it was built from objects
+        shared_ptr<const MappedFile> mapped;
+        // Objects compiled into per kind arrays with a BVH over the bounded ones, shared with
+        // later scenes that only change materials, lights or settings
+        shared_ptr<const CompiledScene> compiled;
+        // Materials are shared between objects with the same colors
+        vector<ColorPack> materials;
+        vector<ShadingMaterial> shadingMaterials;
+        vector<Light> lights;
+        // Tree over lights for light sampling
+        LightTree lightTree;
+        // Sum of the lights' intensities, what reflections are scaled by
+        float lightIntensitySum = 0.0f;
+        // compiled's BVH::cost, about how many nodes and primitives a ray visits
+        float treeCost = 0.0f;
+        ByteColor backgroundColor = {0, 0, 0};
+        float ambientIntensity = 0.5f;
+    };
+    // One frame for render, with its own camera, settings and output
+    struct RenderRequest {
+        Point camera;
+        Vec3 lookAtVec;
+        Vec3 upVec;
+        RenderSettings settings;
+        // settings.imgSizeX * settings.imgSizeY * 3 bytes laid out like image, owned by the
+        // caller
+        unsigned char* image = nullptr;
+        // Filled with the frame's counters and timings if it isn't null
+        RenderStats* stats = nullptr;
+    };
+private:
+    // Triangle math shared by Triangle and Mesh
+    static Vec3 triangleNormal(const Point& a, const Point& b, const Point& c);
+    static float triangleIntersection(const Point& a, const Point& b, const Point& c,
+                                      const Point& p, const Vec3& d);
+    // Scene frames render, replaced rather than changed when the objects, lights or scene
+    // settings change. getScene brings it up to date, so it and what it's made from are
+    // mutable, and sceneLock keeps threads calling it at once from doing that together.
+    mutable shared_ptr<const Scene> scene;
+    mutable mutex sceneLock;
+    // True for a RayTracer made from a scene, which renders it as it is
+    bool fixedScene = false;
+    // Scene of the frame being rendered (startFrame picks up scene), and its compiled objects
+    shared_ptr<const Scene> frameScene;
+    const CompiledScene* compiled = nullptr;
+    // Material index of each object
+    mutable vector<int> objectMaterials;
+    mutable bool accelerationBuilt = false;
+    // Set by refitAcceleration, the next compile refits the last scene's BVH
+    mutable bool refitPending = false;
+    // Fills materials and objectMaterials from the objects' colors
+    void assignMaterials(vector<ColorPack>& materials) const;
+    // Replaces scene with one made from compiled objects and their materials and the lights
+    // and scene settings as they are now
+    void makeScene(shared_ptr<const CompiledScene> geometry, shared_ptr<const MappedFile> mapped,
+                   vector<ColorPack> materials) const;
+    // Replaces scene with one made from the objects compiled again
+    void compileObjects() const;
+    // Makes a new scene if the objects, lights, backgroundColor or ambientIntensity changed
+    void updateScene() const;
+public:
+    // Shadow ray counters for the last frame, summed over the threads
+    struct ShadowStats {
+        long long rays = 0;
+        // Primitive intersection tests
+        long long tests = 0;
+        // Rays skipped by reusing the last frame's result through reprojection
+        long long reused = 0;
+    };
+private:
+    // Square part of a pixel being anti-aliased, centered on x, y with sides size pixels long.
+    // color and hit come from the ray through its center.
+    struct AntialiasRegion {
+        // Pixel within the tile (j * tileSize + i)
+        int pixel;
+        float x;
+        float y;
+        float size;
+        Color color;
+        int hit;
+    };
+    // Per thread tracing state, indexed by the thread pool's worker index
+    struct TraceContext {
+        ShadowStats stats;
+        // Camera rays traced this frame, anti-aliasing samples included, and reflection rays
+        long long cameraRays = 0;
+        long long reflectionRays = 0;
+        // Regions of the anti-aliasing level being traced and of the next, kept between frames
+        // so they don't allocate
+        vector<AntialiasRegion> regions;
+        vector<AntialiasRegion> nextRegions;
+#ifdef RAYTRACER_STATS
+        // Tests, hits and early outs (the ray counts above stay where they are), stage times
+        // and Chrome trace events
+        RenderStats counters;
+        StageClock clock;
+        vector<TraceEvent> events;
+#endif
+        // Keeps the threads' counters off each other's cache lines
+        char padding[64];
+    };
+public:
+    // Threads and per thread tracing state frames run on, kept from frame to frame so frames
+    // don't start threads or allocate. A RayTracer keeps its own (with threadCount threads) for
+    // produceImage and progressive rendering, render borrows the caller's. One frame at a time
+    // can use them, so a program rendering requests in parallel keeps one per request thread.
+    // The members are only for the frames using them.
+    struct Workers {
+        ThreadPool pool;
+        // Indexed by the pool's worker index
+        vector<TraceContext> contexts;
+        // Pixel center colors and primitives, which adaptive anti-aliasing compares
+        // neighbours by
+        vector<Color> centerColors;
+        vector<int> centerHits;
+        // The calling thread counts as one of the threads
+        explicit Workers(int threadCount);
+    };
+private:
+    unique_ptr<Workers> ownWorkers;
+    // Workers of the last frame, ownWorkers or the ones render borrowed
+    Workers* workers = nullptr;
+    // workers' trace contexts, empty before the first frame
+    const vector<TraceContext>& frameContexts() const;
+#ifdef RAYTRACER_STATS
+    // Frame spans recorded by the calling thread, and produceImage's wall clock time
+    vector<TraceEvent> frameEvents;
+    double lastFrameMs = 0.0;
+    // Where to record a trace event, null unless traceTimeline is on
+    vector<TraceEvent>* traceEvents(vector<TraceEvent>& events);
+    // Rays, tests and stage clock ticks a thread has spent so far, recordPixelCost charges
+    // what was spent since a mark to a pixel
+    struct CostMark {
+        long long rays;
+        long long tests;
+        long long ticks;
+    };
+    CostMark costMark(const TraceContext& context) const;
+    void recordPixelCost(int pixel, const CostMark& start, const TraceContext& context);
+    double costTicksPerNs = 1.0;
+#endif
+    // True while produceImage fills pixelCosts
+    bool recordingCosts = false;
+    vector<PixelCost> pixelCosts;
+    // Closest primitive visible to the given RayVisibility along the ray (-1 if none), minT
+    // gets its distance
+    int closestHit(const Point& p, const Vec3& d, unsigned char visibility, bool includeLights,
+                   float& minT, TraceContext& context);
+    // True if any shadow casting primitive is hit closer than maxT
+    bool occluded(const Point& p, const Vec3& d, float maxT, TraceContext& context);
+    // Shading for one hit point, built up one light at a time
+    struct Shading {
+        Point p;
+        Vec3 d;
+        TraceContext* context;
+        int hit;
+        const ShadingMaterial* material;
+        Point x;
+        Vec3 normal;
+        // Unit vector from x back along the ray
+        Vec3 eye;
+        Color totalLight;
+    };
+    void startShading(const Point& p, const Vec3& d, int hit, float minT, TraceContext& context,
+                      Shading& shading);
+    // Ray from the hit point towards a light and the distance to it
+    void shadowRay(const Shading& shading, const Light& light, Point& rayPoint, Vec3& lightVec,
+                   float& lightT);
+    // Adds diffuse and specular from one light, scaled by scale
+    void addLight(Shading& shading, const Light& light, const Vec3& lightVec, bool inShadow,
+                  float scale = 1.0f);
+    // True when this frame samples lightSamples lights per hit instead of trying every light
+    bool samplingLights = false;
+    // Adds lightSamples lights picked from the scene's light tree, each weighted by one over
+    // its chance of being picked so the expected result is every light's (culled lights aside)
+    void sampleLights(Shading& shading);
+    // Frame settings the tracing kernels below are compiled for, so their per ray code doesn't
+    // branch on them. A frame runs the one instantiation matching its settings, GenericKernel
+    // reads the settings at run time instead (specializedKernels off).
+    enum KernelFlags {
+        OrthogonalKernel = 1,
+        LightVisualizationKernel = 2,
+        ReflectionKernel = 4,
+        GenericKernel = 8
+    };
+    template <int flags> bool orthogonalMode() const;
+    template <int flags> bool lightVisualizationMode() const;
+    template <int flags> bool reflectionMode() const;
+    // Adds the reflection (for reflective materials) and clamps
+    template <int flags> Color finishShading(const Shading& shading);
+    // Color reflected into a reflective hit. Follows the reflection from hit to hit with an
+    // explicit stack instead of recursion, tracing each one once (not once per light), until
+    // reflectionDepth, a hit that doesn't reflect, minReflectionWeight or the ray budget.
+    Color traceReflection(const Shading& shading);
+    static const int maxReflectionDepth = 16;
+    // Reflection rays the frame may still trace, shared by the threads
+    atomic<long long> reflectionRaysLeft{0};
+    // Color seen by a camera ray. pixel is its image index (-1 for rays that aren't a pixel's
+    // only sample), used for reprojection. primitive gets the id of what the ray hit (-1 for
+    // the background) if it isn't null.
+    template <int flags> Color findColor(Point p, Vec3 d, TraceContext& context, int pixel = -1,
+                                         int* primitive = nullptr);
+    // Camera basis for a frame, with what primaryRay needs from it worked out once
+    struct CameraBasis {
+        Point camera;
+        Vec3 u;
+        Vec3 v;
+        Vec3 w;
+        // u and v times half the image size, and the ray direction through the image center
+        // (-w, times projectionDistance for perspective)
+        Vec3 halfU;
+        Vec3 halfV;
+        Vec3 orthogonalForward;
+        Vec3 perspectiveForward;
+        float sizeX;
+        float sizeY;
+    };
+    CameraBasis makeBasis(Point camera, Vec3 lookAtVec, Vec3 upVec);
+    // Ray through a point on the image plane given in pixels (pixel centers are at + 0.5)
+    template <int flags> void primaryRay(const CameraBasis& basis, float pixelX, float pixelY,
+                                         Point& p, Vec3& d);
+    // What a produceImage frame saw at each pixel, so the next frame can reuse its shadow rays
+    struct PixelRecord {
+        Point x;
+        // Primitive id, -1 for the background
+        int hit;
+        // Bit per light, set if the light was blocked
+        unsigned int shadowMask;
+    };
+    vector<PixelRecord> pixelRecords;
+    vector<PixelRecord> lastPixelRecords;
+    // Camera and settings lastPixelRecords were made with
+    struct RecordedView {
+        CameraBasis basis;
+        bool orthogonal;
+        float projectionDistance;
+        int sizeX;
+        int sizeY;
+        vector<Point> lightLocations;
+        bool valid = false;
+    };
+    RecordedView lastView;
+    // True while produceImage fills pixelRecords, and while lastPixelRecords can be reused
+    bool recordingPixels = false;
+    bool reprojecting = false;
+    // Projects hit point x into the last frame and gives the shadow mask recorded there. False
+    // if that pixel saw a different material or point, or sits next to a shadow or silhouette
+    // edge (where the mask could change within a pixel).
+    bool reprojectShadows(int hit, const Point& x, unsigned int& shadowMask) const;
+    // Colors of count (at most tileSize) pixels on row y starting at startX, stride pixels
+    // apart, and the primitive each one hit if hits isn't null
+    void traceRun(const CameraBasis& basis, int startX, int stride, int count, int y,
+                  TraceContext& context, Color* colors, int* hits = nullptr);
+    // Colors (and primitives if hits isn't null) of count camera rays through the image plane
+    // points sampleX, sampleY given in pixels. pixels holds each ray's image index when the rays
+    // are the pixels' only samples (for reprojection), null otherwise. costPixels gives the
+    // image index each ray's cost goes to while recording costs (pixels is used when it's
+    // null). Traces primary and shadow rays in SIMD packets when packetKernels is set. Runs
+    // the frame's samplesKernel.
+    void traceSamples(const CameraBasis& basis, int count, const float* sampleX,
+                      const float* sampleY, const int* pixels, TraceContext& context,
+                      Color* colors, int* hits, const int* costPixels = nullptr);
+    template <int flags> void traceSamplesKernel(const CameraBasis& basis, int count,
+                                                 const float* sampleX, const float* sampleY,
+                                                 const int* pixels, TraceContext& context,
+                                                 Color* colors, int* hits,
+                                                 const int* costPixels);
+    using SamplesKernel = void (RayTracer::*)(const CameraBasis&, int, const float*,
+                                              const float*, const int*, TraceContext&, Color*,
+                                              int*, const int*);
+    SamplesKernel samplesKernel = nullptr;
+    // Sets the pixels in [x, endX) x [y, endY) to one color
+    void fillBlock(int x, int y, int endX, int endY, const Color& color);
+    // Renders one tileSize x tileSize block of the image
+    static const int tileSize = 16;
+    void renderTile(const CameraBasis& basis, int tile, TraceContext& context);
+    // Times a pixel can be split into 4 for anti-aliasing this frame, from antialiasSamples
+    int antialiasLevels = 0;
+    static const int maxAntialiasLevels = 4;
+    // True if a pixel center's color or primitive differs from one of its 8 neighbours'
+    bool onEdge(int i, int j) const;
+    // Second pass over a tile once every pixel center is traced, supersamples the pixels on
+    // edges (or every pixel in uniform mode) and writes them over the one sample colors
+    void antialiasTile(const CameraBasis& basis, int tile, TraceContext& context);
+    // Brings the scene up to date (unless it's fixed) and readies the workers for a frame,
+    // ownWorkers (made or remade for threadCount) unless render set borrowed ones
+    void startFrame();
+    // Renders a frame into image, and fills stats with its counters and timings if it isn't
+    // null
+    void renderFrame(Point camera, Vec3 lookAtVec, Vec3 upVec, RenderStats* stats);
+    // Progressive refinement state. Each pass traces one pixel per block x block block and
+    // fills the block with it, then the next pass halves the block. Pixels a coarser pass
+    // traced are skipped, so every pixel is traced once by the time block 1 finishes.
+    struct Progressive {
+        CameraBasis basis;
+        // Block size of the pass in progress, 0 once the image is complete
+        int block = 0;
+        bool firstPass = true;
+        // Next tile of the pass to render
+        int nextTile = 0;
+        // Wall clock milliseconds per traced pixel, measured as tiles finish
+        double msPerSample = 0.001;
     };
-    vector<float> findColor(vector<float> p, vector<float> d, int num, int limit);
+    Progressive progressive;
+    // Coarsest pass startProgressive falls back to when 8x8 blocks are too slow
+    static const int maxProgressiveBlock = 64;
+    // Tiles of a pass (block pixels per block)
+    static int progressiveTileSize(int block);
+    int progressiveTileCount(int block) const;
+    void renderProgressiveTile(int tile, TraceContext& context);
+    const PacketKernels* packetKernels = nullptr;
+    // Pixels image points at, kept between frames and only resized when the image size changes
+    vector<unsigned char> framebuffer;
+    int framebufferSizeX = 0;
+    int framebufferSizeY = 0;
+    void sizeFramebuffer();
 public:
-    // Saves an image to a ppm file (chose ppm because it's easy to write to)
+    RayTracer() = default;
+    // Renders scene as it is, its own objects, lights, backgroundColor and ambientIntensity
+    // are left empty and ignored
+    explicit RayTracer(shared_ptr<const Scene> scene);
+    // Saves an image to a ppm file (chose ppm because it's easy to write to), ImageSink.h has
+    // the other formats
     void takePicture(string fileName, unsigned char* image);
-    // Functions for Vector Math
-    static vector<float> addVec(const vector<float>& a, const vector<float>&
-    b);
-    static vector<float> scalarVec(float scalar, const vector<float>& a);
-    static float dotVec(const vector<float>& a, const vector<float>& b);
-    static vector<float> crossVec(const vector<float>& a, const vector<float>&
-    b);
-    static float vecMag(const vector<float>& a);
-    static vector<float> normalizeVec(const vector<float>& a);
-    static vector<float> multiplyVec(const vector<float>& a, const
-    vector<float>& b);
-    static vector<float> scaleColor(const vector<unsigned char>& a);
+    // Functions for Vector Math (defined inline below so the per-ray path can inline them)
+    static Vec3 addVec(const Vec3& a, const Vec3& b);
+    static Vec3 scalarVec(float scalar, const Vec3& a);
+    static float dotVec(const Vec3& a, const Vec3& b);
+    static Vec3 crossVec(const Vec3& a, const Vec3& b);
+    static float vecMag(const Vec3& a);
+    static Vec3 normalizeVec(const Vec3& a);
+    static Vec3 multiplyVec(const Vec3& a, const Vec3& b);
+    static Color scaleColor(const ByteColor& a);
     // For transforming vectors
-    static vector<float> transformVector(vector<float> vec, float pitch, float
-    yaw, float roll);
-    unsigned char* produceImage(vector<float> camera, vector<float> lookAtVec,
-                                vector<float> upVec);
-    ~RayTracer();
+    static Vec3 transformVector(Vec3 vec, float pitch, float yaw, float roll);
+    // Renders a frame, and fills stats with its counters and timings if it isn't null
+    unsigned char* produceImage(Point camera, Vec3 lookAtVec, Vec3 upVec,
+                                RenderStats* stats = nullptr);
+    // Renders request's frame of the scene getScene gives on workers' threads
+    // (settings.threadCount is ignored), changing nothing but the scene getScene keeps. Any
+    // number of threads can call it at once, each with its own workers, as long as nothing
+    // edits the objects, lights or settings meanwhile.
+    void produceImage(const RenderRequest& request, Workers& workers) const;
+    // Scene the next frame renders, made first if the objects, lights or scene settings
+    // changed since the last one. It stays valid (and unchanged) for as long as it's held.
+    // Safe to call from several threads at once, not while the objects, lights or settings
+    // are being edited.
+    shared_ptr<const Scene> getScene() const;
+    // Renders request's frame of scene into request.image on workers' threads
+    // (settings.threadCount is ignored). Uses nothing but its arguments, so any number of
+    // threads can render at once, of one scene or of several, each with its own workers.
+    // Images match produceImage's with the same settings.
+    static void render(const shared_ptr<const Scene>& scene, const RenderRequest& request,
+                       Workers& workers);
+    // Progressive rendering for interactive use. startProgressive restarts refinement from a
+    // coarse pass (call it whenever the camera, settings or scene change), refineProgressive
+    // renders for about progressiveBudgetMs and returns true once the image is complete. image
+    // always holds the best image so far and the finished image matches produceImage's.
+    void startProgressive(Point camera, Vec3 lookAtVec, Vec3 upVec);
+    bool refineProgressive();
+    // Block size of the pass in progress (8 down to 1), 0 when refinement is done
+    int progressiveBlock() const;
+    ShadowStats getShadowStats() const;
+    // Camera rays the last frame traced, summed over the threads (imgSizeX * imgSizeY without
+    // anti-aliasing)
+    long long getCameraRays() const;
+    long long getReflectionRays() const;
+    // Counters and stage times of the last produceImage frame (or everything since
+    // startProgressive), see RenderStats.h
+    RenderStats getRenderStats() const;
+    // Writes the spans recorded while traceTimeline was on as a Chrome trace. Returns false
+    // and sets error if it can't (or this build has no RAYTRACER_STATS).
+    bool writeTrace(const string& fileName, string& error) const;
+    // What each pixel of the last produceImage frame cost (imgSizeX * imgSizeY entries laid out
+    // like image), empty unless recordPixelCosts was on
+    const vector<PixelCost>& getPixelCosts() const;
+    // Recompiles the objects and rebuilds the BVH, call after changing objects (produceImage
+    // builds it the first time)
+    void buildAcceleration();
+    // Scene caches are versioned binary files holding the compiled scene (every primitive,
+    // material and the BVH), the lights and the background settings. saveSceneCache writes
+    // the current scene. loadSceneCache maps a cache and renders straight from the mapped
+    // pages without copying them or creating objects, so processes rendering the same cache
+    // share its memory. It replaces the objects and lights, building from objects again
+    // (buildAcceleration) drops the cache. Both return false and set error on failure.
+    bool saveSceneCache(const string& fileName, string& error);
+    bool loadSceneCache(const string& fileName, string& error);
+    // Marks the BVH out of date so the next frame rebuilds it
+    void invalidateAcceleration();
+    // Marks the objects out of date after some moved or changed shape, with none added,
+    // removed or reordered. The next frame refits the BVH to them instead of rebuilding it
+    // (rebuilding anyway if they make a different number of spheres or triangles now, or
+    // refitting has left the tree much worse than a new one).
+    void refitAcceleration();
+    // Picks up changed object colors without rebuilding the BVH, call after changing only
+    // colors (rebuilds anyway if objects no longer share materials the same way)
+    void updateMaterials();
+    // Last image rendered, owned by the ray tracer and reused by the next frame
     unsigned char* image = nullptr;
-    // Run Time Settings
-    float distanceAwayConstant = 0.1f;
+    // Run Time Settings (the rest are in RenderSettings)
     float ambientIntensity = 0.5f;
-    bool orthogonal = true;
-    bool lightVisualization = false;
-    int imgSizeX = 256;
-    int imgSizeY = 256;
-    float projectionDistance = 144.0f;
+    // Reuse the last produceImage frame's shadow rays for pixels that see the same point (within
+    // reprojectionTolerance pixels) after the camera moves. Close to exact but not bit identical
+    // since the reused point is a little off, so it's off by default. Needs 32 lights or fewer
+    // and no light sampling. Scenes whose treeCost is below reprojectionMinTreeCost trace
+    // shadow rays about as fast as they're looked up (the default scene's is 5.5 and renders 10%
+    // slower reprojected), so they're traced anyway.
+    bool reprojection = false;
+    float reprojectionTolerance = 1.0f;
+    float reprojectionMinTreeCost = 10.0f;
+    // Record a span per frame and per tile for writeTrace (builds with RAYTRACER_STATS only),
+    // spans pile up until the ray tracer goes away
+    bool traceTimeline = false;
+    // Record the intersection tests, rays and time each pixel takes in produceImage (builds
+    // with RAYTRACER_STATS only, RenderStats.h turns them into a heatmap). Pixels are traced
+    // one ray at a time while it's on since packets share work between pixels, so the costs
+    // are the scalar path's and the frame is slower.
+    bool recordPixelCosts = false;
+    // Time refineProgressive aims to take per call, leaves room in a 60 Hz frame for the rest
+    double progressiveBudgetMs = 12.0;
+    // Objects, lights and their materials are made in sceneArena (objects.push_back(
+    // sceneArena.make<Sphere>(...))) and all freed with it when the ray tracer goes away
+    Arena sceneArena;
     // Object List
-    vector<Object*> objects = {new Sphere({125, 50, -150}, 50, {{255, 128,
-                                                                 255}, {255, 128, 255}, {255, 255, 255}, 16}),
-                               new Triangle({175, 5, -75}, {200, 55, -100},
-                                            {225, 5, -75}, {{128, 255, 255}, {128, 255, 255}, {255, 255, 255}, 16}),
-                               new Triangle({225, 5, -75}, {200, 55, -100},
-                                            {225, 5, -125}, {{128, 255, 255}, {128, 255, 255}, {255, 255, 255}, 16}),
-                               new Triangle({225, 5, -125}, {200, 55, -100},
-                                            {175, 5, -125}, {{128, 255, 255}, {128, 255, 255}, {255, 255, 255}, 16}),
-                               new Triangle({175, 5, -125}, {200, 55, -100},
-                                            {175, 5, -75}, {{128, 255, 255}, {128, 255, 255}, {255, 255, 255}, 16}),
-                               new Triangle({225, 5, -125}, {175, 5, -125},
-                                            {175, 5, -75}, {{128, 255, 255}, {128, 255, 255}, {255, 255, 255}, 16}),
-                               new Triangle({225, 5, -75}, {225, 5, -125},
-                                            {175, 5, -75}, {{128, 255, 255}, {128, 255, 255}, {255, 255, 255}, 16}),
-                               new Sphere({128, 41, -62}, 20, {{255, 128, 128},
-                                                               {255, 128, 128}, {255, 255, 255}, 16}),
-                               new Plane({0, 0, 0}, {1, 0, 0}, {0, 0, 1},
-                                         {{255, 255, 0}, {255, 255, 0}, {255, 255, 255}, 16, true}),
-                               new LightObj({100, 100, -50}, 5, {{255, 255, 0},
-                                                                 {255, 255, 0}, {255, 255, 255}, 16}),
-                               new LightObj({231, 63, -127}, 5, {{255, 255, 0},
-                                                                 {255, 255, 0}, {255, 255, 255}, 16})};
-    vector<unsigned char> backgroundColor = {0, 0, 0};
+    vector<Object*> objects = {
+        sceneArena.make<Sphere>(Point{125, 50, -150}, 50.0f,
+                                ColorPack{{255, 128, 255}, {255, 128, 255}, {255, 255, 255}, 16}),
+        sceneArena.make<Triangle>(Point{175, 5, -75}, Point{200, 55, -100}, Point{225, 5, -75},
+                                  ColorPack{{128, 255, 255}, {128, 255, 255}, {255, 255, 255}, 16}),
+        sceneArena.make<Triangle>(Point{225, 5, -75}, Point{200, 55, -100}, Point{225, 5, -125},
+                                  ColorPack{{128, 255, 255}, {128, 255, 255}, {255, 255, 255}, 16}),
+        sceneArena.make<Triangle>(Point{225, 5, -125}, Point{200, 55, -100}, Point{175, 5, -125},
+                                  ColorPack{{128, 255, 255}, {128, 255, 255}, {255, 255, 255}, 16}),
+        sceneArena.make<Triangle>(Point{175, 5, -125}, Point{200, 55, -100}, Point{175, 5, -75},
+                                  ColorPack{{128, 255, 255}, {128, 255, 255}, {255, 255, 255}, 16}),
+        sceneArena.make<Triangle>(Point{225, 5, -125}, Point{175, 5, -125}, Point{175, 5, -75},
+                                  ColorPack{{128, 255, 255}, {128, 255, 255}, {255, 255, 255}, 16}),
+        sceneArena.make<Triangle>(Point{225, 5, -75}, Point{225, 5, -125}, Point{175, 5, -75},
+                                  ColorPack{{128, 255, 255}, {128, 255, 255}, {255, 255, 255}, 16}),
+        sceneArena.make<Sphere>(Point{128, 41, -62}, 20.0f,
+                                ColorPack{{255, 128, 128}, {255, 128, 128}, {255, 255, 255}, 16}),
+        sceneArena.make<Plane>(Point{0, 0, 0}, Point{1, 0, 0}, Point{0, 0, 1},
+                               ColorPack{{255, 255, 0}, {255, 255, 0}, {255, 255, 255}, 16, true}),
+        sceneArena.make<LightObj>(Point{100, 100, -50}, 5.0f,
+                                  ColorPack{{255, 255, 0}, {255, 255, 0}, {255, 255, 255}, 16}),
+        sceneArena.make<LightObj>(Point{231, 63, -127}, 5.0f,
+                                  ColorPack{{255, 255, 0}, {255, 255, 0}, {255, 255, 255}, 16})};
+    ByteColor backgroundColor = {0, 0, 0};
     // Lights
-    vector<Light*> lights = {new Light({100, 100, -50}, 0.2f),
-                             new Light({231, 63, -127}, 0.2f)};
-};
\ No newline at end of file
+    vector<Light*> lights = {sceneArena.make<Light>(Point{100, 100, -50}, 0.2f),
+                             sceneArena.make<Light>(Point{231, 63, -127}, 0.2f)};
+};
+inline Vec3 RayTracer::addVec(const Vec3 &a, const Vec3 &b) {
+    return {a[0] + b[0], a[1] + b[1], a[2] + b[2]};
+}
+inline Vec3 RayTracer::scalarVec(float scalar, const Vec3 &a) {
+    return {a[0] * scalar, a[1] * scalar, a[2] * scalar};
+}
+inline float RayTracer::dotVec(const Vec3 &a, const Vec3 &b) {
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+inline Vec3 RayTracer::crossVec(const Vec3 &a, const Vec3 &b) {
+    return {a[1]*b[2] - a[2]*b[1], a[2]*b[0]-a[0]*b[2], a[0]*b[1]-a[1]*b[0]};
+}
+inline float RayTracer::vecMag(const Vec3 &a) {
+    return sqrt(pow(a[0], 2) + pow(a[1], 2) + pow(a[2], 2));
+}
+inline Vec3 RayTracer::normalizeVec(const Vec3 &a) {
+    float mag = vecMag(a);
+    return {a[0] / mag, a[1] / mag, a[2] / mag};
+}
+inline Vec3 RayTracer::multiplyVec(const Vec3 &a, const Vec3 &b) {
+    return {a[0] * b[0], a[1] * b[1], a[2] * b[2]};
+}
+inline Color RayTracer::scaleColor(const ByteColor &a) {
+    return {a[0] / 255.0f, a[1] / 255.0f, a[2] / 255.0f};
+}
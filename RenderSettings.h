@@ -0,0 +1,58 @@
+#include <thread>
+#include <algorithm>
+using namespace std;
+#pragma once
+// How a frame is rendered, as opposed to what is in it (RayTracer::Scene). RayTracer keeps its
+// own copy for produceImage and progressive rendering, RayTracer::RenderRequest carries one per
+// request.
+struct RenderSettings {
+    float distanceAwayConstant = 0.1f;
+    bool orthogonal = true;
+    bool lightVisualization = false;
+    int imgSizeX = 256;
+    int imgSizeY = 256;
+    float projectionDistance = 144.0f;
+    // Threads used by produceImage (the calling thread counts as one)
+    int threadCount = max(1, (int)thread::hardware_concurrency());
+    // Turn off to test every object for every ray instead of using the BVH
+    bool useBVH = true;
+    // Turn off to trace with the kernel that checks orthogonal, lightVisualization and
+    // reflectionDepth per ray instead of one compiled for the frame's settings (same image)
+    bool specializedKernels = true;
+    // Rays traced together by produceImage, 0 picks the widest the CPU supports (8 with AVX2,
+    // 4 with SSE), 4 or 8 force a width, 1 traces one ray at a time
+    int packetWidth = 0;
+    // Anti-aliasing for produceImage (progressive refinement always traces one ray per pixel).
+    // antialiasSamples is the most rays a pixel gets, 1 turns it off, 4, 16, 64 or 256 allow
+    // that many (other values round down). Adaptive mode traces one ray per pixel, then splits
+    // pixels whose color (by more than antialiasThreshold in any channel) or primitive differs
+    // from a neighbour's into 4 and keeps splitting parts whose quarters differ from the part's
+    // center. Uniform mode traces every pixel on an even grid instead.
+    int antialiasSamples = 1;
+    bool adaptiveAntialiasing = true;
+    float antialiasThreshold = 0.05f;
+    // Reflections followed per camera ray (at most 16, 0 turns them off). Paths also stop once
+    // what further hits could add falls below minReflectionWeight (the product of the
+    // reflecting materials' specular colors times the light intensity sum, 1 / 512 is under
+    // half a color step), and when the frame has traced reflectionRayBudget reflection rays (0
+    // for no limit, which pixels run out then depends on thread timing).
+    int reflectionDepth = 1;
+    float minReflectionWeight = 1.0f / 512.0f;
+    long long reflectionRayBudget = 0;
+    // Many lights: with more than lightSamples * lightSampleCost lights (lightSamples 0 turns
+    // it off), each hit traces shadow rays to lightSamples lights picked at random from a light
+    // tree, in proportion to a bound on how much light they can add there, instead of to every
+    // light. The pick is the same for the same point so frames don't flicker. A sample (a tree
+    // walk and a shadow ray traced on its own rather than in a packet) costs about as much as
+    // lightSampleCost lights shaded exactly, so with fewer lights exact shading is faster and
+    // has no noise (raytracer_bench --filter lights has the crossover at about 100 lights for
+    // 8 samples).
+    int lightSamples = 0;
+    int lightSampleCost = 12;
+    // Opt-in biased cull for light sampling: a part of the tree that can add less than
+    // lightCullThreshold times what the part next to it can is never picked. That saves samples
+    // and bright speckles from lights that hardly matter there but darkens the image slightly
+    // (by at most that fraction per tree level). 0 keeps the estimate unbiased, 1 / 512 (under
+    // half a color step) is a reasonable value to try.
+    float lightCullThreshold = 0.0f;
+};
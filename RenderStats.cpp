@@ -0,0 +1,134 @@
+#include "RenderStats.h"
+#include <cstdio>
+#include <algorithm>
+const char* const renderStageNames[StageCount] = {"ray generation", "traversal", "shading",
+                                                  "output"};
+void RenderStats::add(const RenderStats &other) {
+    enabled = enabled || other.enabled;
+    cameraRays += other.cameraRays;
+    shadowRays += other.shadowRays;
+    reflectionRays += other.reflectionRays;
+    for (int kind = 0; kind < primitiveKindCount; kind++) {
+        tests[kind] += other.tests[kind];
+    }
+    hits += other.hits;
+    misses += other.misses;
+    shadowEarlyOuts += other.shadowEarlyOuts;
+    for (int stage = 0; stage < StageCount; stage++) {
+        stageMs[stage] += other.stageMs[stage];
+    }
+    frameMs += other.frameMs;
+}
+void printRenderStats(ostream &out, const RenderStats &stats) {
+    out << "Rays: " << stats.cameraRays << " camera, " << stats.shadowRays << " shadow, "
+        << stats.reflectionRays << " reflection" << endl;
+    if (!stats.enabled) {
+        out << "(configure with -DRAYTRACER_STATS=ON for tests, hits and timings)" << endl;
+        return;
+    }
+    const char* kindNames[primitiveKindCount] = {"sphere", "triangle", "plane", "light"};
+    out << "Tests:";
+    for (int kind = 0; kind < primitiveKindCount; kind++) {
+        out << (kind == 0 ? " " : ", ") << stats.tests[kind] << " " << kindNames[kind];
+    }
+    out << endl;
+    out << "Hits: " << stats.hits << " hit, " << stats.misses << " missed, "
+        << stats.shadowEarlyOuts << " shadow early outs" << endl;
+    out << "Thread ms:";
+    for (int stage = 0; stage < StageCount; stage++) {
+        out << (stage == 0 ? " " : ", ") << renderStageNames[stage] << " " << stats.stageMs[stage];
+    }
+    out << endl;
+    if (stats.frameMs > 0.0) {
+        out << "Frame ms: " << stats.frameMs << endl;
+    }
+}
+// Both clocks read together once, at start up
+static const chrono::steady_clock::time_point clockEpoch = chrono::steady_clock::now();
+static const long long ticksEpoch = stageTicks();
+double stageTicksPerMs() {
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - clockEpoch).count();
+    return ms > 0.0 ? (double)(stageTicks() - ticksEpoch) / ms : 1e6;
+}
+void costHeatmap(const vector<PixelCost> &costs, vector<unsigned char> &image, float &scaleNs) {
+    vector<float> times(costs.size());
+    for (size_t i = 0; i < costs.size(); i++) {
+        times[i] = costs[i].nanoseconds;
+    }
+    scaleNs = 1.0f;
+    if (!times.empty()) {
+        size_t percentile = (times.size() - 1) * 99 / 100;
+        nth_element(times.begin(), times.begin() + percentile, times.end());
+        scaleNs = max(times[percentile], 1.0f);
+    }
+    const float stops[5][3] = {{0, 0, 0}, {80, 0, 140}, {220, 30, 30}, {255, 200, 0},
+                               {255, 255, 255}};
+    image.resize(costs.size() * 3);
+    for (size_t i = 0; i < costs.size(); i++) {
+        float position = min(costs[i].nanoseconds / scaleNs, 1.0f) * 4.0f;
+        int stop = min((int)position, 3);
+        float blend = position - (float)stop;
+        for (int k = 0; k < 3; k++) {
+            float value = stops[stop][k] + blend * (stops[stop + 1][k] - stops[stop][k]);
+            image[i * 3 + k] = (unsigned char)(value + 0.5f);
+        }
+    }
+}
+bool writeCostData(const string &fileName, const vector<PixelCost> &costs, int width,
+                   int height, string &error) {
+    FILE* file = fopen(fileName.c_str(), "wb");
+    if (file == nullptr) {
+        error = "Could not open " + fileName;
+        return false;
+    }
+    // A negative scale says the floats are little endian
+    unsigned short one = 1;
+    bool littleEndian = *(unsigned char*)&one == 1;
+    fprintf(file, "PF\n%d %d\n%s\n", width, height, littleEndian ? "-1.0" : "1.0");
+    static_assert(sizeof(PixelCost) == 3 * sizeof(float), "PixelCost must be 3 packed floats");
+    bool written = fwrite(costs.data(), sizeof(PixelCost), costs.size(), file) == costs.size();
+    if (fclose(file) != 0 || !written) {
+        error = "Could not write " + fileName;
+        return false;
+    }
+    return true;
+}
+void StageClock::reset() {
+    stage = -1;
+    for (int i = 0; i < StageCount; i++) {
+        ticks[i] = 0;
+    }
+}
+double traceMicroseconds() {
+    static const auto epoch = chrono::steady_clock::now();
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - epoch).count();
+}
+bool writeChromeTrace(const string &fileName, const vector<TraceEvent> &events, string &error) {
+    FILE* file = fopen(fileName.c_str(), "w");
+    if (file == nullptr) {
+        error = "Could not open " + fileName;
+        return false;
+    }
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    int threads = 0;
+    for (size_t i = 0; i < events.size(); i++) {
+        const TraceEvent& event = events[i];
+        fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                      "\"ts\":%.3f,\"dur\":%.3f},\n",
+                event.name, event.thread, event.start, event.duration);
+        threads = max(threads, event.thread + 1);
+    }
+    // Thread names, which also ends the list without a trailing comma
+    for (int thread = 0; thread < max(threads, 1); thread++) {
+        fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                      "\"args\":{\"name\":\"worker %d\"}}%s\n", thread, thread,
+                thread + 1 < max(threads, 1) ? "," : "");
+    }
+    fprintf(file, "]}\n");
+    bool written = !ferror(file);
+    if (fclose(file) != 0 || !written) {
+        error = "Could not write " + fileName;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,138 @@
+#include <vector>
+#include <string>
+#include <chrono>
+#include <ostream>
+#include "CompiledScene.h"
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+using namespace std;
+#pragma once
+// Instrumentation is only compiled in with RAYTRACER_STATS defined (cmake
+// -DRAYTRACER_STATS=ON). RAYTRACER_STAT(statement) keeps the statement in those builds and
+// drops it from every other, so the counters, stage timers and trace events cost nothing
+// in release builds.
+#ifdef RAYTRACER_STATS
+#define RAYTRACER_STAT(...) __VA_ARGS__
+#else
+#define RAYTRACER_STAT(...)
+#endif
+// Parts of a frame the stage timers split the time between
+enum RenderStage {
+    // Camera rays from the image plane
+    RayGenerationStage = 0,
+    // Closest hit and shadow ray tests, BVH included
+    TraversalStage = 1,
+    // Lighting and setting up shadow and reflection rays
+    ShadingStage = 2,
+    // Writing pixels to the image
+    OutputStage = 3,
+    StageCount = 4
+};
+extern const char* const renderStageNames[StageCount];
+// Counters and timings for a frame, summed over the threads. The ray counts are always
+// there, the rest stays 0 unless enabled (built with RAYTRACER_STATS).
+struct RenderStats {
+    bool enabled = false;
+    long long cameraRays = 0;
+    long long shadowRays = 0;
+    long long reflectionRays = 0;
+    // Ray primitive intersection tests by PrimitiveKind (a packet lane counts as one)
+    long long tests[primitiveKindCount] = {};
+    // Camera and reflection rays that hit something and that didn't
+    long long hits = 0;
+    long long misses = 0;
+    // Shadow rays that stopped at the first blocker instead of searching the whole scene
+    long long shadowEarlyOuts = 0;
+    // Thread milliseconds per RenderStage (so up to threads times the wall clock)
+    double stageMs[StageCount] = {};
+    // Wall clock milliseconds of produceImage, 0 for progressive frames
+    double frameMs = 0.0;
+    void add(const RenderStats& other);
+};
+// Human readable summary, one line per group
+void printRenderStats(ostream& out, const RenderStats& stats);
+// What one pixel cost, its anti-aliasing samples included
+struct PixelCost {
+    float tests = 0.0f;
+    float rays = 0.0f;
+    float nanoseconds = 0.0f;
+};
+// False colour image of the costs' nanoseconds laid out like produceImage's image (RGB, bottom
+// row first). Runs from black through purple, red and yellow to white at the 99th percentile
+// (so a few outliers don't wash it out), which scaleNs gets.
+void costHeatmap(const vector<PixelCost>& costs, vector<unsigned char>& image, float& scaleNs);
+// Writes the costs as a PFM image, three floats per pixel (tests, rays, nanoseconds) with the
+// bottom row first, which numpy or any PFM reader loads as is. Returns false and sets error if
+// the file can't be written.
+bool writeCostData(const string& fileName, const vector<PixelCost>& costs, int width,
+                   int height, string& error);
+// Cheap timestamp for the stage timers, the CPU's time stamp counter on x86 (a few
+// nanoseconds to read, steady_clock costs several times that) and steady_clock nanoseconds
+// elsewhere
+inline long long stageTicks() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    return (long long)__rdtsc();
+#else
+    return chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+// stageTicks per millisecond, measured against steady_clock since the program started
+double stageTicksPerMs();
+// Times one thread's work by stage. enter switches to another stage (or -1 for none) and
+// returns the one it left, so stages nest without counting the inner stage twice.
+class StageClock {
+    int stage = -1;
+    long long start = 0;
+public:
+    long long ticks[StageCount] = {};
+    void reset();
+    int enter(int newStage) {
+        long long now = stageTicks();
+        if (stage != -1) {
+            ticks[stage] += now - start;
+        }
+        int previous = stage;
+        stage = newStage;
+        start = now;
+        return previous;
+    }
+};
+// Switches a StageClock to a stage for the rest of a scope
+struct StageScope {
+    StageClock& clock;
+    int previous;
+    StageScope(StageClock& clock, int stage) : clock(clock), previous(clock.enter(stage)) {}
+    ~StageScope() {
+        clock.enter(previous);
+    }
+};
+// Span of time on one thread for the Chrome trace timeline, microseconds since the first
+// event was recorded
+struct TraceEvent {
+    const char* name;
+    double start;
+    double duration;
+    int thread;
+};
+double traceMicroseconds();
+// Records a TraceEvent for the rest of a scope, nothing if events is null
+struct TraceScope {
+    vector<TraceEvent>* events;
+    const char* name;
+    int thread;
+    double start;
+    TraceScope(vector<TraceEvent>* events, const char* name, int thread)
+        : events(events), name(name), thread(thread), start(events ? traceMicroseconds() : 0) {}
+    ~TraceScope() {
+        if (events != nullptr) {
+            events->push_back({name, start, traceMicroseconds() - start, thread});
+        }
+    }
+};
+// Writes events as Chrome trace_event JSON (chrome://tracing or ui.perfetto.dev open it),
+// thread n is named "worker n". Returns false and sets error if the file can't be written.
+bool writeChromeTrace(const string& fileName, const vector<TraceEvent>& events, string& error);
@@ -0,0 +1,281 @@
+#include "RayTracer.h"
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+// Scene cache files start with CacheHeader, followed by every array of the compiled scene at
+// the offset the header gives (from the start of the file, so the file can be mapped
+// anywhere). Arrays start on cacheAlignment byte boundaries and are stored exactly as the
+// compiled scene holds them, so a mapped file is used in place. Only the header and array
+// sizes are checked when loading, the contents are trusted like the program that wrote them.
+static const char cacheMagic[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+// Bump whenever the layout of the file or of anything stored in it changes
+static const uint32_t cacheVersion = 3;
+static const uint32_t cacheByteOrder = 0x01020304;
+static const uint64_t cacheAlignment = 64;
+static const int cacheArrayCount = 48;
+struct CacheArrayEntry {
+    uint64_t offset;
+    uint64_t bytes;
+};
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    // cacheByteOrder as written, catches files from a machine with the other byte order
+    uint32_t byteOrder;
+    // sizeof(BVH::Node), catches builds that lay nodes out differently
+    uint32_t nodeSize;
+    int32_t sphereCount;
+    int32_t vertexCount;
+    int32_t triangleCount;
+    int32_t planeCount;
+    int32_t lightObjectCount;
+    int32_t nodeCount;
+    int32_t boundedCount;
+    int32_t materialCount;
+    int32_t lightCount;
+    uint8_t backgroundColor[3];
+    uint8_t padding;
+    float ambientIntensity;
+    uint64_t fileSize;
+    CacheArrayEntry arrays[cacheArrayCount];
+};
+// Materials and lights are small and copied out when loading, stored with fixed layouts
+struct CacheMaterial {
+    uint8_t ambientConstant[3];
+    uint8_t diffuseConstant[3];
+    uint8_t specularConstant[3];
+    uint8_t reflect;
+    uint8_t padding[2];
+    float phongExponent;
+};
+struct CacheLight {
+    float location[3];
+    float intensity;
+};
+static uint64_t alignUp(uint64_t offset) {
+    return (offset + cacheAlignment - 1) / cacheAlignment * cacheAlignment;
+}
+// Calls visit(pointer, count) for every array in file order. pointer is a reference so
+// loading can point it into the file, counts come from the header.
+template <class Visit>
+static void visitArrays(const CacheHeader& header, SceneView& view, const int*& order,
+                        const int*& boundedIds, const CacheMaterial*& materials,
+                        const CacheLight*& lights, Visit visit) {
+    SphereBucket* sphereBuckets[2] = {&view.spheres, &view.lights};
+    int sphereCounts[2] = {header.sphereCount, header.lightObjectCount};
+    for (int k = 0; k < 2; k++) {
+        SphereBucket& bucket = *sphereBuckets[k];
+        visit(bucket.center.x, sphereCounts[k]);
+        visit(bucket.center.y, sphereCounts[k]);
+        visit(bucket.center.z, sphereCounts[k]);
+        visit(bucket.radius, sphereCounts[k]);
+        visit(bucket.radiusSquared, sphereCounts[k]);
+        visit(bucket.material, sphereCounts[k]);
+        visit(bucket.flags, sphereCounts[k]);
+    }
+    visit(view.triangles.vertices.x, header.vertexCount);
+    visit(view.triangles.vertices.y, header.vertexCount);
+    visit(view.triangles.vertices.z, header.vertexCount);
+    visit(view.triangles.indices, 3 * (int64_t)header.triangleCount);
+    visit(view.triangles.normal.x, header.triangleCount);
+    visit(view.triangles.normal.y, header.triangleCount);
+    visit(view.triangles.normal.z, header.triangleCount);
+    Vec3Array* triangleArrays[3] = {&view.triangles.corner, &view.triangles.edge1,
+                                    &view.triangles.edge2};
+    for (int k = 0; k < 3; k++) {
+        visit(triangleArrays[k]->x, header.triangleCount);
+        visit(triangleArrays[k]->y, header.triangleCount);
+        visit(triangleArrays[k]->z, header.triangleCount);
+    }
+    visit(view.triangles.minDeterminant, header.triangleCount);
+    visit(view.triangles.material, header.triangleCount);
+    visit(view.triangles.flags, header.triangleCount);
+    visit(view.planes.a.x, header.planeCount);
+    visit(view.planes.a.y, header.planeCount);
+    visit(view.planes.a.z, header.planeCount);
+    visit(view.planes.normal.x, header.planeCount);
+    visit(view.planes.normal.y, header.planeCount);
+    visit(view.planes.normal.z, header.planeCount);
+    visit(view.planes.offset, header.planeCount);
+    visit(view.planes.material, header.planeCount);
+    visit(view.planes.flags, header.planeCount);
+    visit(view.nodes, header.nodeCount);
+    visit(order, header.boundedCount);
+    visit(boundedIds, header.boundedCount);
+    visit(view.leafIds, header.boundedCount);
+    visit(materials, header.materialCount);
+    visit(lights, header.lightCount);
+}
+bool RayTracer::saveSceneCache(const string &fileName, string &error) {
+    shared_ptr<const Scene> saved = getScene();
+    const vector<ColorPack>& materials = saved->materials;
+    const vector<Light>& lights = saved->lights;
+    SceneView view = saved->compiled->view();
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = cacheVersion;
+    header.byteOrder = cacheByteOrder;
+    header.nodeSize = sizeof(BVH::Node);
+    header.sphereCount = view.spheres.count;
+    header.vertexCount = view.triangles.vertexCount;
+    header.triangleCount = view.triangles.count;
+    header.planeCount = view.planes.count;
+    header.lightObjectCount = view.lights.count;
+    header.nodeCount = view.nodeCount;
+    header.boundedCount = view.spheres.count + view.triangles.count;
+    header.materialCount = (int32_t)materials.size();
+    header.lightCount = (int32_t)lights.size();
+    memcpy(header.backgroundColor, saved->backgroundColor.data(), 3);
+    header.ambientIntensity = saved->ambientIntensity;
+    vector<CacheMaterial> materialRecords(materials.size());
+    for (int i = 0; i < materials.size(); i++) {
+        CacheMaterial& record = materialRecords[i];
+        memset(&record, 0, sizeof(record));
+        memcpy(record.ambientConstant, materials[i].ambientConstant.data(), 3);
+        memcpy(record.diffuseConstant, materials[i].diffuseConstant.data(), 3);
+        memcpy(record.specularConstant, materials[i].specularConstant.data(), 3);
+        record.reflect = materials[i].reflect ? 1 : 0;
+        record.phongExponent = materials[i].phongExponent;
+    }
+    vector<CacheLight> lightRecords(lights.size());
+    for (int i = 0; i < lights.size(); i++) {
+        for (int k = 0; k < 3; k++) {
+            lightRecords[i].location[k] = lights[i].location[k];
+        }
+        lightRecords[i].intensity = lights[i].intensity;
+    }
+    // Lay the arrays out after the header
+    const int* order = saved->compiled->getBVH().getOrder();
+    const int* boundedIds = saved->compiled->getBoundedIds();
+    const CacheMaterial* materialData = materialRecords.data();
+    const CacheLight* lightData = lightRecords.data();
+    vector<const void*> arrays;
+    uint64_t offset = alignUp(sizeof(CacheHeader));
+    visitArrays(header, view, order, boundedIds, materialData, lightData,
+                [&](auto& pointer, int64_t count) {
+        CacheArrayEntry& entry = header.arrays[arrays.size()];
+        entry.offset = offset;
+        entry.bytes = (uint64_t)count * sizeof(*pointer);
+        arrays.push_back(pointer);
+        offset = alignUp(offset + entry.bytes);
+    });
+    header.fileSize = offset;
+    // Written under a temporary name and renamed over the old cache, so processes that still
+    // have the old file mapped keep their pages instead of seeing it change under them
+    string tempName = fileName + ".tmp";
+    FILE* file = fopen(tempName.c_str(), "wb");
+    if (file == nullptr) {
+        error = "Could not write " + tempName;
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    uint64_t position = sizeof(header);
+    static const char zeros[cacheAlignment] = {};
+    for (int i = 0; i < arrays.size() && written; i++) {
+        const CacheArrayEntry& entry = header.arrays[i];
+        written = fwrite(zeros, 1, entry.offset - position, file) == entry.offset - position &&
+                  (entry.bytes == 0 || fwrite(arrays[i], 1, entry.bytes, file) == entry.bytes);
+        position = entry.offset + entry.bytes;
+    }
+    written = written && fwrite(zeros, 1, header.fileSize - position, file) ==
+                         header.fileSize - position;
+    written = fclose(file) == 0 && written;
+#ifdef _WIN32
+    // Windows won't rename over an existing file
+    remove(fileName.c_str());
+#endif
+    if (!written || rename(tempName.c_str(), fileName.c_str()) != 0) {
+        remove(tempName.c_str());
+        error = "Could not write " + fileName;
+        return false;
+    }
+    return true;
+}
+bool RayTracer::loadSceneCache(const string &fileName, string &error) {
+    unique_ptr<MappedFile> file(new MappedFile());
+    if (!file->open(fileName, error)) {
+        return false;
+    }
+    CacheHeader header;
+    if (file->length() < sizeof(header) ||
+        memcmp(file->bytes(), cacheMagic, sizeof(cacheMagic)) != 0) {
+        error = fileName + " isn't a scene cache";
+        return false;
+    }
+    memcpy(&header, file->bytes(), sizeof(header));
+    if (header.version != cacheVersion || header.byteOrder != cacheByteOrder ||
+        header.nodeSize != sizeof(BVH::Node)) {
+        error = fileName + " was written by a different version, compile the scene again";
+        return false;
+    }
+    int32_t counts[9] = {header.sphereCount, header.vertexCount, header.triangleCount,
+                         header.planeCount, header.lightObjectCount, header.nodeCount,
+                         header.boundedCount, header.materialCount, header.lightCount};
+    bool valid = header.fileSize == file->length() &&
+                 header.boundedCount == (int64_t)header.sphereCount + header.triangleCount;
+    for (int k = 0; k < 9; k++) {
+        valid = valid && counts[k] >= 0;
+    }
+    // Point the view into the file, every array has to be the size the counts say
+    SceneView view;
+    const int* order = nullptr;
+    const int* boundedIds = nullptr;
+    const CacheMaterial* materialData = nullptr;
+    const CacheLight* lightData = nullptr;
+    int arrayIndex = 0;
+    uint64_t length = file->length();
+    visitArrays(header, view, order, boundedIds, materialData, lightData,
+                [&](auto& pointer, int64_t count) {
+        const CacheArrayEntry& entry = header.arrays[arrayIndex++];
+        if (!valid || entry.bytes != (uint64_t)count * sizeof(*pointer) ||
+            entry.offset % cacheAlignment != 0 || entry.offset > length ||
+            entry.bytes > length - entry.offset) {
+            valid = false;
+            return;
+        }
+        pointer = (typename remove_reference<decltype(pointer)>::type)(file->bytes() +
+                                                                        entry.offset);
+    });
+    if (!valid) {
+        error = fileName + " is damaged or truncated";
+        return false;
+    }
+    view.spheres.count = header.sphereCount;
+    view.lights.count = header.lightObjectCount;
+    view.triangles.count = header.triangleCount;
+    view.triangles.vertexCount = header.vertexCount;
+    view.planes.count = header.planeCount;
+    view.nodeCount = header.nodeCount;
+    // Only materials and lights are copied, they're what shading reads per hit
+    vector<ColorPack> materials(header.materialCount);
+    for (int i = 0; i < header.materialCount; i++) {
+        const CacheMaterial& record = materialData[i];
+        ColorPack& material = materials[i];
+        memcpy(material.ambientConstant.data(), record.ambientConstant, 3);
+        memcpy(material.diffuseConstant.data(), record.diffuseConstant, 3);
+        memcpy(material.specularConstant.data(), record.specularConstant, 3);
+        material.phongExponent = record.phongExponent;
+        material.reflect = record.reflect != 0;
+    }
+    objects.clear();
+    lights.clear();
+    sceneArena.clear();
+    for (int i = 0; i < header.lightCount; i++) {
+        const CacheLight& record = lightData[i];
+        lights.push_back(sceneArena.make<Light>(Point{record.location[0], record.location[1],
+                                                      record.location[2]}, record.intensity));
+    }
+    objectMaterials.clear();
+    memcpy(backgroundColor.data(), header.backgroundColor, 3);
+    ambientIntensity = header.ambientIntensity;
+    shared_ptr<CompiledScene> geometry = make_shared<CompiledScene>();
+    geometry->attach(view, order, boundedIds);
+    makeScene(move(geometry), move(file), move(materials));
+    fixedScene = false;
+    accelerationBuilt = true;
+    refitPending = false;
+    lastView.valid = false;
+    return true;
+}
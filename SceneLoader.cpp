@@ -0,0 +1,452 @@
+#include "SceneLoader.h"
+#include "TextParser.h"
+#include "ObjLoader.h"
+#include <cstring>
+#include <unordered_map>
+#include <sys/stat.h>
+// FNV-1a, keys only need to tell objects apart, not resist attacks
+static uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+// Key of a primitive, kind is its PrimitiveKind
+static uint64_t objectKey(int kind, const float* values, int count) {
+    unsigned char kindByte = (unsigned char)kind;
+    return hashBytes(values, count * sizeof(float), hashBytes(&kindByte, 1));
+}
+// Modification time and size mixed together, -1 if the file doesn't exist
+static long long fileStamp(const string& fileName) {
+    struct stat info;
+    if (stat(fileName.c_str(), &info) != 0) {
+        return -1;
+    }
+    return (long long)info.st_mtime * 1000003 + (long long)info.st_size;
+}
+static bool sameColor(const RayTracer::ColorPack& a, const RayTracer::ColorPack& b) {
+    return a.ambientConstant == b.ambientConstant && a.diffuseConstant == b.diffuseConstant &&
+           a.specularConstant == b.specularConstant && a.phongExponent == b.phongExponent &&
+           a.reflect == b.reflect;
+}
+namespace {
+// Parser state carried from one chunk to the next. Each line is read once left to right, the
+// keyword picks the entry and the entry reads exactly the fields it needs.
+struct SceneParser {
+    SceneDescription& scene;
+    string& error;
+    // Directory of the scene file, mesh files are found relative to it
+    string directory;
+    int line = 0;
+    unordered_map<string, int> materialLookup;
+    vector<string> materialNames;
+    vector<RayTracer::ColorPack> materialColors;
+    // Consecutive objects usually share a material, checked before the map
+    int lastMaterial = -1;
+    SceneParser(SceneDescription& scene, string& error, string directory)
+            : scene(scene), error(error), directory(move(directory)) {}
+    bool fail(const string& message) {
+        error = message + " on line " + to_string(line);
+        return false;
+    }
+    static bool isEnd(char c) {
+        return c == '\n' || c == '\r' || c == '#';
+    }
+    static bool isSpace(char c) {
+        return c == ' ' || c == '\t';
+    }
+    // Word up to the next space or end of line, length is 0 if there isn't one
+    static const char* readWord(const char* c, const char*& word, size_t& length) {
+        c = skipSpaces(c);
+        word = c;
+        while (!isSpace(*c) && !isEnd(*c)) {
+            c++;
+        }
+        length = (size_t)(c - word);
+        return c;
+    }
+    static bool matches(const char* word, size_t length, const char* keyword) {
+        return strlen(keyword) == length && memcmp(word, keyword, length) == 0;
+    }
+    // count numbers, each followed by a space or the end of the line
+    static const char* readFloats(const char* c, float* values, int count) {
+        for (int k = 0; k < count; k++) {
+            c = parseFloat(skipSpaces(c), values[k]);
+            if (c == nullptr || (!isSpace(*c) && !isEnd(*c))) {
+                return nullptr;
+            }
+        }
+        return c;
+    }
+    static const char* readColor(const char* c, ByteColor& color) {
+        for (int k = 0; k < 3; k++) {
+            int value;
+            c = parseInt(skipSpaces(c), value);
+            if (c == nullptr || value < 0 || value > 255 || (!isSpace(*c) && !isEnd(*c))) {
+                return nullptr;
+            }
+            color[k] = (unsigned char)value;
+        }
+        return c;
+    }
+    // Material named at c, fails if it isn't defined
+    const char* readMaterial(const char* c, RayTracer::ColorPack& color) {
+        const char* word;
+        size_t length;
+        c = readWord(c, word, length);
+        if (lastMaterial < 0 || materialNames[lastMaterial].size() != length ||
+            memcmp(materialNames[lastMaterial].data(), word, length) != 0) {
+            auto found = materialLookup.find(string(word, length));
+            if (found == materialLookup.end()) {
+                fail(length == 0 ? "Missing material" :
+                     "Unknown material '" + string(word, length) + "'");
+                return nullptr;
+            }
+            lastMaterial = found->second;
+        }
+        color = materialColors[lastMaterial];
+        return c;
+    }
+    void addObject(RayTracer::Object* object, uint64_t key) {
+        scene.objects.push_back(object);
+        scene.keys.push_back(key);
+    }
+    // Parses every line in [c, end), end must be just past a '\n'
+    bool parse(const char* c, const char* end) {
+        while (c < end) {
+            line++;
+            const char* word;
+            size_t length;
+            c = readWord(c, word, length);
+            if (length > 0) {
+                c = parseEntry(c, word, length);
+                if (c == nullptr) {
+                    return false;
+                }
+                c = skipSpaces(c);
+                if (!isEnd(*c)) {
+                    return fail("Unexpected text");
+                }
+            }
+            c = skipLine(c);
+        }
+        return true;
+    }
+    // Reads the rest of the entry named by keyword, returns where it stopped or nullptr
+    const char* parseEntry(const char* c, const char* keyword, size_t length) {
+        float values[9];
+        RayTracer::ColorPack color;
+        if (matches(keyword, length, "triangle") || matches(keyword, length, "plane")) {
+            bool triangle = length == 8;
+            c = readFloats(c, values, 9);
+            if (c == nullptr) {
+                fail(triangle ? "Bad triangle" : "Bad plane");
+                return nullptr;
+            }
+            c = readMaterial(c, color);
+            if (c == nullptr) {
+                return nullptr;
+            }
+            Point a = {values[0], values[1], values[2]};
+            Point b = {values[3], values[4], values[5]};
+            Point d = {values[6], values[7], values[8]};
+            uint64_t key = objectKey(triangle ? TriangleKind : PlaneKind, values, 9);
+            if (triangle) {
+                addObject(scene.arena.make<RayTracer::Triangle>(a, b, d, color), key);
+            }
+            else {
+                addObject(scene.arena.make<RayTracer::Plane>(a, b, d, color), key);
+            }
+        }
+        else if (matches(keyword, length, "sphere") || matches(keyword, length, "lightobject")) {
+            bool sphere = length == 6;
+            c = readFloats(c, values, 4);
+            if (c == nullptr) {
+                fail(sphere ? "Bad sphere" : "Bad light object");
+                return nullptr;
+            }
+            c = readMaterial(c, color);
+            if (c == nullptr) {
+                return nullptr;
+            }
+            Point center = {values[0], values[1], values[2]};
+            uint64_t key = objectKey(sphere ? SphereKind : LightKind, values, 4);
+            if (sphere) {
+                addObject(scene.arena.make<RayTracer::Sphere>(center, values[3], color), key);
+            }
+            else {
+                addObject(scene.arena.make<RayTracer::LightObj>(center, values[3], color), key);
+            }
+        }
+        else if (matches(keyword, length, "mesh")) {
+            const char* word;
+            size_t wordLength;
+            c = readWord(c, word, wordLength);
+            if (wordLength == 0) {
+                fail("Bad mesh");
+                return nullptr;
+            }
+            c = readMaterial(c, color);
+            if (c == nullptr) {
+                return nullptr;
+            }
+            string fileName(word, wordLength);
+            bool absolute = fileName[0] == '/' || fileName[0] == '\\' ||
+                            (fileName.size() > 1 && fileName[1] == ':');
+            if (!absolute) {
+                fileName = directory + fileName;
+            }
+            // A mesh is the same as long as its file hasn't changed
+            long long stamp = fileStamp(fileName);
+            uint64_t key = hashBytes(fileName.data(), fileName.size(),
+                                     hashBytes(&stamp, sizeof(stamp)));
+            scene.meshes.push_back({(int)scene.objects.size(), fileName, color});
+            addObject(nullptr, key);
+        }
+        else if (matches(keyword, length, "light")) {
+            c = readFloats(c, values, 4);
+            if (c == nullptr) {
+                fail("Bad light");
+                return nullptr;
+            }
+            scene.lights.emplace_back(Point{values[0], values[1], values[2]}, values[3]);
+        }
+        else if (matches(keyword, length, "material")) {
+            const char* word;
+            size_t wordLength;
+            c = readWord(c, word, wordLength);
+            if (wordLength == 0 || (c = readColor(c, color.ambientConstant)) == nullptr ||
+                (c = readColor(c, color.diffuseConstant)) == nullptr ||
+                (c = readColor(c, color.specularConstant)) == nullptr ||
+                (c = readFloats(c, &color.phongExponent, 1)) == nullptr) {
+                fail("Bad material");
+                return nullptr;
+            }
+            const char* flag;
+            size_t flagLength;
+            const char* afterFlag = readWord(c, flag, flagLength);
+            if (matches(flag, flagLength, "reflect")) {
+                color.reflect = true;
+                c = afterFlag;
+            }
+            // Defining a name again replaces it for the lines after
+            string name(word, wordLength);
+            auto found = materialLookup.find(name);
+            if (found == materialLookup.end()) {
+                materialLookup.insert({name, (int)materialNames.size()});
+                materialNames.push_back(name);
+                materialColors.push_back(color);
+            }
+            else {
+                materialColors[found->second] = color;
+            }
+        }
+        else if (matches(keyword, length, "background")) {
+            c = readColor(c, scene.backgroundColor);
+            if (c == nullptr) {
+                fail("Bad background");
+                return nullptr;
+            }
+        }
+        else if (matches(keyword, length, "ambient")) {
+            c = readFloats(c, &scene.ambientIntensity, 1);
+            if (c == nullptr) {
+                fail("Bad ambient");
+                return nullptr;
+            }
+        }
+        else if (matches(keyword, length, "camera") || matches(keyword, length, "look") ||
+                 matches(keyword, length, "up")) {
+            Vec3* vec = length == 6 ? &scene.camera : length == 4 ? &scene.lookAtVec : &scene.upVec;
+            c = readFloats(c, values, 3);
+            if (c == nullptr) {
+                fail("Bad " + string(keyword, length));
+                return nullptr;
+            }
+            *vec = {values[0], values[1], values[2]};
+            scene.hasView = true;
+        }
+        else if (matches(keyword, length, "orthogonal")) {
+            scene.hasProjection = true;
+            scene.orthogonal = true;
+        }
+        else if (matches(keyword, length, "perspective")) {
+            c = readFloats(c, &scene.projectionDistance, 1);
+            if (c == nullptr) {
+                fail("Bad perspective");
+                return nullptr;
+            }
+            scene.hasProjection = true;
+            scene.orthogonal = false;
+        }
+        else {
+            fail("Unknown entry '" + string(keyword, length) + "'");
+            return nullptr;
+        }
+        return c;
+    }
+};
+}
+bool loadScene(const string& fileName, SceneDescription& scene, string& error) {
+    scene = SceneDescription();
+    size_t slash = fileName.find_last_of("/\\");
+    SceneParser parser(scene, error, slash == string::npos ? "" : fileName.substr(0, slash + 1));
+    return readTextChunks(fileName, [&](const char* begin, const char* end) {
+        return parser.parse(begin, end);
+    }, error);
+}
+SceneWatcher::SceneWatcher(string fileName) : fileName(move(fileName)) {}
+bool SceneWatcher::changed() const {
+    return stamp == -1 || fileStamp(fileName) != stamp;
+}
+bool SceneWatcher::reload(RayTracer &rayTracer, string &error) {
+    // A bad file isn't retried until it changes again
+    stamp = fileStamp(fileName);
+    SceneDescription scene;
+    if (!loadScene(fileName, scene, error)) {
+        return false;
+    }
+    int count = (int)scene.objects.size();
+    // Old object reused for each new one (-1 for none), matched in place first since edits
+    // usually leave the other lines where they were
+    bool reusable = rayTracer.objects == applied;
+    int oldCount = reusable ? (int)applied.size() : 0;
+    vector<int> reuse(count, -1);
+    vector<bool> reused(oldCount, false);
+    bool moved = count != oldCount;
+    // Objects added, removed or reused from another line, the BVH can't just be refit
+    bool reordered = moved;
+    for (int i = 0; i < count && i < oldCount; i++) {
+        if (scene.keys[i] == keys[i]) {
+            reuse[i] = i;
+            reused[i] = true;
+        }
+    }
+    unordered_multimap<uint64_t, int> leftOver;
+    for (int i = 0; i < oldCount; i++) {
+        if (!reused[i]) {
+            leftOver.insert({keys[i], i});
+        }
+    }
+    for (int i = 0; i < count && !leftOver.empty(); i++) {
+        if (reuse[i] == -1) {
+            auto found = leftOver.find(scene.keys[i]);
+            if (found != leftOver.end()) {
+                reuse[i] = found->second;
+                reused[found->second] = true;
+                leftOver.erase(found);
+            }
+        }
+    }
+    // Reused meshes hand their triangles over below, anything else with the same key only has
+    // its color checked. Keys don't include the kind for meshes, so check it.
+    for (int i = 0; i < scene.meshes.size(); i++) {
+        int object = scene.meshes[i].object;
+        if (reuse[object] != -1 &&
+            dynamic_cast<RayTracer::Mesh*>(applied[reuse[object]]) == nullptr) {
+            reuse[object] = -1;
+        }
+    }
+    // Meshes that changed are read before anything is touched so a bad file changes nothing
+    for (int i = 0; i < scene.meshes.size(); i++) {
+        const SceneDescription::MeshFile& mesh = scene.meshes[i];
+        if (reuse[mesh.object] != -1) {
+            continue;
+        }
+        vector<Point> vertices;
+        vector<int> indices;
+        if (!loadObj(mesh.fileName, vertices, indices, error)) {
+            return false;
+        }
+        scene.objects[mesh.object] = scene.arena.make<RayTracer::Mesh>(move(vertices),
+                                                                      move(indices), mesh.color);
+    }
+    lastChanges = 0;
+    for (int i = 0; i < scene.meshes.size(); i++) {
+        const SceneDescription::MeshFile& mesh = scene.meshes[i];
+        if (reuse[mesh.object] != -1) {
+            RayTracer::Mesh& old = static_cast<RayTracer::Mesh&>(*applied[reuse[mesh.object]]);
+            scene.objects[mesh.object] = scene.arena.make<RayTracer::Mesh>(move(old.vertices),
+                                                                          move(old.indices),
+                                                                          mesh.color);
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        if (reuse[i] == -1) {
+            moved = true;
+            continue;
+        }
+        reordered = reordered || reuse[i] != i;
+        moved = moved || reordered;
+        if (!sameColor(applied[reuse[i]]->color, scene.objects[i]->color)) {
+            lastChanges |= MaterialsChanged;
+        }
+    }
+    // Lights aren't part of the compiled scene, they're just swapped
+    bool lightsChanged = scene.lights.size() != rayTracer.lights.size();
+    for (int i = 0; !lightsChanged && i < scene.lights.size(); i++) {
+        const RayTracer::Light& light = *rayTracer.lights.at(i);
+        const RayTracer::Light& newLight = scene.lights[i];
+        lightsChanged = light.location.x != newLight.location.x ||
+                        light.location.y != newLight.location.y ||
+                        light.location.z != newLight.location.z ||
+                        light.intensity != newLight.intensity;
+    }
+    if (lightsChanged) {
+        lastChanges |= LightsChanged;
+    }
+    // Everything now lives in the new arena, the old one goes with whatever wasn't reused
+    rayTracer.lights.clear();
+    for (int i = 0; i < scene.lights.size(); i++) {
+        rayTracer.lights.push_back(scene.arena.make<RayTracer::Light>(scene.lights[i]));
+    }
+    rayTracer.objects = scene.objects;
+    rayTracer.sceneArena = move(scene.arena);
+    applied = move(scene.objects);
+    keys = move(scene.keys);
+    if (moved) {
+        lastChanges |= GeometryChanged;
+        if (reordered) {
+            rayTracer.invalidateAcceleration();
+        }
+        else {
+            rayTracer.refitAcceleration();
+        }
+    }
+    else if (lastChanges & MaterialsChanged) {
+        rayTracer.updateMaterials();
+    }
+    if (rayTracer.backgroundColor != scene.backgroundColor ||
+        rayTracer.ambientIntensity != scene.ambientIntensity ||
+        (scene.hasProjection && (rayTracer.orthogonal != scene.orthogonal ||
+                                 (!scene.orthogonal &&
+                                  rayTracer.projectionDistance != scene.projectionDistance)))) {
+        lastChanges |= SettingsChanged;
+        rayTracer.backgroundColor = scene.backgroundColor;
+        rayTracer.ambientIntensity = scene.ambientIntensity;
+        if (scene.hasProjection) {
+            rayTracer.orthogonal = scene.orthogonal;
+            // Orthogonal lines leave the distance for switching to perspective later
+            if (!scene.orthogonal) {
+                rayTracer.projectionDistance = scene.projectionDistance;
+            }
+        }
+    }
+    // The view only counts as changed when the file's camera lines change, so editing
+    // anything else leaves the viewer's camera where it is
+    bool viewChanged = scene.hasView &&
+                       (!hasView || camera.x != scene.camera.x || camera.y != scene.camera.y ||
+                        camera.z != scene.camera.z || lookAtVec.x != scene.lookAtVec.x ||
+                        lookAtVec.y != scene.lookAtVec.y || lookAtVec.z != scene.lookAtVec.z ||
+                        upVec.x != scene.upVec.x || upVec.y != scene.upVec.y ||
+                        upVec.z != scene.upVec.z);
+    if (viewChanged) {
+        lastChanges |= ViewChanged;
+    }
+    hasView = scene.hasView;
+    camera = scene.camera;
+    lookAtVec = scene.lookAtVec;
+    upVec = scene.upVec;
+    return true;
+}
@@ -0,0 +1,90 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "RayTracer.h"
+using namespace std;
+#pragma once
+// Scene files are text with one entry per line, a keyword followed by numbers separated by
+// spaces. '#' starts a comment and colors are 0 to 255.
+//   material NAME  AMBIENT_RGB  DIFFUSE_RGB  SPECULAR_RGB  PHONG_EXPONENT [reflect]
+//   sphere X Y Z  RADIUS  MATERIAL
+//   triangle X Y Z  X Y Z  X Y Z  MATERIAL
+//   plane X Y Z  X Y Z  X Y Z  MATERIAL      (through the 3 points)
+//   lightobject X Y Z  RADIUS  MATERIAL      (sphere drawn when lights are visualized)
+//   mesh FILE  MATERIAL                      (Wavefront OBJ, relative to the scene file)
+//   light X Y Z  INTENSITY
+//   background R G B
+//   ambient INTENSITY
+//   camera X Y Z, look X Y Z, up X Y Z       (where the viewer starts)
+//   orthogonal, perspective DISTANCE
+// Materials are named before they're used and names and file names can't contain spaces.
+// default.scene holds the built in scene.
+struct SceneDescription {
+    // Objects in file order, each with a key made from its kind and geometry (not its colors)
+    // so a reload can tell which ones changed. They live in arena, which a reload hands to the
+    // ray tracer as its sceneArena.
+    Arena arena;
+    vector<RayTracer::Object*> objects;
+    vector<uint64_t> keys;
+    // Meshes are only named by loadScene, their objects stay null until the OBJ file is read
+    struct MeshFile {
+        int object;
+        string fileName;
+        RayTracer::ColorPack color;
+    };
+    vector<MeshFile> meshes;
+    vector<RayTracer::Light> lights;
+    ByteColor backgroundColor = {0, 0, 0};
+    float ambientIntensity = 0.5f;
+    // Set if the file has camera, look or up lines
+    bool hasView = false;
+    Point camera = {100.0f, 100.0f, 0.0f};
+    Vec3 lookAtVec = {0.0f, 0.0f, -1.0f};
+    Vec3 upVec = {0.0f, 1.0f, 0.0f};
+    // Set if the file has an orthogonal or perspective line
+    bool hasProjection = false;
+    bool orthogonal = true;
+    float projectionDistance = 144.0f;
+};
+// Parses a scene file in one pass. Returns false and sets error (with the line number) if the
+// file can't be read or an entry is malformed.
+bool loadScene(const string& fileName, SceneDescription& scene, string& error);
+// Bits of SceneWatcher::lastChanges
+enum SceneChange {
+    GeometryChanged = 1,
+    MaterialsChanged = 2,
+    LightsChanged = 4,
+    SettingsChanged = 8,
+    ViewChanged = 16
+};
+// Keeps a ray tracer's scene in step with a scene file. A reload only redoes what changed:
+// unchanged meshes move their triangles over instead of being read again, color changes alone
+// update the materials without rebuilding the BVH and light or setting changes don't rebuild
+// anything. The reloaded scene replaces the ray tracer's sceneArena as a whole.
+class SceneWatcher {
+    string fileName;
+    // Modification time and size of the file when it was last read
+    long long stamp = -1;
+    // Objects the last reload gave the ray tracer with their keys, objects are only reused
+    // while the ray tracer still has exactly these
+    vector<RayTracer::Object*> applied;
+    vector<uint64_t> keys;
+public:
+    explicit SceneWatcher(string fileName);
+    // True if the file looks different from when it was last read, successfully or not
+    // (always before the first reload)
+    bool changed() const;
+    // Reads the file and brings rayTracer's objects, lights and settings up to date. Returns
+    // false and sets error, leaving rayTracer alone, if the file can't be read or is
+    // malformed. The BVH is rebuilt by the next frame (or buildAcceleration), or only refit
+    // if every line that changed stayed where it was.
+    bool reload(RayTracer& rayTracer, string& error);
+    // SceneChange bits for what the last successful reload changed
+    int lastChanges = 0;
+    // View from the file, only meaningful if hasView
+    bool hasView = false;
+    Point camera = {0.0f, 0.0f, 0.0f};
+    Vec3 lookAtVec = {0.0f, 0.0f, 0.0f};
+    Vec3 upVec = {0.0f, 0.0f, 0.0f};
+};
@@ -0,0 +1,49 @@
+#include "TextParser.h"
+#include <fstream>
+#include <vector>
+#include <cstring>
+// Bytes read from the file at a time
+static const int chunkSize = 1 << 20;
+bool readTextChunks(const string& fileName, const function<bool(const char*, const char*)>& parse,
+                    string& error) {
+    ifstream file(fileName, ios::in | ios::binary);
+    if (!file) {
+        error = "Could not open " + fileName;
+        return false;
+    }
+    // One spare byte so a last line without a newline can be given one
+    vector<char> buffer(chunkSize + 1);
+    size_t carried = 0;
+    while (true) {
+        file.read(&buffer[carried], (streamsize)(buffer.size() - 1 - carried));
+        size_t filled = carried + (size_t)file.gcount();
+        bool last = !file;
+        size_t end;
+        if (last) {
+            buffer[filled++] = '\n';
+            end = filled;
+        }
+        else {
+            // Parse up to the last complete line, the rest waits for the next chunk
+            end = filled;
+            while (end > 0 && buffer[end - 1] != '\n') {
+                end--;
+            }
+            if (end == 0) {
+                // One line longer than the buffer
+                carried = filled;
+                buffer.resize(buffer.size() * 2);
+                continue;
+            }
+        }
+        if (!parse(&buffer[0], &buffer[0] + end)) {
+            return false;
+        }
+        if (last) {
+            break;
+        }
+        carried = filled - end;
+        memmove(&buffer[0], &buffer[end], carried);
+    }
+    return true;
+}
@@ -0,0 +1,110 @@
+#include <string>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+using namespace std;
+#pragma once
+// Fast text parsing shared by the OBJ and scene loaders. The parsing works on complete lines
+// and the text always ends with a '\n', so scanning for the end of a line or number never
+// needs a bounds check.
+inline const char* skipSpaces(const char* c) {
+    while (*c == ' ' || *c == '\t') {
+        c++;
+    }
+    return c;
+}
+inline const char* skipLine(const char* c) {
+    while (*c != '\n') {
+        c++;
+    }
+    return c + 1;
+}
+inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+// Decimal number with optional sign, fraction and exponent, returns nullptr if there isn't one
+inline const char* parseFloat(const char* c, float& value) {
+    static const double powersOf10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                                        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+                                        1e20, 1e21, 1e22};
+    bool negative = *c == '-';
+    if (*c == '-' || *c == '+') {
+        c++;
+    }
+    // Up to 19 significant digits fit in the mantissa, any more only move the exponent
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool anyDigits = false;
+    for (; isDigit(*c); c++) {
+        anyDigits = true;
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*c - '0');
+            digits += mantissa != 0;
+        }
+        else {
+            exponent++;
+        }
+    }
+    if (*c == '.') {
+        for (c++; isDigit(*c); c++) {
+            anyDigits = true;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*c - '0');
+                digits += mantissa != 0;
+                exponent--;
+            }
+        }
+    }
+    if (!anyDigits) {
+        return nullptr;
+    }
+    if (*c == 'e' || *c == 'E') {
+        const char* e = c + 1;
+        bool negativeExponent = *e == '-';
+        if (*e == '-' || *e == '+') {
+            e++;
+        }
+        if (isDigit(*e)) {
+            int power = 0;
+            for (; isDigit(*e); e++) {
+                power = min(power * 10 + (*e - '0'), 10000);
+            }
+            exponent += negativeExponent ? -power : power;
+            c = e;
+        }
+    }
+    double result = (double)mantissa;
+    if (exponent >= 0 && exponent <= 22) {
+        result *= powersOf10[exponent];
+    }
+    else if (exponent < 0 && exponent >= -22) {
+        result /= powersOf10[-exponent];
+    }
+    else {
+        result *= pow(10.0, exponent);
+    }
+    value = (float)(negative ? -result : result);
+    return c;
+}
+inline const char* parseInt(const char* c, int& value) {
+    bool negative = *c == '-';
+    if (*c == '-' || *c == '+') {
+        c++;
+    }
+    if (!isDigit(*c)) {
+        return nullptr;
+    }
+    long long result = 0;
+    for (; isDigit(*c); c++) {
+        result = min(result * 10 + (*c - '0'), (long long)INT32_MAX);
+    }
+    value = (int)(negative ? -result : result);
+    return c;
+}
+// Reads fileName in fixed size chunks and hands parse whole lines, [begin, end) with end just
+// past a '\n' (a last line without one gets one). Returns false if the file can't be opened
+// (setting error) or parse returns false.
+bool readTextChunks(const string& fileName, const function<bool(const char*, const char*)>& parse,
+                    string& error);
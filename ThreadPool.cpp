@@ -0,0 +1,119 @@
+#include "ThreadPool.h"
+ThreadPool::ThreadPool(int threadCount) {
+    threadCount = max(1, threadCount);
+    for (int i = 0; i < threadCount; i++) {
+        queues.emplace_back(new WorkQueue());
+    }
+    // Worker 0 is whoever calls parallelFor
+    for (int i = 1; i < threadCount; i++) {
+        threads.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> guard(stateLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (int i = 0; i < threads.size(); i++) {
+        threads.at(i).join();
+    }
+}
+int ThreadPool::size() const {
+    return (int)queues.size();
+}
+void ThreadPool::reserve(int jobCount) {
+    // parallelFor gives no worker more than jobCount / size() rounded up
+    int perWorker = (jobCount + size() - 1) / size();
+    for (int worker = 0; worker < size(); worker++) {
+        WorkQueue& queue = *queues.at(worker);
+        lock_guard<mutex> guard(queue.lock);
+        queue.jobs.reserve(perWorker);
+    }
+}
+void ThreadPool::parallelFor(int jobCount, const function<void(int, int)>& job) {
+    if (jobCount <= 0) {
+        return;
+    }
+    // Single thread, no need for any of the queue machinery
+    if (threads.empty()) {
+        for (int i = 0; i < jobCount; i++) {
+            job(i, 0);
+        }
+        return;
+    }
+    {
+        lock_guard<mutex> guard(stateLock);
+        // Give each worker a contiguous run of jobs so neighbouring tiles stay together
+        int workerCount = size();
+        for (int worker = 0; worker < workerCount; worker++) {
+            int first = (int)((long)jobCount * worker / workerCount);
+            int last = (int)((long)jobCount * (worker + 1) / workerCount);
+            WorkQueue& queue = *queues.at(worker);
+            lock_guard<mutex> queueGuard(queue.lock);
+            queue.jobs.clear();
+            queue.front = 0;
+            for (int i = first; i < last; i++) {
+                queue.jobs.push_back(i);
+            }
+        }
+        currentJob = &job;
+        finishedWorkers = 0;
+        generation++;
+    }
+    wake.notify_all();
+    runJobs(0, job);
+    // Every worker has to check in before returning, so none of them can still hold the job
+    unique_lock<mutex> guard(stateLock);
+    done.wait(guard, [this]() { return finishedWorkers == (int)threads.size(); });
+    currentJob = nullptr;
+}
+void ThreadPool::workerLoop(int worker) {
+    long seenGeneration = 0;
+    while (true) {
+        const function<void(int, int)>* job;
+        {
+            unique_lock<mutex> guard(stateLock);
+            wake.wait(guard, [&]() { return stopping || generation != seenGeneration; });
+            if (stopping) {
+                return;
+            }
+            seenGeneration = generation;
+            job = currentJob;
+        }
+        runJobs(worker, *job);
+        {
+            lock_guard<mutex> guard(stateLock);
+            finishedWorkers++;
+        }
+        done.notify_all();
+    }
+}
+void ThreadPool::runJobs(int worker, const function<void(int, int)>& job) {
+    int jobIndex;
+    while (popJob(worker, jobIndex)) {
+        job(jobIndex, worker);
+    }
+}
+bool ThreadPool::popJob(int worker, int& jobIndex) {
+    // Own queue first
+    {
+        WorkQueue& own = *queues.at(worker);
+        lock_guard<mutex> guard(own.lock);
+        if (own.front < own.jobs.size()) {
+            jobIndex = own.jobs[own.front++];
+            return true;
+        }
+    }
+    // Otherwise steal from the back of someone else's queue
+    for (int offset = 1; offset < size(); offset++) {
+        WorkQueue& victim = *queues.at((worker + offset) % size());
+        lock_guard<mutex> guard(victim.lock);
+        if (victim.front < victim.jobs.size()) {
+            jobIndex = victim.jobs.back();
+            victim.jobs.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,41 @@
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+using namespace std;
+#pragma once
+// Persistent pool of worker threads that splits a batch of jobs between per-worker
+// queues and lets idle workers steal from busy ones
+class ThreadPool {
+    // Each worker owns a queue, it takes jobs from the front and thieves take from the back.
+    // Jobs before front are done, the vector keeps its capacity so batches don't allocate.
+    struct WorkQueue {
+        mutex lock;
+        vector<int> jobs;
+        size_t front = 0;
+    };
+    vector<thread> threads;
+    vector<unique_ptr<WorkQueue>> queues;
+    mutex stateLock;
+    condition_variable wake;
+    condition_variable done;
+    const function<void(int, int)>* currentJob = nullptr;
+    long generation = 0;
+    int finishedWorkers = 0;
+    bool stopping = false;
+    void workerLoop(int worker);
+    void runJobs(int worker, const function<void(int, int)>& job);
+    bool popJob(int worker, int& jobIndex);
+public:
+    // The calling thread counts as one of the threads
+    explicit ThreadPool(int threadCount);
+    ~ThreadPool();
+    int size() const;
+    // Makes room for batches of up to jobCount jobs, so parallelFor doesn't allocate when a
+    // batch is bigger than any before it
+    void reserve(int jobCount);
+    // Calls job(jobIndex, worker) for every jobIndex in [0, jobCount), returns once all are done
+    void parallelFor(int jobCount, const function<void(int, int)>& job);
+};
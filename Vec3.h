@@ -0,0 +1,32 @@
+#include <array>
+using namespace std;
+#pragma once
+// Fixed size 3 component vector, lives on the stack so vector math never allocates
+struct Vec3 {
+    float x;
+    float y;
+    float z;
+    // Index access so components can be used like the old vector<float>
+    float& operator[](int i) {
+        return i == 0 ? x : (i == 1 ? y : z);
+    }
+    const float& operator[](int i) const {
+        return i == 0 ? x : (i == 1 ? y : z);
+    }
+};
+// Colors (0 to 1 per channel) and points are both just three floats
+using Color = Vec3;
+using Point = Vec3;
+// Material constants are stored as 0 to 255 bytes
+using ByteColor = array<unsigned char, 3>;
+// c to a whole power by squaring, a few multiplies instead of pow for the whole Phong exponents
+// materials usually have
+inline float wholePower(float c, int exponent) {
+    float result = 1.0f;
+    for (; exponent != 0; exponent >>= 1, c *= c) {
+        if (exponent & 1) {
+            result *= c;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,1546 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <atomic>
+#include <thread>
+#include <cstdlib>
+#include <cstdio>
+#include <new>
+#include "RayTracer.h"
+#include "ObjLoader.h"
+#include "Animation.h"
+#include "ImageSink.h"
+#include "SceneLoader.h"
+#include "LightTree.h"
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#endif
+using namespace std;
+// Benchmarks for the intersection kernels (micro) and for whole frames (macro).
+// Frame benchmarks count one ray per pixel (primary rays).
+// One measured benchmark, times are in nanoseconds per ray and milliseconds per sample
+struct Result {
+    string group;
+    string name;
+    double nsPerRay = 0;
+    double mraysPerSec = 0;
+    double p50Ms = 0;
+    double p90Ms = 0;
+    double p99Ms = 0;
+    int samples = 0;
+    // Anything else worth reporting (build times, speedups, ...)
+    vector<pair<string, double>> extra;
+};
+struct Options {
+    string filter;
+    string jsonFile;
+    bool quick = false;
+};
+Options options;
+vector<Result> results;
+// Results get written here so the compiler can't throw the work away
+volatile float sink;
+// Live heap bytes for the memory numbers, every allocation keeps its size just in front of it.
+// heapAllocations counts every operator new call.
+atomic<long long> heapBytes(0);
+atomic<long long> heapAllocations(0);
+void* operator new(size_t size) {
+    size_t* block = (size_t*)malloc(size + 16);
+    if (block == nullptr) {
+        throw bad_alloc();
+    }
+    block[0] = size;
+    heapBytes += (long long)size;
+    heapAllocations++;
+    return (char*)block + 16;
+}
+void operator delete(void* pointer) noexcept {
+    if (pointer == nullptr) {
+        return;
+    }
+    size_t* block = (size_t*)((char*)pointer - 16);
+    heapBytes -= (long long)block[0];
+    free(block);
+}
+void operator delete(void* pointer, size_t) noexcept {
+    operator delete(pointer);
+}
+double nowMs() {
+    return chrono::duration<double, milli>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+double percentile(vector<double> samples, double fraction) {
+    sort(samples.begin(), samples.end());
+    int index = min((int)samples.size() - 1, (int)(fraction * (double)(samples.size() - 1) + 0.5));
+    return samples[index];
+}
+bool selected(const string& group, const string& name) {
+    return options.filter.empty() || (group + "/" + name).find(options.filter) != string::npos;
+}
+// Fills in the percentiles and rates from per sample times and adds the result
+void report(Result result, const vector<double>& sampleMs, double raysPerSample) {
+    result.samples = (int)sampleMs.size();
+    result.p50Ms = percentile(sampleMs, 0.5);
+    result.p90Ms = percentile(sampleMs, 0.9);
+    result.p99Ms = percentile(sampleMs, 0.99);
+    result.nsPerRay = result.p50Ms * 1e6 / raysPerSample;
+    result.mraysPerSec = raysPerSample / (result.p50Ms * 1e3);
+    cout << left << setw(10) << result.group << setw(34) << result.name << right << fixed
+         << setprecision(2) << setw(10) << result.nsPerRay << " ns/ray" << setw(10)
+         << result.mraysPerSec << " Mrays/s" << setw(10) << result.p50Ms << " p50 ms"
+         << setw(10) << result.p99Ms << " p99 ms";
+    for (int i = 0; i < result.extra.size(); i++) {
+        cout << "  " << result.extra[i].first << "=" << result.extra[i].second;
+    }
+    cout << endl;
+    results.push_back(result);
+}
+void writeJson(const string& fileName) {
+    ofstream file(fileName);
+    file << "{\n  \"results\": [\n";
+    for (int i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        file << "    {\"group\": \"" << r.group << "\", \"name\": \"" << r.name
+             << "\", \"ns_per_ray\": " << r.nsPerRay << ", \"mrays_per_sec\": " << r.mraysPerSec
+             << ", \"p50_ms\": " << r.p50Ms << ", \"p90_ms\": " << r.p90Ms << ", \"p99_ms\": "
+             << r.p99Ms << ", \"samples\": " << r.samples;
+        for (int k = 0; k < r.extra.size(); k++) {
+            file << ", \"" << r.extra[k].first << "\": " << r.extra[k].second;
+        }
+        file << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n}\n";
+}
+// Repeats body until it has run for about budgetMs (and at least minSamples times)
+vector<double> sample(const function<void()>& body, double budgetMs, int minSamples,
+                      int maxSamples) {
+    vector<double> times;
+    double start = nowMs();
+    while ((int)times.size() < maxSamples &&
+           ((int)times.size() < minSamples || nowMs() - start < budgetMs)) {
+        double before = nowMs();
+        body();
+        times.push_back(nowMs() - before);
+    }
+    return times;
+}
+// Random unit vector
+Vec3 randomDirection(mt19937& rng) {
+    normal_distribution<float> gaussian;
+    return RayTracer::normalizeVec({gaussian(rng), gaussian(rng), gaussian(rng)});
+}
+// Rays from random origins around target point, aimed offsetMin to offsetMax away from it
+// (sideways to the ray) so hits, misses and grazing rays can all be made the same way
+struct RaySet {
+    vector<Point> origins;
+    vector<Vec3> directions;
+};
+RaySet aimedRays(mt19937& rng, int count, const Point& target, float distance, float offsetMin,
+                 float offsetMax) {
+    RaySet rays;
+    uniform_real_distribution<float> offsetDist(offsetMin, offsetMax);
+    for (int i = 0; i < count; i++) {
+        Point origin = RayTracer::addVec(target, RayTracer::scalarVec(distance, randomDirection(rng)));
+        Vec3 toTarget = RayTracer::normalizeVec(RayTracer::addVec(target, RayTracer::scalarVec(-1, origin)));
+        Vec3 side = RayTracer::normalizeVec(RayTracer::crossVec(toTarget, randomDirection(rng)));
+        Point aim = RayTracer::addVec(target, RayTracer::scalarVec(offsetDist(rng), side));
+        rays.origins.push_back(origin);
+        rays.directions.push_back(RayTracer::normalizeVec(RayTracer::addVec(aim, RayTracer::scalarVec(-1, origin))));
+    }
+    return rays;
+}
+void benchIntersection(const string& name, RayTracer::Object& object, const RaySet& rays) {
+    if (!selected("micro", name)) {
+        return;
+    }
+    int count = (int)rays.origins.size();
+    int hits = 0;
+    vector<double> times = sample([&]() {
+        float total = 0;
+        hits = 0;
+        for (int i = 0; i < count; i++) {
+            float t = object.intersection(rays.origins[i], rays.directions[i]);
+            total += t;
+            hits += t != -1;
+        }
+        sink = total;
+    }, options.quick ? 50 : 300, 5, 100000);
+    Result result;
+    result.group = "micro";
+    result.name = name;
+    result.extra.push_back({"hit_rate", (double)hits / count});
+    report(result, times, count);
+}
+// The same rays against the object compiled on its own into a CompiledScene, the kernel
+// rendering uses. Checks it against Object::intersection: mismatches counts rays where one hits
+// and the other doesn't, max_relative_error is the largest distance difference over the rest.
+// Grazing spheres can count a few (see intersectSphere), test_intersections asserts the bounds.
+void benchCompiled(const string& name, RayTracer::Object& object, PrimitiveKind kind,
+                   const RaySet& rays) {
+    if (!selected("micro", name)) {
+        return;
+    }
+    CompiledScene scene;
+    object.compile(scene, 0);
+    scene.finish();
+    int id = kind << primitiveKindShift;
+    int count = (int)rays.origins.size();
+    int hits = 0;
+    int mismatches = 0;
+    double maxError = 0;
+    for (int i = 0; i < count; i++) {
+        float expected = object.intersection(rays.origins[i], rays.directions[i]);
+        float t = scene.intersect(id, rays.origins[i], rays.directions[i]);
+        if ((t == -1) != (expected == -1)) {
+            mismatches++;
+        }
+        else if (t != -1) {
+            maxError = max(maxError, (double)fabs(t - expected) / max((double)expected, 1e-6));
+        }
+    }
+    vector<double> times = sample([&]() {
+        float total = 0;
+        hits = 0;
+        for (int i = 0; i < count; i++) {
+            float t = scene.intersect(id, rays.origins[i], rays.directions[i]);
+            total += t;
+            hits += t != -1;
+        }
+        sink = total;
+    }, options.quick ? 50 : 300, 5, 100000);
+    Result result;
+    result.group = "micro";
+    result.name = name;
+    result.extra.push_back({"hit_rate", (double)hits / count});
+    result.extra.push_back({"mismatches", (double)mismatches});
+    result.extra.push_back({"max_relative_error", maxError});
+    report(result, times, count);
+}
+void benchNormal(const string& name, RayTracer::Object& object, const vector<Point>& points) {
+    if (!selected("micro", name)) {
+        return;
+    }
+    vector<double> times = sample([&]() {
+        float total = 0;
+        for (int i = 0; i < points.size(); i++) {
+            total += object.getNormal(points[i]).x;
+        }
+        sink = total;
+    }, options.quick ? 50 : 300, 5, 100000);
+    Result result;
+    result.group = "micro";
+    result.name = name;
+    report(result, times, (double)points.size());
+}
+void benchPrimitives() {
+    const int rayCount = 4096;
+    mt19937 rng(7);
+    RayTracer::ColorPack color({255, 255, 255}, {255, 255, 255}, {255, 255, 255}, 16);
+    // Sphere of radius 1, rays pass through the middle, just off the silhouette or well past it
+    RayTracer::Sphere sphere({0, 0, 0}, 1, color);
+    RaySet sphereHit = aimedRays(rng, rayCount, {0, 0, 0}, 10, 0.0f, 0.9f);
+    RaySet sphereMiss = aimedRays(rng, rayCount, {0, 0, 0}, 10, 1.5f, 3.0f);
+    RaySet sphereGrazing = aimedRays(rng, rayCount, {0, 0, 0}, 10, 0.99f, 1.01f);
+    benchIntersection("sphere.intersection/hit", sphere, sphereHit);
+    benchIntersection("sphere.intersection/miss", sphere, sphereMiss);
+    benchIntersection("sphere.intersection/grazing", sphere, sphereGrazing);
+    benchCompiled("compiled.sphere/hit", sphere, SphereKind, sphereHit);
+    benchCompiled("compiled.sphere/miss", sphere, SphereKind, sphereMiss);
+    benchCompiled("compiled.sphere/grazing", sphere, SphereKind, sphereGrazing);
+    vector<Point> spherePoints;
+    for (int i = 0; i < rayCount; i++) {
+        spherePoints.push_back(randomDirection(rng));
+    }
+    benchNormal("sphere.getNormal", sphere, spherePoints);
+    // Triangle in the z = 0 plane, grazing rays are aimed at its edges
+    Point a = {-1, -1, 0};
+    Point b = {0, 1, 0};
+    Point c = {1, -1, 0};
+    RayTracer::Triangle triangle(a, b, c, color);
+    Point centroid = {0, -1.0f / 3.0f, 0};
+    RaySet triangleHit = aimedRays(rng, rayCount, centroid, 10, 0.0f, 0.4f);
+    RaySet triangleMiss = aimedRays(rng, rayCount, centroid, 10, 2.0f, 4.0f);
+    benchIntersection("triangle.intersection/hit", triangle, triangleHit);
+    benchIntersection("triangle.intersection/miss", triangle, triangleMiss);
+    RaySet edgeRays;
+    uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (int i = 0; i < rayCount; i++) {
+        Point edgeStart = i % 3 == 0 ? a : (i % 3 == 1 ? b : c);
+        Point edgeEnd = i % 3 == 0 ? b : (i % 3 == 1 ? c : a);
+        float along = unit(rng);
+        Point edgePoint = RayTracer::addVec(RayTracer::scalarVec(1 - along, edgeStart),
+                                            RayTracer::scalarVec(along, edgeEnd));
+        RaySet one = aimedRays(rng, 1, edgePoint, 10, 0.0f, 0.001f);
+        edgeRays.origins.push_back(one.origins[0]);
+        edgeRays.directions.push_back(one.directions[0]);
+    }
+    benchIntersection("triangle.intersection/grazing", triangle, edgeRays);
+    benchCompiled("compiled.triangle/hit", triangle, TriangleKind, triangleHit);
+    benchCompiled("compiled.triangle/miss", triangle, TriangleKind, triangleMiss);
+    benchCompiled("compiled.triangle/grazing", triangle, TriangleKind, edgeRays);
+    // Rays in the triangle's plane, which both tests count as misses
+    RaySet parallelRays;
+    for (int i = 0; i < rayCount; i++) {
+        parallelRays.origins.push_back({unit(rng) * 4 - 2, unit(rng) * 4 - 2, 0});
+        float angle = unit(rng) * 6.2831853f;
+        parallelRays.directions.push_back({cos(angle), sin(angle), 0});
+    }
+    benchCompiled("compiled.triangle/parallel", triangle, TriangleKind, parallelRays);
+    vector<Point> trianglePoints;
+    for (int i = 0; i < rayCount; i++) {
+        trianglePoints.push_back({unit(rng) - 0.5f, unit(rng) - 0.5f, 0});
+    }
+    benchNormal("triangle.getNormal", triangle, trianglePoints);
+    // Plane y = 0, rays from above going down, going up, or almost parallel to it
+    RayTracer::Plane plane({0, 0, 0}, {1, 0, 0}, {0, 0, 1}, color);
+    RaySet planeHit;
+    RaySet planeMiss;
+    RaySet planeGrazing;
+    for (int i = 0; i < rayCount; i++) {
+        Point origin = {unit(rng) * 100, 1 + unit(rng) * 10, unit(rng) * 100};
+        Vec3 direction = randomDirection(rng);
+        direction.y = -fabs(direction.y) - 0.1f;
+        planeHit.origins.push_back(origin);
+        planeHit.directions.push_back(RayTracer::normalizeVec(direction));
+        direction.y = -direction.y;
+        planeMiss.origins.push_back(origin);
+        planeMiss.directions.push_back(RayTracer::normalizeVec(direction));
+        direction.y = -0.001f * unit(rng);
+        planeGrazing.origins.push_back(origin);
+        planeGrazing.directions.push_back(RayTracer::normalizeVec(direction));
+    }
+    benchIntersection("plane.intersection/hit", plane, planeHit);
+    benchIntersection("plane.intersection/miss", plane, planeMiss);
+    benchIntersection("plane.intersection/grazing", plane, planeGrazing);
+    benchCompiled("compiled.plane/hit", plane, PlaneKind, planeHit);
+    benchCompiled("compiled.plane/miss", plane, PlaneKind, planeMiss);
+    benchCompiled("compiled.plane/grazing", plane, PlaneKind, planeGrazing);
+    benchNormal("plane.getNormal", plane, trianglePoints);
+}
+// Same settings the viewer uses for the default camera
+void setupFrame(RayTracer& rayTracer, int size, bool orthogonal) {
+    rayTracer.imgSizeX = size;
+    rayTracer.imgSizeY = size;
+    rayTracer.orthogonal = orthogonal;
+    rayTracer.projectionDistance = 0.5625f * (float)size;
+}
+vector<double> sampleFrames(RayTracer& rayTracer, double budgetMs, int minSamples) {
+    // First frame builds the BVH and thread pool, keep it out of the numbers
+    rayTracer.produceImage({100, 100, 0}, {0, 0, -1}, {0, 1, 0});
+    return sample([&]() {
+        rayTracer.produceImage({100, 100, 0}, {0, 0, -1}, {0, 1, 0});
+    }, budgetMs, minSamples, 1000);
+}
+void benchFrames() {
+    vector<int> sizes = {32, 256, 1024};
+    if (options.quick) {
+        sizes.pop_back();
+    }
+    for (int s = 0; s < sizes.size(); s++) {
+        for (int mode = 0; mode < 2; mode++) {
+            string name = string(mode == 0 ? "orthogonal" : "perspective") + "/" +
+                          to_string(sizes[s]);
+            if (!selected("frame", name)) {
+                continue;
+            }
+            RayTracer rayTracer;
+            setupFrame(rayTracer, sizes[s], mode == 0);
+            vector<double> times = sampleFrames(rayTracer, options.quick ? 200 : 2000, 5);
+            Result result;
+            result.group = "frame";
+            result.name = name;
+            result.extra.push_back({"threads", (double)rayTracer.threadCount});
+            report(result, times, (double)sizes[s] * sizes[s]);
+        }
+    }
+}
+// Default scene rendered with the kernel compiled for each combination of projection, light
+// visualization and reflections, against the generic kernel that checks them per ray
+void benchKernels() {
+    int size = 256;
+    for (int mode = 0; mode < 8; mode++) {
+        bool orthogonal = (mode & 1) != 0;
+        bool lights = (mode & 2) != 0;
+        bool reflect = (mode & 4) != 0;
+        string modeName = string(orthogonal ? "ortho" : "persp") +
+                          (lights ? "/lights" : "") + (reflect ? "/reflect" : "/noreflect");
+        double genericMs = 0;
+        for (int specialized = 0; specialized < 2; specialized++) {
+            string name = modeName + (specialized ? "/specialized" : "/generic");
+            if (!selected("kernels", name)) {
+                continue;
+            }
+            RayTracer rayTracer;
+            setupFrame(rayTracer, size, orthogonal);
+            rayTracer.lightVisualization = lights;
+            rayTracer.reflectionDepth = reflect ? 1 : 0;
+            rayTracer.specializedKernels = specialized == 1;
+            vector<double> times = sampleFrames(rayTracer, options.quick ? 200 : 1000, 5);
+            Result result;
+            result.group = "kernels";
+            result.name = name;
+            if (specialized == 0) {
+                genericMs = percentile(times, 0.5);
+            }
+            else if (genericMs > 0) {
+                result.extra.push_back({"speedup_vs_generic", genericMs / percentile(times, 0.5)});
+            }
+            report(result, times, (double)size * size);
+        }
+    }
+}
+// Page faults the process has taken so far (0 where getrusage isn't available)
+long long pageFaults() {
+#ifdef _WIN32
+    return 0;
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (long long)usage.ru_minflt + usage.ru_majflt;
+#endif
+}
+// Heap allocations and page faults per frame once a ray tracer has warmed up, and for its
+// first frame (which builds the BVH, thread pool and framebuffer, so it depends on what ran
+// before). Whole frames and progressive refinement run to completion.
+void benchAllocations() {
+    vector<int> sizes = {256, 1024};
+    int maxThreads = max(1, (int)thread::hardware_concurrency());
+    vector<int> threadCounts = {1, max(4, maxThreads)};
+    for (int s = 0; s < sizes.size(); s++) {
+        for (int t = 0; t < threadCounts.size(); t++) {
+            for (int progressive = 0; progressive < 2; progressive++) {
+                string name = string(progressive ? "progressive" : "frame") + "/" +
+                              to_string(sizes[s]) + "/threads" + to_string(threadCounts[t]);
+                if (!selected("alloc", name)) {
+                    continue;
+                }
+                RayTracer rayTracer;
+                setupFrame(rayTracer, sizes[s], false);
+                rayTracer.threadCount = threadCounts[t];
+                auto frame = [&]() {
+                    if (progressive) {
+                        rayTracer.startProgressive({100, 100, 0}, {0, 0, -1}, {0, 1, 0});
+                        while (!rayTracer.refineProgressive()) {
+                        }
+                    }
+                    else {
+                        rayTracer.produceImage({100, 100, 0}, {0, 0, -1}, {0, 1, 0});
+                    }
+                };
+                long long firstAllocations = heapAllocations;
+                long long firstFaults = pageFaults();
+                frame();
+                firstAllocations = heapAllocations - firstAllocations;
+                firstFaults = pageFaults() - firstFaults;
+                // Counted over a fixed run so the timing samples' own allocations stay out
+                int frames = 5;
+                long long allocations = heapAllocations;
+                long long faults = pageFaults();
+                for (int i = 0; i < frames; i++) {
+                    frame();
+                }
+                allocations = heapAllocations - allocations;
+                faults = pageFaults() - faults;
+                vector<double> times = sample(frame, options.quick ? 200 : 1000, 3, 200);
+                Result result;
+                result.group = "alloc";
+                result.name = name;
+                result.extra.push_back({"allocs_per_frame", (double)allocations / frames});
+                result.extra.push_back({"faults_per_frame", (double)faults / frames});
+                result.extra.push_back({"first_frame_allocs", (double)firstAllocations});
+                result.extra.push_back({"first_frame_faults", (double)firstFaults});
+                report(result, times, (double)sizes[s] * sizes[s]);
+            }
+        }
+    }
+}
+void benchThreads() {
+    int maxThreads = max(1, (int)thread::hardware_concurrency());
+    vector<int> threadCounts;
+    for (int threads = 1; threads < maxThreads; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(maxThreads);
+    double singleThreadMs = 0;
+    for (int i = 0; i < threadCounts.size(); i++) {
+        string name = "perspective/256/" + to_string(threadCounts[i]);
+        if (!selected("threads", name)) {
+            continue;
+        }
+        RayTracer rayTracer;
+        setupFrame(rayTracer, 256, false);
+        rayTracer.threadCount = threadCounts[i];
+        vector<double> times = sampleFrames(rayTracer, options.quick ? 200 : 1000, 5);
+        if (threadCounts[i] == 1) {
+            singleThreadMs = percentile(times, 0.5);
+        }
+        Result result;
+        result.group = "threads";
+        result.name = name;
+        if (singleThreadMs > 0) {
+            result.extra.push_back({"speedup", singleThreadMs / percentile(times, 0.5)});
+        }
+        report(result, times, 256.0 * 256.0);
+    }
+}
+// Adds count small random triangles (and a few spheres) in front of the default camera
+void addRandomScene(RayTracer& rayTracer, int triangleCount, int sphereCount, unsigned seed) {
+    mt19937 rng(seed);
+    uniform_real_distribution<float> position(0, 250);
+    uniform_real_distribution<float> size(-5, 5);
+    RayTracer::ColorPack color({200, 100, 50}, {200, 100, 50}, {255, 255, 255}, 16);
+    for (int i = 0; i < triangleCount; i++) {
+        Point a = {position(rng), position(rng), -position(rng)};
+        Point b = {a.x + size(rng), a.y + size(rng), a.z + size(rng)};
+        Point c = {a.x + size(rng), a.y + size(rng), a.z + size(rng)};
+        rayTracer.objects.push_back(rayTracer.sceneArena.make<RayTracer::Triangle>(a, b, c, color));
+    }
+    for (int i = 0; i < sphereCount; i++) {
+        Point center = {position(rng), position(rng), -position(rng)};
+        rayTracer.objects.push_back(rayTracer.sceneArena.make<RayTracer::Sphere>(center,
+                                                                                 fabs(size(rng)),
+                                                                                 color));
+    }
+}
+void benchBVH() {
+    vector<int> triangleCounts = {1000, 10000};
+    if (!options.quick) {
+        triangleCounts.push_back(100000);
+    }
+    for (int i = 0; i < triangleCounts.size(); i++) {
+        RayTracer rayTracer;
+        addRandomScene(rayTracer, triangleCounts[i], triangleCounts[i] / 100, 1);
+        setupFrame(rayTracer, 64, false);
+        double buildMs = nowMs();
+        rayTracer.buildAcceleration();
+        buildMs = nowMs() - buildMs;
+        for (int linear = 0; linear < 2; linear++) {
+            string name = to_string(triangleCounts[i]) + (linear ? "/linear" : "/bvh");
+            // The linear scan at 100k triangles takes minutes per frame
+            if (!selected("bvh", name) || (linear && triangleCounts[i] > 10000)) {
+                continue;
+            }
+            rayTracer.useBVH = linear == 0;
+            vector<double> times = sampleFrames(rayTracer, options.quick ? 200 : 1000, linear ? 1 : 5);
+            Result result;
+            result.group = "bvh";
+            result.name = name;
+            if (!linear) {
+                result.extra.push_back({"build_ms", buildMs});
+            }
+            report(result, times, 64.0 * 64.0);
+        }
+    }
+}
+// Scalar rays against SSE and AVX2 packets, single threaded so only the tracing differs
+void benchPackets() {
+    int widths[3] = {1, 4, 8};
+    for (int dense = 0; dense < 2; dense++) {
+        for (int mode = 0; mode < 2; mode++) {
+            double scalarMs = 0;
+            for (int w = 0; w < 3; w++) {
+                string name = string(dense ? "dense" : "default") + "/" +
+                              (mode == 0 ? "orthogonal" : "perspective") + "/" +
+                              (widths[w] == 1 ? "scalar" : "x" + to_string(widths[w]));
+                if (!selected("packets", name) ||
+                    (widths[w] > 1 && selectPacketKernels(widths[w]) == nullptr)) {
+                    continue;
+                }
+                RayTracer rayTracer;
+                if (dense) {
+                    addRandomScene(rayTracer, 20000, 0, 2);
+                }
+                setupFrame(rayTracer, 256, mode == 0);
+                rayTracer.threadCount = 1;
+                rayTracer.packetWidth = widths[w];
+                vector<double> times = sampleFrames(rayTracer, options.quick ? 200 : 1000, 5);
+                Result result;
+                result.group = "packets";
+                result.name = name;
+                if (widths[w] == 1) {
+                    scalarMs = percentile(times, 0.5);
+                }
+                else if (scalarMs > 0) {
+                    result.extra.push_back({"speedup", scalarMs / percentile(times, 0.5)});
+                }
+                report(result, times, 256.0 * 256.0);
+            }
+        }
+    }
+}
+// Shadow rays through a dense scene, rates are per shadow ray
+void benchShadows() {
+    int lightCounts[2] = {4, 32};
+    for (int l = 0; l < 2; l++) {
+        string name = "dense/" + to_string(lightCounts[l]) + "lights";
+        if (!selected("shadows", name)) {
+            continue;
+        }
+        RayTracer rayTracer;
+        addRandomScene(rayTracer, 20000, 200, 3);
+        // Lights spread out above the scene
+        mt19937 rng(4);
+        uniform_real_distribution<float> position(0, 250);
+        for (int i = 0; i < lightCounts[l]; i++) {
+            Point location = {position(rng), 260, -position(rng)};
+            rayTracer.lights.push_back(
+                rayTracer.sceneArena.make<RayTracer::Light>(location, 0.4f / lightCounts[l]));
+        }
+        setupFrame(rayTracer, 128, false);
+        rayTracer.threadCount = 1;
+        vector<double> times = sampleFrames(rayTracer, options.quick ? 300 : 2000, 3);
+        RayTracer::ShadowStats stats = rayTracer.getShadowStats();
+        Result result;
+        result.group = "shadows";
+        result.name = name;
+        result.extra.push_back({"tests_per_ray", (double)stats.tests / stats.rays});
+        report(result, times, (double)stats.rays);
+    }
+}
+// Wavy size x size vertex grid in front of the default camera, written the way modeling tools
+// export (vertex normals and v//vn faces), returns the number of triangles
+int writeGridObj(const string& fileName, int size) {
+    FILE* file = fopen(fileName.c_str(), "wb");
+    if (file == nullptr) {
+        return 0;
+    }
+    float step = 250.0f / (float)(size - 1);
+    for (int pass = 0; pass < 2; pass++) {
+        for (int j = 0; j < size; j++) {
+            for (int i = 0; i < size; i++) {
+                float x = (float)i * step;
+                float y = (float)j * step;
+                if (pass == 0) {
+                    fprintf(file, "v %.6f %.6f %.6f\n", x, y, -100.0f + 10.0f * sin(x * 0.05f) * cos(y * 0.05f));
+                }
+                else {
+                    fprintf(file, "vn %.6f %.6f %.6f\n", 0.0f, 0.0f, 1.0f);
+                }
+            }
+        }
+    }
+    for (int j = 0; j + 1 < size; j++) {
+        for (int i = 0; i + 1 < size; i++) {
+            int a = j * size + i + 1;
+            int b = a + 1;
+            int c = a + size;
+            int d = c + 1;
+            fprintf(file, "f %d//%d %d//%d %d//%d\n", a, a, b, b, d, d);
+            fprintf(file, "f %d//%d %d//%d %d//%d\n", a, a, d, d, c, c);
+        }
+    }
+    fclose(file);
+    return 2 * (size - 1) * (size - 1);
+}
+// OBJ load throughput, then heap use and frame time for the model as one Mesh against the
+// same triangles as separate Triangle objects. Load rates count triangles as rays.
+void benchMesh() {
+    if (!selected("mesh", "load/obj") && !selected("mesh", "memory/mesh") &&
+        !selected("mesh", "memory/triangles")) {
+        return;
+    }
+    string fileName = "raytracer_bench_grid.obj";
+    int triangleCount = writeGridObj(fileName, options.quick ? 300 : 1000);
+    if (triangleCount == 0) {
+        cout << "Could not write " << fileName << endl;
+        return;
+    }
+    ifstream sizeCheck(fileName, ios::binary | ios::ate);
+    double megabytes = (double)sizeCheck.tellg() / (1024.0 * 1024.0);
+    vector<Point> vertices;
+    vector<int> indices;
+    string error;
+    if (selected("mesh", "load/obj")) {
+        vector<double> times = sample([&]() {
+            if (!loadObj(fileName, vertices, indices, error)) {
+                cout << error << endl;
+            }
+        }, options.quick ? 500 : 3000, 3, 100);
+        double seconds = percentile(times, 0.5) / 1000.0;
+        Result result;
+        result.group = "mesh";
+        result.name = "load/obj";
+        result.extra.push_back({"triangles", (double)triangleCount});
+        result.extra.push_back({"MB_per_s", megabytes / seconds});
+        result.extra.push_back({"Mtriangles_per_s", triangleCount / seconds / 1e6});
+        report(result, times, (double)triangleCount);
+    }
+    loadObj(fileName, vertices, indices, error);
+    remove(fileName.c_str());
+    RayTracer::ColorPack color({200, 100, 50}, {200, 100, 50}, {255, 255, 255}, 16);
+    for (int asMesh = 1; asMesh >= 0; asMesh--) {
+        string name = asMesh ? "memory/mesh" : "memory/triangles";
+        if (!selected("mesh", name)) {
+            continue;
+        }
+        long long heapBefore = heapBytes;
+        RayTracer* rayTracer = new RayTracer();
+        if (asMesh) {
+            rayTracer->objects.push_back(
+                rayTracer->sceneArena.make<RayTracer::Mesh>(vertices, indices, color));
+        }
+        else {
+            for (int i = 0; i < indices.size(); i += 3) {
+                rayTracer->objects.push_back(rayTracer->sceneArena.make<RayTracer::Triangle>(
+                    vertices[indices[i]], vertices[indices[i + 1]], vertices[indices[i + 2]], color));
+            }
+        }
+        long long sceneBytes = heapBytes - heapBefore;
+        double buildMs = nowMs();
+        rayTracer->buildAcceleration();
+        buildMs = nowMs() - buildMs;
+        long long totalBytes = heapBytes - heapBefore;
+        setupFrame(*rayTracer, 256, false);
+        vector<double> times = sampleFrames(*rayTracer, options.quick ? 200 : 1000, 3);
+        Result result;
+        result.group = "mesh";
+        result.name = name;
+        result.extra.push_back({"scene_bytes_per_triangle", (double)sceneBytes / triangleCount});
+        result.extra.push_back({"total_bytes_per_triangle", (double)totalBytes / triangleCount});
+        result.extra.push_back({"build_ms", buildMs});
+        report(result, times, 256.0 * 256.0);
+        delete rayTracer;
+    }
+}
+// Wavy size x size grid facing the default camera, as one mesh
+void addTerrain(RayTracer& rayTracer, int size) {
+    vector<Point> vertices;
+    vector<int> indices;
+    float step = 250.0f / (float)(size - 1);
+    for (int j = 0; j < size; j++) {
+        for (int i = 0; i < size; i++) {
+            float x = (float)i * step;
+            float y = (float)j * step;
+            vertices.push_back({x, y, -200.0f + 10.0f * sin(x * 0.05f) * cos(y * 0.05f)});
+        }
+    }
+    for (int j = 0; j + 1 < size; j++) {
+        for (int i = 0; i + 1 < size; i++) {
+            int a = j * size + i;
+            indices.insert(indices.end(), {a, a + 1, a + size + 1, a, a + size + 1, a + size});
+        }
+    }
+    RayTracer::ColorPack color({120, 200, 120}, {120, 200, 120}, {255, 255, 255}, 16);
+    rayTracer.objects.push_back(rayTracer.sceneArena.make<RayTracer::Mesh>(move(vertices),
+                                                                           move(indices), color));
+}
+// A recorded style camera path (strafing while turning) rendered with and without
+// reprojection. rays_saved is the fraction of shadow rays reused from the previous frame,
+// pixels_changed_ppm the pixels per million that differ from the exact render. The default
+// scene's BVH is below reprojectionMinTreeCost, so it's traced exactly either way.
+void benchReprojection() {
+    for (int terrain = 0; terrain < 2; terrain++) {
+        string name = terrain ? "terrain/8lights" : "default";
+        if (!selected("reproject", name)) {
+            continue;
+        }
+        RayTracer rayTracers[2];
+        for (int k = 0; k < 2; k++) {
+            setupFrame(rayTracers[k], 256, false);
+            rayTracers[k].reprojection = k == 1;
+            if (terrain) {
+                addTerrain(rayTracers[k], 150);
+                for (int i = 0; i < 6; i++) {
+                    rayTracers[k].lights.push_back(rayTracers[k].sceneArena.make<RayTracer::Light>(
+                        Point{40.0f * i, 200, -20.0f * i}, 0.05f));
+                }
+            }
+        }
+        int frames = options.quick ? 10 : 40;
+        vector<double> times[2];
+        long long reused = 0;
+        long long traced = 0;
+        long long changed = 0;
+        for (int frame = 0; frame < frames; frame++) {
+            Point camera = {100.0f + 2.0f * frame, 100.0f, -1.0f * frame};
+            Vec3 lookAtVec = RayTracer::transformVector({0, 0, -1}, 0, 0.3f * frame, 0);
+            Vec3 upVec = RayTracer::transformVector({0, 1, 0}, 0, 0.3f * frame, 0);
+            unsigned char* images[2];
+            for (int k = 0; k < 2; k++) {
+                double before = nowMs();
+                images[k] = rayTracers[k].produceImage(camera, lookAtVec, upVec);
+                // The first frame has nothing to reuse (and builds the BVH)
+                if (frame > 0) {
+                    times[k].push_back(nowMs() - before);
+                }
+            }
+            if (frame > 0) {
+                RayTracer::ShadowStats stats = rayTracers[1].getShadowStats();
+                reused += stats.reused;
+                traced += stats.rays;
+                for (int i = 0; i < 256 * 256 * 3; i += 3) {
+                    changed += images[0][i] != images[1][i] || images[0][i + 1] != images[1][i + 1] ||
+                               images[0][i + 2] != images[1][i + 2];
+                }
+            }
+        }
+        for (int k = 0; k < 2; k++) {
+            Result result;
+            result.group = "reproject";
+            result.name = name + (k ? "/reprojected" : "/exact");
+            if (k == 1) {
+                result.extra.push_back({"rays_saved", (double)reused / (reused + traced)});
+                result.extra.push_back({"pixels_changed_ppm",
+                                        1e6 * (double)changed / (256.0 * 256.0 * (frames - 1))});
+                result.extra.push_back({"speedup", percentile(times[0], 0.5) / percentile(times[1], 0.5)});
+            }
+            report(result, times[k], 256.0 * 256.0);
+        }
+    }
+}
+// Progressive refinement as the viewer drives it: time to the first image (one
+// refineProgressive call, should stay inside the budget at any size) and to the full image
+void benchProgressive() {
+    vector<int> sizes = {256, 1024};
+    for (int s = 0; s < sizes.size(); s++) {
+        string name = to_string(sizes[s]) + "/perspective";
+        if (!selected("refine", name)) {
+            continue;
+        }
+        RayTracer rayTracer;
+        setupFrame(rayTracer, sizes[s], false);
+        rayTracer.lightVisualization = true;
+        // First run builds the BVH and thread pool and measures the tracing speed
+        rayTracer.startProgressive({100, 100, 0}, {0, 0, -1}, {0, 1, 0});
+        while (!rayTracer.refineProgressive()) {
+        }
+        vector<double> firstTimes;
+        vector<double> calls;
+        vector<double> totalTimes = sample([&]() {
+            rayTracer.startProgressive({100, 100, 0}, {0, 0, -1}, {0, 1, 0});
+            double before = nowMs();
+            bool done = rayTracer.refineProgressive();
+            firstTimes.push_back(nowMs() - before);
+            int count = 1;
+            for (; !done; count++) {
+                done = rayTracer.refineProgressive();
+            }
+            calls.push_back(count);
+        }, options.quick ? 300 : 2000, 3, 1000);
+        Result first;
+        first.group = "refine";
+        first.name = name + "/first_image";
+        first.extra.push_back({"budget_ms", rayTracer.progressiveBudgetMs});
+        // Counted per image pixel like the frames, how many get traced depends on the budget
+        report(first, firstTimes, (double)sizes[s] * sizes[s]);
+        Result converged;
+        converged.group = "refine";
+        converged.name = name + "/converged";
+        converged.extra.push_back({"refine_calls", percentile(calls, 0.5)});
+        report(converged, totalTimes, (double)sizes[s] * sizes[s]);
+    }
+}
+// Adaptive and uniform anti-aliasing on the default scene. rmse is against a uniform 256 ray
+// per pixel render (0 to 255 units), rays_per_pixel counts camera rays, speedup is against
+// uniform 16x.
+void benchAntialiasing() {
+    int size = options.quick ? 128 : 256;
+    string names[6] = {"none", "uniform/4", "uniform/16", "adaptive/4", "adaptive/16",
+                       "adaptive/64"};
+    int samples[6] = {1, 4, 16, 4, 16, 64};
+    bool any = false;
+    for (int k = 0; k < 6; k++) {
+        any = any || selected("antialias", names[k]);
+    }
+    if (!any) {
+        return;
+    }
+    vector<unsigned char> reference;
+    {
+        RayTracer rayTracer;
+        setupFrame(rayTracer, size, false);
+        rayTracer.antialiasSamples = 256;
+        rayTracer.adaptiveAntialiasing = false;
+        unsigned char* image = rayTracer.produceImage({100, 100, 0}, {0, 0, -1}, {0, 1, 0});
+        reference.assign(image, image + size * size * 3);
+    }
+    double uniformMs = 0;
+    for (int k = 0; k < 6; k++) {
+        if (!selected("antialias", names[k])) {
+            continue;
+        }
+        RayTracer rayTracer;
+        setupFrame(rayTracer, size, false);
+        rayTracer.antialiasSamples = samples[k];
+        rayTracer.adaptiveAntialiasing = k == 0 || k > 2;
+        vector<double> times = sampleFrames(rayTracer, options.quick ? 300 : 2000, 3);
+        double squaredError = 0;
+        for (int i = 0; i < reference.size(); i++) {
+            double difference = (double)rayTracer.image[i] - (double)reference[i];
+            squaredError += difference * difference;
+        }
+        Result result;
+        result.group = "antialias";
+        result.name = names[k];
+        result.extra.push_back({"rays_per_pixel",
+                                (double)rayTracer.getCameraRays() / ((double)size * size)});
+        result.extra.push_back({"rmse", sqrt(squaredError / (double)reference.size())});
+        if (k == 2) {
+            uniformMs = percentile(times, 0.5);
+        }
+        else if (uniformMs > 0) {
+            result.extra.push_back({"speedup_vs_uniform16", uniformMs / percentile(times, 0.5)});
+        }
+        report(result, times, (double)size * size);
+    }
+}
+// Replaces the scene with a reflective floor and a 4x4 grid of spheres (most of them mirrors)
+// lit by lightCount lights
+void addMirrorScene(RayTracer& rayTracer, int lightCount) {
+    rayTracer.objects.clear();
+    rayTracer.lights.clear();
+    RayTracer::ColorPack mirror({20, 20, 30}, {40, 40, 60}, {230, 230, 230}, 64, true);
+    RayTracer::ColorPack floor({60, 60, 60}, {120, 120, 120}, {200, 200, 200}, 16, true);
+    RayTracer::ColorPack red({200, 40, 40}, {200, 40, 40}, {255, 255, 255}, 16);
+    rayTracer.objects.push_back(rayTracer.sceneArena.make<RayTracer::Plane>(
+        Point{0, 0, 0}, Point{1, 0, 0}, Point{0, 0, 1}, floor));
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            Point center = {40.0f + 55.0f * i, 22.0f, -60.0f - 55.0f * j};
+            rayTracer.objects.push_back(rayTracer.sceneArena.make<RayTracer::Sphere>(
+                center, 20.0f, (i + j) % 3 == 2 ? red : mirror));
+        }
+    }
+    for (int i = 0; i < lightCount; i++) {
+        Point location = {20.0f + 230.0f * (float)(i % 4) / 3.0f, 150.0f + 10.0f * (float)(i / 4),
+                          -20.0f - 60.0f * (float)(i / 4)};
+        rayTracer.lights.push_back(rayTracer.sceneArena.make<RayTracer::Light>(
+            location, 0.8f / (float)lightCount));
+    }
+}
+// Mirror scene with 16 lights at increasing reflection depths, and with a reflection ray
+// budget of a quarter ray per pixel
+void benchReflections() {
+    string names[4] = {"depth1", "depth4", "depth16", "depth16/budget"};
+    int depths[4] = {1, 4, 16, 16};
+    int size = 256;
+    for (int k = 0; k < 4; k++) {
+        if (!selected("reflect", names[k])) {
+            continue;
+        }
+        RayTracer rayTracer;
+        addMirrorScene(rayTracer, 16);
+        setupFrame(rayTracer, size, false);
+        rayTracer.reflectionDepth = depths[k];
+        rayTracer.reflectionRayBudget = k == 3 ? size * size / 4 : 0;
+        Point camera = {125, 90, 40};
+        Vec3 lookAt = RayTracer::normalizeVec({0, -0.45f, -1});
+        rayTracer.produceImage(camera, lookAt, {0, 1, 0});
+        vector<double> times = sample([&]() {
+            rayTracer.produceImage(camera, lookAt, {0, 1, 0});
+        }, options.quick ? 300 : 2000, 3, 1000);
+        Result result;
+        result.group = "reflect";
+        result.name = names[k];
+        double pixels = (double)size * size;
+        result.extra.push_back({"reflection_rays_per_pixel",
+                                (double)rayTracer.getReflectionRays() / pixels});
+        result.extra.push_back({"shadow_rays_per_pixel",
+                                (double)rayTracer.getShadowStats().rays / pixels});
+        report(result, times, pixels);
+    }
+}
+// Replaces the scene with a floor and an 8x8 grid of spheres, each with its own material (none
+// reflective), lit by lightCount lights. Every material gets Phong exponent exponent.
+void addMaterialScene(RayTracer& rayTracer, int lightCount, float exponent) {
+    rayTracer.objects.clear();
+    rayTracer.lights.clear();
+    RayTracer::ColorPack floor({60, 60, 60}, {120, 120, 120}, {100, 100, 100}, exponent);
+    rayTracer.objects.push_back(rayTracer.sceneArena.make<RayTracer::Plane>(
+        Point{0, 0, 0}, Point{1, 0, 0}, Point{0, 0, 1}, floor));
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 8; j++) {
+            unsigned char red = (unsigned char)(40 + 25 * i);
+            unsigned char green = (unsigned char)(40 + 25 * j);
+            unsigned char blue = (unsigned char)(200 - 20 * ((i + j) % 8));
+            RayTracer::ColorPack color({red, green, blue}, {red, green, blue},
+                                       {255, 255, 255}, exponent);
+            Point center = {20.0f + 30.0f * i, 12.0f, -30.0f - 30.0f * j};
+            rayTracer.objects.push_back(rayTracer.sceneArena.make<RayTracer::Sphere>(
+                center, 11.0f, color));
+        }
+    }
+    for (int i = 0; i < lightCount; i++) {
+        Point location = {20.0f + 230.0f * (float)(i % 4) / 3.0f, 120.0f + 5.0f * (float)(i / 4),
+                          -20.0f - 30.0f * (float)(i / 4)};
+        rayTracer.lights.push_back(rayTracer.sceneArena.make<RayTracer::Light>(
+            location, 0.8f / (float)lightCount));
+    }
+}
+// Shading cost on the material scene with 4 and 32 lights, with whole Phong exponents (raised
+// by squaring) and fractional ones (pow). ns_per_light is the frame time per shadow ray, so it
+// covers shading a light and tracing its shadow ray.
+void benchShading() {
+    int lightCounts[2] = {4, 32};
+    float exponents[2] = {16.0f, 16.5f};
+    string exponentNames[2] = {"whole", "fractional"};
+    int size = 256;
+    for (int l = 0; l < 2; l++) {
+        for (int e = 0; e < 2; e++) {
+            string name = "64materials/" + to_string(lightCounts[l]) + "lights/" +
+                          exponentNames[e];
+            if (!selected("shading", name)) {
+                continue;
+            }
+            RayTracer rayTracer;
+            addMaterialScene(rayTracer, lightCounts[l], exponents[e]);
+            setupFrame(rayTracer, size, false);
+            rayTracer.reflectionDepth = 0;
+            Point camera = {125, 80, 40};
+            Vec3 lookAt = RayTracer::normalizeVec({0, -0.6f, -1});
+            rayTracer.produceImage(camera, lookAt, {0, 1, 0});
+            vector<double> times = sample([&]() {
+                rayTracer.produceImage(camera, lookAt, {0, 1, 0});
+            }, options.quick ? 300 : 2000, 3, 1000);
+            Result result;
+            result.group = "shading";
+            result.name = name;
+            double shadowRays = (double)rayTracer.getShadowStats().rays;
+            result.extra.push_back({"ns_per_light", percentile(times, 0.5) * 1e6 / shadowRays});
+            report(result, times, (double)size * size);
+        }
+    }
+}
+// Mirror scene lit by lightCount dim lights spread through a box above it. Exact traces a
+// shadow ray to every light from every hit, sampled to lightSamples of them picked from the
+// light tree (lightSampleCost 1 makes it sample at 10 and 100 lights too, where frames shade
+// exactly by default). rmse is against the exact image, which at 100k lights would take
+// minutes a frame so it isn't rendered there.
+void benchLights() {
+    int lightCounts[4] = {10, 100, 1000, 100000};
+    string countNames[4] = {"10", "100", "1k", "100k"};
+    int lightSamples = 8;
+    int size = options.quick ? 64 : 128;
+    Point camera = {125, 90, 40};
+    Vec3 lookAt = RayTracer::normalizeVec({0, -0.45f, -1});
+    for (int c = 0; c < 4; c++) {
+        string names[2] = {"exact/" + countNames[c], "sampled8/" + countNames[c]};
+        bool exact = lightCounts[c] <= 1000;
+        if (!(exact && selected("lights", names[0])) && !selected("lights", names[1])) {
+            continue;
+        }
+        RayTracer rayTracer;
+        addMirrorScene(rayTracer, 0);
+        setupFrame(rayTracer, size, false);
+        mt19937 rng(21);
+        uniform_real_distribution<float> unit(0.0f, 1.0f);
+        vector<Point> locations;
+        vector<float> intensities;
+        for (int i = 0; i < lightCounts[c]; i++) {
+            Point location = {-20.0f + 290.0f * unit(rng), 80.0f + 100.0f * unit(rng),
+                              20.0f - 280.0f * unit(rng)};
+            rayTracer.lights.push_back(rayTracer.sceneArena.make<RayTracer::Light>(
+                location, 0.8f / (float)lightCounts[c]));
+            locations.push_back(location);
+            intensities.push_back(0.8f / (float)lightCounts[c]);
+        }
+        double buildStart = nowMs();
+        LightTree tree;
+        tree.build(locations, intensities);
+        double buildMs = nowMs() - buildStart;
+        vector<unsigned char> reference;
+        for (int mode = exact ? 0 : 1; mode < 2; mode++) {
+            rayTracer.lightSamples = mode == 0 ? 0 : lightSamples;
+            rayTracer.lightSampleCost = 1;
+            // First frame builds the BVH and light tree
+            unsigned char* image = rayTracer.produceImage(camera, lookAt, {0, 1, 0});
+            if (mode == 0) {
+                reference.assign(image, image + size * size * 3);
+            }
+            if (!selected("lights", names[mode])) {
+                continue;
+            }
+            vector<double> times = sample([&]() {
+                rayTracer.produceImage(camera, lookAt, {0, 1, 0});
+            }, options.quick ? 300 : 2000, 3, 1000);
+            Result result;
+            result.group = "lights";
+            result.name = names[mode];
+            double pixels = (double)size * size;
+            result.extra.push_back({"shadow_rays_per_pixel",
+                                    (double)rayTracer.getShadowStats().rays / pixels});
+            if (mode == 1) {
+                result.extra.push_back({"tree_build_ms", buildMs});
+            }
+            if (mode == 1 && !reference.empty()) {
+                double squaredError = 0;
+                for (int i = 0; i < reference.size(); i++) {
+                    double difference = (double)rayTracer.image[i] - (double)reference[i];
+                    squaredError += difference * difference;
+                }
+                result.extra.push_back({"rmse", sqrt(squaredError / (double)reference.size())});
+            }
+            report(result, times, pixels);
+        }
+    }
+}
+// Rendering and saving a long camera path, one frame after the other on one thread versus
+// through AnimationRenderer, which overlaps saving with rendering
+void benchAnimation() {
+    int frames = options.quick ? 60 : 500;
+    vector<CameraKey> path;
+    for (int i = 0; i < frames; i++) {
+        path.push_back({{100.0f + 0.2f * i, 100.0f, -0.2f * i},
+                        RayTracer::transformVector({0, 0, -1}, 0, 0.05f * i, 0),
+                        RayTracer::transformVector({0, 1, 0}, 0, 0.05f * i, 0)});
+    }
+    string pattern = "raytracer_bench_frame%d.ppm";
+    double sequentialMinutes = 0;
+    for (int pipelined = 0; pipelined < 2; pipelined++) {
+        string name = to_string(frames) + "frames/" + (pipelined ? "pipelined" : "sequential");
+        if (!selected("animation", name)) {
+            continue;
+        }
+        RayTracer rayTracer;
+        setupFrame(rayTracer, 256, false);
+        double start = nowMs();
+        PPMSink sink(pattern);
+        if (pipelined) {
+            AnimationRenderer animation(rayTracer, path, sink);
+            animation.start();
+            animation.wait();
+        }
+        else {
+            for (int i = 0; i < frames; i++) {
+                unsigned char* image = rayTracer.produceImage(path[i].camera, path[i].lookAtVec,
+                                                              path[i].upVec);
+                sink.writeFrame(image, rayTracer.imgSizeX, rayTracer.imgSizeY);
+            }
+        }
+        double minutes = (nowMs() - start) / 60000.0;
+        for (int i = 0; i < frames; i++) {
+            remove(frameFileName(pattern, i).c_str());
+        }
+        Result result;
+        result.group = "animation";
+        result.name = name;
+        result.extra.push_back({"frames_per_min", frames / minutes});
+        if (pipelined && sequentialMinutes > 0) {
+            result.extra.push_back({"speedup", sequentialMinutes / minutes});
+        }
+        else {
+            sequentialMinutes = minutes;
+        }
+        // One sample for the whole path, in milliseconds per frame
+        report(result, {minutes * 60000.0 / frames}, 256.0 * 256.0);
+    }
+}
+// Scene file with count primitives, half spheres and half triangles in front of the default
+// camera. Later versions make the edits the reload benchmarks time: 1 changes a material's
+// color, 2 moves a light and 3 moves one sphere. Returns false if it can't be written.
+bool writeRandomSceneFile(const string& fileName, int count, int version) {
+    FILE* file = fopen(fileName.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    fprintf(file, "material warm %s  255 255 255  16\n",
+            version == 1 ? "255 64 64  255 64 64" : "200 120 80  200 120 80");
+    fprintf(file, "material cool 80 160 220  80 160 220  255 255 255  16\n");
+    fprintf(file, "light %s 0.2\nlight 231 63 -127 0.2\n", version == 2 ? "90 110 -40" : "100 100 -50");
+    mt19937 rng(7);
+    uniform_real_distribution<float> across(0.0f, 250.0f);
+    uniform_real_distribution<float> depth(-300.0f, -50.0f);
+    uniform_real_distribution<float> offset(-3.0f, 3.0f);
+    for (int i = 0; i < count; i++) {
+        float x = across(rng);
+        float y = across(rng);
+        float z = depth(rng);
+        if (i % 2 == 0) {
+            fprintf(file, "sphere %.3f %.3f %.3f 0.5 warm\n", i == 0 && version == 3 ? x + 1 : x, y, z);
+        }
+        else {
+            fprintf(file, "triangle %.3f %.3f %.3f  %.3f %.3f %.3f  %.3f %.3f %.3f cool\n",
+                    x, y, z, x + offset(rng), y + offset(rng), z, x, y + offset(rng), z + offset(rng));
+        }
+    }
+    return fclose(file) == 0;
+}
+// Scene file parse rate and the time to reload the file after different kinds of edit, from a
+// full load (new ray tracer, everything parsed and built) down to a light change. Rates count
+// primitives as rays.
+void benchScene() {
+    string names[5] = {"parse", "reload/full", "reload/geometry", "reload/materials",
+                       "reload/lights"};
+    bool any = false;
+    for (int k = 0; k < 5; k++) {
+        any = any || selected("scene", names[k]);
+    }
+    if (!any) {
+        return;
+    }
+    int count = options.quick ? 100000 : 1000000;
+    int samples = options.quick ? 2 : 3;
+    string fileName = "raytracer_bench_scene.txt";
+    if (!writeRandomSceneFile(fileName, count, 0)) {
+        cout << "Could not write " << fileName << endl;
+        return;
+    }
+    ifstream sizeCheck(fileName, ios::binary | ios::ate);
+    double megabytes = (double)sizeCheck.tellg() / (1024.0 * 1024.0);
+    string error;
+    double fullMs = 0;
+    for (int k = 0; k < 5; k++) {
+        if (!selected("scene", names[k])) {
+            continue;
+        }
+        vector<double> times;
+        if (k == 0) {
+            times = sample([&]() {
+                SceneDescription scene;
+                if (!loadScene(fileName, scene, error)) {
+                    cout << error << endl;
+                }
+            }, 0, samples, samples);
+        }
+        else if (k == 1) {
+            times = sample([&]() {
+                RayTracer rayTracer;
+                SceneWatcher watcher(fileName);
+                watcher.reload(rayTracer, error);
+                rayTracer.buildAcceleration();
+            }, 0, samples, samples);
+            fullMs = percentile(times, 0.5);
+        }
+        else {
+            // Flip between the base file and the edited one, only the reloads are timed
+            RayTracer rayTracer;
+            SceneWatcher watcher(fileName);
+            watcher.reload(rayTracer, error);
+            rayTracer.buildAcceleration();
+            for (int i = 0; i < 2 * samples; i++) {
+                writeRandomSceneFile(fileName, count, i % 2 == 0 ? 5 - k : 0);
+                double start = nowMs();
+                if (!watcher.reload(rayTracer, error)) {
+                    cout << error << endl;
+                }
+                // Compiles the objects like the next frame would, refitting the BVH when it can
+                rayTracer.getScene();
+                times.push_back(nowMs() - start);
+            }
+        }
+        Result result;
+        result.group = "scene";
+        result.name = names[k];
+        result.extra.push_back({"primitives", (double)count});
+        if (k == 0) {
+            result.extra.push_back({"MB_per_s", megabytes / (percentile(times, 0.5) / 1000.0)});
+        }
+        if (k > 1 && fullMs > 0) {
+            result.extra.push_back({"speedup_vs_full", fullMs / percentile(times, 0.5)});
+        }
+        report(result, times, (double)count);
+    }
+    remove(fileName.c_str());
+}
+#ifndef _WIN32
+// A "Key:  1234 kB" line from a /proc/self file in MB, 0 if it isn't there
+double procMegabytes(const char* fileName, const string& key) {
+    ifstream file(fileName);
+    string line;
+    while (getline(file, line)) {
+        if (line.compare(0, key.size() + 1, key + ":") == 0) {
+            return atof(line.c_str() + key.size() + 1) / 1024.0;
+        }
+    }
+    return 0.0;
+}
+// Drops the file from the page cache so the next read comes from disk (Linux only, elsewhere
+// cold runs are warm)
+void evictFromPageCache(const string& fileName) {
+#ifdef __linux__
+    int descriptor = open(fileName.c_str(), O_RDONLY);
+    if (descriptor >= 0) {
+        fdatasync(descriptor);
+        posix_fadvise(descriptor, 0, 0, POSIX_FADV_DONTNEED);
+        close(descriptor);
+    }
+#endif
+}
+// What a fresh process needs to render its first frame of a scene
+struct Startup {
+    double readyMs = 0;
+    double firstFrameMs = 0;
+    // Resident memory the scene added, private (heap) and file backed (mapped) pages, and the
+    // mapped pages' proportional share while all the processes are running
+    double anonMB = 0;
+    double fileMB = 0;
+    double pssFileMB = 0;
+};
+// Starts processes loading fileName (a scene file, or a scene cache if mapped) at the same
+// time, each renders one frame and waits until all of them have before measuring memory
+vector<Startup> startProcesses(int processes, const string& fileName, bool mapped, bool cold) {
+    if (cold) {
+        evictFromPageCache(fileName);
+    }
+    int results[2];
+    int ready[2];
+    int go[2];
+    if (pipe(results) != 0 || pipe(ready) != 0 || pipe(go) != 0) {
+        return {};
+    }
+    for (int i = 0; i < processes; i++) {
+        if (fork() != 0) {
+            continue;
+        }
+        Startup startup;
+        double anonBefore = procMegabytes("/proc/self/status", "RssAnon");
+        double fileBefore = procMegabytes("/proc/self/status", "RssFile");
+        double start = nowMs();
+        {
+            RayTracer rayTracer;
+            setupFrame(rayTracer, 256, false);
+            string error;
+            if (mapped) {
+                rayTracer.loadSceneCache(fileName, error);
+            }
+            else {
+                SceneWatcher watcher(fileName);
+                watcher.reload(rayTracer, error);
+                rayTracer.buildAcceleration();
+            }
+            startup.readyMs = nowMs() - start;
+            rayTracer.produceImage({100.0f, 100.0f, 0.0f}, {0.0f, 0.0f, -1.0f}, {0.0f, 1.0f, 0.0f});
+            startup.firstFrameMs = nowMs() - start;
+            startup.anonMB = procMegabytes("/proc/self/status", "RssAnon") - anonBefore;
+            startup.fileMB = procMegabytes("/proc/self/status", "RssFile") - fileBefore;
+            char signal = 'r';
+            if (write(ready[1], &signal, 1) != 1 || read(go[0], &signal, 1) != 1) {
+                _exit(1);
+            }
+            startup.pssFileMB = procMegabytes("/proc/self/smaps_rollup", "Pss_File");
+        }
+        if (write(results[1], &startup, sizeof(startup)) != sizeof(startup)) {
+            _exit(1);
+        }
+        _exit(0);
+    }
+    char signal;
+    for (int i = 0; i < processes; i++) {
+        if (read(ready[0], &signal, 1) != 1) {
+            break;
+        }
+    }
+    for (int i = 0; i < processes; i++) {
+        signal = 'g';
+        if (write(go[1], &signal, 1) != 1) {
+            break;
+        }
+    }
+    vector<Startup> startups;
+    for (int i = 0; i < processes; i++) {
+        Startup startup;
+        if (read(results[0], &startup, sizeof(startup)) == sizeof(startup)) {
+            startups.push_back(startup);
+        }
+    }
+    while (wait(nullptr) > 0) {
+    }
+    for (int k = 0; k < 2; k++) {
+        close(results[k]);
+        close(ready[k]);
+        close(go[k]);
+    }
+    return startups;
+}
+#endif
+// Startup of a fresh process from the scene file and from a compiled scene cache, cold (file
+// evicted from the page cache first) and warm, with memory per process. shared runs 4
+// processes on one cache at once. Rates count primitives as rays, p50 is time to ready.
+void benchCache() {
+    string names[5] = {"source/cold", "source/warm", "mapped/cold", "mapped/warm",
+                       "mapped/shared_x4"};
+    bool any = false;
+    for (int k = 0; k < 5; k++) {
+        any = any || selected("cache", names[k]);
+    }
+    if (!any) {
+        return;
+    }
+#ifdef _WIN32
+    cout << "cache benchmarks need fork, skipped" << endl;
+#else
+    int count = options.quick ? 100000 : 1000000;
+    int samples = options.quick ? 1 : 3;
+    string sceneName = "raytracer_bench_cache.txt";
+    string cacheName = "raytracer_bench_cache.rtscene";
+    if (!writeRandomSceneFile(sceneName, count, 0)) {
+        cout << "Could not write " << sceneName << endl;
+        return;
+    }
+    double compileMs = nowMs();
+    {
+        RayTracer rayTracer;
+        SceneWatcher watcher(sceneName);
+        string error;
+        if (!watcher.reload(rayTracer, error) || !rayTracer.saveSceneCache(cacheName, error)) {
+            cout << error << endl;
+            return;
+        }
+    }
+    compileMs = nowMs() - compileMs;
+    ifstream sizeCheck(cacheName, ios::binary | ios::ate);
+    double cacheMB = (double)sizeCheck.tellg() / (1024.0 * 1024.0);
+    double sourceMs = 0;
+    for (int k = 0; k < 5; k++) {
+        if (!selected("cache", names[k])) {
+            continue;
+        }
+        bool mapped = k >= 2;
+        int processes = k == 4 ? 4 : 1;
+        vector<Startup> startups;
+        for (int i = 0; i < samples; i++) {
+            vector<Startup> run = startProcesses(processes, mapped ? cacheName : sceneName, mapped,
+                                                 k == 0 || k == 2);
+            startups.insert(startups.end(), run.begin(), run.end());
+        }
+        if (startups.empty()) {
+            cout << "Could not start processes" << endl;
+            continue;
+        }
+        vector<double> times;
+        vector<double> firstFrames;
+        double anonMB = 0;
+        double fileMB = 0;
+        double pssFileMB = 0;
+        for (int i = 0; i < startups.size(); i++) {
+            times.push_back(startups[i].readyMs);
+            firstFrames.push_back(startups[i].firstFrameMs);
+            anonMB += startups[i].anonMB / startups.size();
+            fileMB += startups[i].fileMB / startups.size();
+            pssFileMB += startups[i].pssFileMB / startups.size();
+        }
+        Result result;
+        result.group = "cache";
+        result.name = names[k];
+        result.extra.push_back({"primitives", (double)count});
+        result.extra.push_back({"first_frame_ms", percentile(firstFrames, 0.5)});
+        result.extra.push_back({"anon_MB", anonMB});
+        result.extra.push_back({"file_MB", fileMB});
+        if (mapped) {
+            result.extra.push_back({"pss_file_MB", pssFileMB});
+            result.extra.push_back({"cache_MB", cacheMB});
+            result.extra.push_back({"compile_ms", compileMs});
+        }
+        if (k == 1) {
+            sourceMs = percentile(firstFrames, 0.5);
+        }
+        if (mapped && sourceMs > 0) {
+            result.extra.push_back({"first_frame_speedup", sourceMs / percentile(firstFrames, 0.5)});
+        }
+        report(result, times, (double)count);
+    }
+    remove(sceneName.c_str());
+    remove(cacheName.c_str());
+#endif
+}
+// How takePicture used to write PPM files, 3 bytes per ofstream::write, kept as the baseline
+void writePPMPerPixel(const string& fileName, const unsigned char* image, int width, int height) {
+    ofstream file(fileName, ios::out | ios::binary | ios::trunc);
+    file << "P6\n" << width << "\n" << height << "\n255\n";
+    for (int i = height - 1; i >= 0; i--) {
+        for (int j = 0; j < width; j++) {
+            file.write((const char*)image + (i * width + j) * 3, 3);
+        }
+    }
+}
+// Writing 1024x1024 frames to disk with each sink, MB_per_s counts the RGB frame bytes
+void benchOutput() {
+    int size = 1024;
+    vector<unsigned char> image((size_t)size * size * 3);
+    for (int i = 0; i < image.size(); i++) {
+        image[i] = (unsigned char)(i * 7 + i / 3011);
+    }
+    double megabytes = (double)image.size() / (1024.0 * 1024.0);
+    string names[4] = {"ppm/per_pixel", "ppm/bulk", "raw", "y4m"};
+    double perPixelMs = 0;
+    for (int k = 0; k < 4; k++) {
+        if (!selected("output", names[k])) {
+            continue;
+        }
+        string fileName = k == 2 ? "raytracer_bench_output.rgb" :
+                          k == 3 ? "raytracer_bench_output.y4m" : "raytracer_bench_output.ppm";
+        unique_ptr<ImageSink> sink;
+        if (k > 1) {
+            string error;
+            sink = openImageSink(fileName, 20, error);
+            if (sink == nullptr) {
+                cout << error << endl;
+                continue;
+            }
+        }
+        vector<double> times = sample([&]() {
+            if (k == 0) {
+                writePPMPerPixel(fileName, image.data(), size, size);
+            }
+            else if (k == 1) {
+                writePPM(fileName, image.data(), size, size);
+            }
+            else {
+                sink->writeFrame(image.data(), size, size);
+            }
+        }, options.quick ? 300 : 2000, 3, 200);
+        sink.reset();
+        remove(fileName.c_str());
+        double p50 = percentile(times, 0.5);
+        Result result;
+        result.group = "output";
+        result.name = names[k];
+        result.extra.push_back({"MB_per_s", megabytes / (p50 / 1000.0)});
+        if (k == 0) {
+            perPixelMs = p50;
+        }
+        else if (perPixelMs > 0) {
+            result.extra.push_back({"speedup", perPixelMs / p50});
+        }
+        report(result, times, (double)size * size);
+    }
+}
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc) {
+            options.filter = argv[++i];
+        }
+        else if (arg == "--json" && i + 1 < argc) {
+            options.jsonFile = argv[++i];
+        }
+        else if (arg == "--quick") {
+            options.quick = true;
+        }
+        else {
+            cout << "Usage: raytracer_bench [--filter GROUP/NAME] [--json FILE] [--quick]" << endl;
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+    benchPrimitives();
+    benchFrames();
+    benchKernels();
+    benchAllocations();
+    benchThreads();
+    benchBVH();
+    benchPackets();
+    benchShadows();
+    benchMesh();
+    benchProgressive();
+    benchReprojection();
+    benchAntialiasing();
+    benchReflections();
+    benchShading();
+    benchLights();
+    benchAnimation();
+    benchOutput();
+    benchScene();
+    benchCache();
+    if (!options.jsonFile.empty()) {
+        writeJson(options.jsonFile);
+    }
+    return 0;
+}
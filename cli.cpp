@@ -0,0 +1,352 @@
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <csignal>
+#include <atomic>
+#include "RayTracer.h"
+#include "ObjLoader.h"
+#include "Animation.h"
+#include "ImageSink.h"
+#include "SceneLoader.h"
+using namespace std;
+// Headless renderer, renders a single frame (or a camera path) and saves it without needing a
+// window
+void printUsage() {
+    cout << "Usage: raytracer_cli [options]" << endl;
+    cout << "  --camera X Y Z          Camera position (default 100 100 0)" << endl;
+    cout << "  --look X Y Z            Look at direction (default 0 0 -1)" << endl;
+    cout << "  --up X Y Z              Up direction (default 0 1 0)" << endl;
+    cout << "  --size WIDTH HEIGHT     Resolution (default 256 256)" << endl;
+    cout << "  --orthogonal            Orthogonal projection (default)" << endl;
+    cout << "  --perspective           Perspective projection" << endl;
+    cout << "  --projection-distance D Perspective projection distance (default 0.5625 * WIDTH)" << endl;
+    cout << "  --lights                Show light objects" << endl;
+    cout << "  --scene FILE            Render a scene file instead of the built in scene (see" << endl;
+    cout << "                          default.scene), its camera is the default camera" << endl;
+    cout << "  --cache FILE            Render a scene cache written by --compile, mapped straight" << endl;
+    cout << "                          into memory instead of parsed and built" << endl;
+    cout << "  --compile FILE          Save the scene (with --scene and --obj) as a scene cache" << endl;
+    cout << "                          and exit without rendering" << endl;
+    cout << "  --obj FILE              Add a Wavefront OBJ model to the scene (or the --scene" << endl;
+    cout << "                          one, wherever it's given)" << endl;
+    cout << "  --threads N             Render threads (default all cores)" << endl;
+    cout << "  --reflections N         Reflections followed per ray (default 1)" << endl;
+    cout << "  --light-samples N       With more than 12 N lights, trace shadow rays to N" << endl;
+    cout << "                          lights per hit picked from a light tree instead of" << endl;
+    cout << "                          to all" << endl;
+    cout << "  --aa N                  Anti-aliasing with up to N rays per pixel (4, 16, 64 or" << endl;
+    cout << "                          256), only pixels on edges get more than one" << endl;
+    cout << "  --aa-uniform            Give every pixel all N rays instead" << endl;
+    cout << "  --aa-threshold T        Color difference (0 to 1) that counts as an edge" << endl;
+    cout << "                          (default 0.05)" << endl;
+    cout << "  --path FILE             Render every frame of a camera path file (the viewer's T" << endl;
+    cout << "                          key saves one as rayTracePath.txt)" << endl;
+    cout << "  --output FILE           Output file (default rayTrace.ppm, rayTrace%d.ppm with" << endl;
+    cout << "                          --path where %d is the frame number). .y4m writes a" << endl;
+    cout << "                          YUV4MPEG2 video, - writes one to stdout, .rgb/.raw raw RGB" << endl;
+    cout << "  --fps N                 Frame rate stored in Y4M output (default 20)" << endl;
+    cout << "  --stats                 Print the frame's ray counts (and with a RAYTRACER_STATS" << endl;
+    cout << "                          build its intersection tests and stage times)" << endl;
+    cout << "  --trace FILE            Save a Chrome trace of every frame and tile (needs a" << endl;
+    cout << "                          RAYTRACER_STATS build), open it in ui.perfetto.dev" << endl;
+    cout << "  --cost-map              Also save a heatmap of the time each pixel took and its" << endl;
+    cout << "                          raw costs next to the output, OUTPUT.cost.ppm and" << endl;
+    cout << "                          OUTPUT.cost.pfm (needs a RAYTRACER_STATS build)" << endl;
+}
+// Set by Ctrl+C so a path render can stop cleanly
+atomic<bool> interrupted(false);
+void handleInterrupt(int) {
+    interrupted = true;
+}
+// Renders a camera path with progress on one line, returns the exit code
+// (on stderr, stdout may be carrying the video)
+int renderPath(RayTracer& rayTracer, const string& pathFile, ImageSink& sink) {
+    vector<CameraKey> path;
+    string error;
+    if (!loadCameraPath(pathFile, path, error)) {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+    signal(SIGINT, handleInterrupt);
+    AnimationRenderer animation(rayTracer, path, sink);
+    animation.start();
+    while (!animation.finished()) {
+        if (interrupted) {
+            animation.cancel();
+        }
+        this_thread::sleep_for(chrono::milliseconds(200));
+        cerr << "\rFrame " << animation.framesWritten() << "/" << animation.frameCount() << " ("
+             << (int)animation.framesPerMinute() << " frames/min)" << flush;
+    }
+    animation.wait();
+    cerr << endl;
+    if (animation.failed()) {
+        cerr << "Error: could not write frame " << animation.framesWritten() << endl;
+        return 1;
+    }
+    if (animation.wasCancelled()) {
+        cerr << "Cancelled after " << animation.framesWritten() << " frames" << endl;
+        return 1;
+    }
+    return 0;
+}
+// Saves the last frame's cost heatmap and raw costs next to output (frame.ppm gets
+// frame.cost.ppm and frame.cost.pfm), returns false and sets error if it can't
+bool saveCostMaps(const RayTracer& rayTracer, const string& output, ostream& info,
+                  string& error) {
+    const vector<PixelCost>& costs = rayTracer.getPixelCosts();
+    if (costs.empty()) {
+        error = "--cost-map needs a build configured with -DRAYTRACER_STATS=ON";
+        return false;
+    }
+    size_t dot = output.rfind('.');
+    size_t slash = output.find_last_of("/\\");
+    string base = output == "-" ? "rayTrace" :
+                  dot != string::npos && (slash == string::npos || dot > slash) ?
+                  output.substr(0, dot) : output;
+    vector<unsigned char> heatmap;
+    float scaleNs;
+    costHeatmap(costs, heatmap, scaleNs);
+    if (!writePPM(base + ".cost.ppm", heatmap.data(), rayTracer.imgSizeX, rayTracer.imgSizeY)) {
+        error = "Could not write " + base + ".cost.ppm";
+        return false;
+    }
+    if (!writeCostData(base + ".cost.pfm", costs, rayTracer.imgSizeX, rayTracer.imgSizeY,
+                       error)) {
+        return false;
+    }
+    info << "Cost map: " << base << ".cost.ppm (white is " << scaleNs / 1000.0f
+         << " us or more), per pixel tests, rays and ns in " << base << ".cost.pfm" << endl;
+    return true;
+}
+// Reads count numbers following argument i, returns false if they are missing or invalid
+bool readFloats(int argc, char** argv, int& i, float* values, int count) {
+    for (int k = 0; k < count; k++) {
+        if (i + 1 >= argc) {
+            return false;
+        }
+        char* end;
+        values[k] = strtof(argv[++i], &end);
+        if (*end != '\0' || end == argv[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+int main(int argc, char** argv) {
+    RayTracer rayTracer;
+    Point camera = {100.0f, 100.0f, 0.0f};
+    Vec3 lookAtVec = {0.0f, 0.0f, -1.0f};
+    Vec3 upVec = {0.0f, 1.0f, 0.0f};
+    float projectionDistance = -1.0f;
+    string outputFile;
+    string pathFile;
+    int framesPerSecond = 20;
+    string compileFile;
+    bool cached = false;
+    // Models are added once every argument is read, so a --scene anywhere doesn't replace them
+    vector<string> objFiles;
+    bool printStats = false;
+    string traceFile;
+    bool costMap = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        float values[3];
+        bool valid = true;
+        if (arg == "--camera" || arg == "--look" || arg == "--up") {
+            valid = readFloats(argc, argv, i, values, 3);
+            Vec3 vec = {values[0], values[1], values[2]};
+            if (arg == "--camera") {
+                camera = vec;
+            }
+            else if (arg == "--look") {
+                lookAtVec = vec;
+            }
+            else {
+                upVec = vec;
+            }
+        }
+        else if (arg == "--size") {
+            valid = readFloats(argc, argv, i, values, 2) && values[0] >= 1 && values[1] >= 1;
+            rayTracer.imgSizeX = (int)values[0];
+            rayTracer.imgSizeY = (int)values[1];
+        }
+        else if (arg == "--orthogonal") {
+            rayTracer.orthogonal = true;
+        }
+        else if (arg == "--perspective") {
+            rayTracer.orthogonal = false;
+        }
+        else if (arg == "--projection-distance") {
+            valid = readFloats(argc, argv, i, values, 1);
+            projectionDistance = values[0];
+        }
+        else if (arg == "--lights") {
+            rayTracer.lightVisualization = true;
+        }
+        else if (arg == "--scene" && i + 1 < argc) {
+            SceneWatcher scene(argv[++i]);
+            string error;
+            if (!scene.reload(rayTracer, error)) {
+                cout << "Error: " << error << endl;
+                return 1;
+            }
+            if (scene.hasView) {
+                camera = scene.camera;
+                lookAtVec = scene.lookAtVec;
+                upVec = scene.upVec;
+            }
+            // A perspective line sets the distance unless it's given on the command line
+            if (!rayTracer.orthogonal && projectionDistance <= 0) {
+                projectionDistance = rayTracer.projectionDistance;
+            }
+        }
+        else if (arg == "--cache" && i + 1 < argc) {
+            string error;
+            if (!rayTracer.loadSceneCache(argv[++i], error)) {
+                cout << "Error: " << error << endl;
+                return 1;
+            }
+            cached = true;
+        }
+        else if (arg == "--compile" && i + 1 < argc) {
+            compileFile = argv[++i];
+        }
+        else if (arg == "--obj" && i + 1 < argc) {
+            objFiles.push_back(argv[++i]);
+        }
+        else if (arg == "--threads") {
+            valid = readFloats(argc, argv, i, values, 1) && values[0] >= 1;
+            rayTracer.threadCount = (int)values[0];
+        }
+        else if (arg == "--reflections") {
+            valid = readFloats(argc, argv, i, values, 1) && values[0] >= 0;
+            rayTracer.reflectionDepth = (int)values[0];
+        }
+        else if (arg == "--light-samples") {
+            valid = readFloats(argc, argv, i, values, 1) && values[0] >= 0;
+            rayTracer.lightSamples = (int)values[0];
+        }
+        else if (arg == "--aa") {
+            valid = readFloats(argc, argv, i, values, 1) && values[0] >= 1;
+            rayTracer.antialiasSamples = (int)values[0];
+        }
+        else if (arg == "--aa-uniform") {
+            rayTracer.adaptiveAntialiasing = false;
+        }
+        else if (arg == "--aa-threshold") {
+            valid = readFloats(argc, argv, i, values, 1) && values[0] >= 0;
+            rayTracer.antialiasThreshold = values[0];
+        }
+        else if (arg == "--path" && i + 1 < argc) {
+            pathFile = argv[++i];
+        }
+        else if (arg == "--fps") {
+            valid = readFloats(argc, argv, i, values, 1) && values[0] >= 1;
+            framesPerSecond = (int)values[0];
+        }
+        else if (arg == "--output" && i + 1 < argc) {
+            outputFile = argv[++i];
+        }
+        else if (arg == "--stats") {
+            printStats = true;
+        }
+        else if (arg == "--cost-map") {
+            costMap = true;
+            rayTracer.recordPixelCosts = true;
+        }
+        else if (arg == "--trace" && i + 1 < argc) {
+            traceFile = argv[++i];
+            rayTracer.traceTimeline = true;
+        }
+        else if (arg == "--help" || arg == "-h") {
+            printUsage();
+            return 0;
+        }
+        else {
+            valid = false;
+        }
+        if (!valid) {
+            cout << "Error: bad argument " << arg << endl;
+            printUsage();
+            return 1;
+        }
+    }
+    if (cached && !objFiles.empty()) {
+        cout << "Error: --obj can't add to a scene cache, give it to --compile instead" << endl;
+        return 1;
+    }
+    for (int i = 0; i < objFiles.size(); i++) {
+        vector<Point> vertices;
+        vector<int> indices;
+        string error;
+        if (!loadObj(objFiles[i], vertices, indices, error)) {
+            cout << "Error: " << error << endl;
+            return 1;
+        }
+        RayTracer::ColorPack color({200, 200, 200}, {200, 200, 200}, {255, 255, 255}, 16);
+        rayTracer.objects.push_back(
+            rayTracer.sceneArena.make<RayTracer::Mesh>(move(vertices), move(indices), color));
+    }
+    // Same ratio the viewer uses (144 at 256 pixels wide)
+    rayTracer.projectionDistance = projectionDistance > 0 ? projectionDistance :
+                                   0.5625f * (float)rayTracer.imgSizeX;
+    if (!compileFile.empty()) {
+        string error;
+        if (!rayTracer.saveSceneCache(compileFile, error)) {
+            cout << "Error: " << error << endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (costMap && !pathFile.empty()) {
+        cout << "Error: --cost-map renders a single frame, it can't be used with --path" << endl;
+        return 1;
+    }
+    if (outputFile.empty()) {
+        outputFile = pathFile.empty() ? "rayTrace.ppm" : "rayTrace%d.ppm";
+    }
+    string error;
+    unique_ptr<ImageSink> sink;
+    // A single PPM keeps the name it was given, PPMSink would number it
+    if (!pathFile.empty() || !isPPMOutput(outputFile)) {
+        sink = openImageSink(outputFile, framesPerSecond, error);
+        if (sink == nullptr) {
+            cerr << "Error: " << error << endl;
+            return 1;
+        }
+    }
+    int result = 0;
+    if (!pathFile.empty()) {
+        result = renderPath(rayTracer, pathFile, *sink);
+    }
+    else {
+        RenderStats stats;
+        unsigned char* image = rayTracer.produceImage(camera, lookAtVec, upVec, &stats);
+        bool saved = sink != nullptr ?
+                     sink->writeFrame(image, rayTracer.imgSizeX, rayTracer.imgSizeY) :
+                     writePPM(outputFile, image, rayTracer.imgSizeX, rayTracer.imgSizeY);
+        if (!saved) {
+            cerr << "Error: could not write " << outputFile << endl;
+            return 1;
+        }
+        // Stdout may be carrying the image
+        ostream& info = outputFile == "-" ? cerr : cout;
+        if (printStats) {
+            printRenderStats(info, stats);
+        }
+        if (costMap && !saveCostMaps(rayTracer, outputFile, info, error)) {
+            cerr << "Error: " << error << endl;
+            return 1;
+        }
+    }
+    // Stats for a path are the last frame's, on stderr since stdout may be carrying the video
+    if (printStats && !pathFile.empty()) {
+        printRenderStats(cerr, rayTracer.getRenderStats());
+    }
+    if (!traceFile.empty() && !rayTracer.writeTrace(traceFile, error)) {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+    return result;
+}
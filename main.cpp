@@ -2,30 +2,63 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include "RayTracer.h"
+#include "Animation.h"
+#include "SceneLoader.h"
 using namespace std;
 // Global Ray Tracer Settings
-float highQualitySize = 256;
-float lowQualitySize = 32;
-float highQualityProjDistance = 144.0f;
-float lowQualityProjDistance = 18.0f;
+int imageSize = 256;
+float projDistance = 144.0f;
 float stepSize = 4;
 float thetaSize = 10;
 float cursorSens = 0.1f;
 bool printLocation = false;
 // Global Ray Tracer Variables
 RayTracer rayTracer;
-vector<float> camera = {100.0f, 100.0f, 0.0f};
-vector<float> lookAtVec = {0.0f, 0.0f, -1.0f};
-vector<float> upVec = {0.0f, 1.0f, 0.0f};
+Point camera = {100.0f, 100.0f, 0.0f};
+Vec3 lookAtVec = {0.0f, 0.0f, -1.0f};
+Vec3 upVec = {0.0f, 1.0f, 0.0f};
 float yaw = 0.0f;
 float pitch = 0.0f;
 float roll = 0.0f;
 double lastCursorPosX;
 double lastCursorPosY;
 bool render = true;
-bool cameraControlsEnabled = false;
+bool cameraControlsEnabled = true;
+// True until progressive refinement of the current view finishes
+bool refining = false;
 bool record = false;
-vector<vector<vector<float>>> movements;
+vector<vector<Vec3>> movements;
+// Recorded movements being rendered in the background, with their own ray tracer so the viewer
+// keeps running (declared in this order so the animation stops before its ray tracer goes)
+unique_ptr<RayTracer> animationTracer;
+unique_ptr<ImageSink> animationSink;
+unique_ptr<AnimationRenderer> animation;
+int shownProgress = -1;
+// Scene file from the command line, text scenes are reloaded whenever they're saved and scene
+// caches (.rtscene, see raytracer_cli --compile) are mapped once
+string sceneFile;
+bool sceneCached = false;
+unique_ptr<SceneWatcher> sceneWatcher;
+double lastSceneCheck = 0.0;
+// Reloads the scene file, only the parts that changed are rebuilt
+void reloadScene() {
+    string error;
+    if (!sceneWatcher->reload(rayTracer, error)) {
+        cout << "Error: " << error << endl;
+        return;
+    }
+    if (sceneWatcher->lastChanges & ViewChanged) {
+        camera = sceneWatcher->camera;
+        // Angles that turn (0, 0, -1) into the file's look at vector, up follows from them
+        Vec3 look = RayTracer::normalizeVec(sceneWatcher->lookAtVec);
+        pitch = asin(-look[1]) * 180.0f / (float)M_PI;
+        yaw = atan2(look[0], -look[2]) * 180.0f / (float)M_PI;
+        roll = 0.0f;
+    }
+    if (sceneWatcher->lastChanges != 0) {
+        render = true;
+    }
+}
 // Function that processes keyboard inputs
 void processInput(GLFWwindow *window)
 {
@@ -128,23 +161,6 @@ void processInput(GLFWwindow *window)
             render = true;
         }
     }
-    // Press H to switch to high quality resolution
-    if (glfwGetKey(window, GLFW_KEY_H)) {
-        rayTracer.imgSizeX = highQualitySize;
-        rayTracer.imgSizeY = highQualitySize;
-        rayTracer.projectionDistance = highQualityProjDistance;
-        render = true;
-        cameraControlsEnabled = false;
-    }
-    // Press L to switch to low quality resolution
-    if (glfwGetKey(window, GLFW_KEY_L)) {
-        rayTracer.imgSizeX = lowQualitySize;
-        rayTracer.imgSizeY = lowQualitySize;
-        rayTracer.projectionDistance = lowQualityProjDistance;
-        render = true;
-        cameraControlsEnabled = true;
-        glfwGetCursorPos(window, &lastCursorPosX, &lastCursorPosY);
-    }
     // Press U to turn off light visualization
     if (glfwGetKey(window, GLFW_KEY_U)) {
         render = true;
@@ -160,22 +176,43 @@ void processInput(GLFWwindow *window)
         render = true;
         record = true;
     }
-    // Press T to save all movements as PPM files
-    if (glfwGetKey(window, GLFW_KEY_T)) {
+    // Press T to save all movements as a Y4M video, rendered in the background
+    if (glfwGetKey(window, GLFW_KEY_T) && animation == nullptr && !movements.empty()) {
         record = false;
-        rayTracer.imgSizeX = highQualitySize;
-        rayTracer.imgSizeY = highQualitySize;
-        rayTracer.projectionDistance = highQualityProjDistance;
-        cameraControlsEnabled = false;
-        // Renders each frame (program will say not responding while this occurs)
+        vector<CameraKey> path;
         for (int i = 0; i < movements.size(); i++) {
-            unsigned char* move = rayTracer.produceImage(movements.at(i)[0],
-                                                         movements.at(i)[1], movements.at(i)[2]);
-            // To render: ffmpeg -framerate 20 -i rayTrace%d.ppm -c:v libx264 -crf 25 -vf "scale=256:256,format=yuv420p" -movflags +faststart rayTrace.mp4
-            rayTracer.takePicture("rayTrace" + to_string(i) + ".ppm", move);
+            path.push_back({movements.at(i)[0], movements.at(i)[1], movements.at(i)[2]});
         }
-        movements = vector<vector<vector<float>>>();
-        render = true;
+        // Saved so the same path can be rendered again with raytracer_cli --path
+        string error;
+        if (!saveCameraPath("rayTracePath.txt", path, error)) {
+            cout << "Error: " << error << endl;
+        }
+        // Renders the scene as it is now alongside the viewer, which moves on to a new scene
+        // if the file is edited meanwhile
+        animationTracer.reset(new RayTracer(rayTracer.getScene()));
+        animationTracer->orthogonal = rayTracer.orthogonal;
+        animationTracer->lightVisualization = rayTracer.lightVisualization;
+        animationTracer->imgSizeX = rayTracer.imgSizeX;
+        animationTracer->imgSizeY = rayTracer.imgSizeY;
+        animationTracer->projectionDistance = rayTracer.projectionDistance;
+        // Consecutive frames of a recording mostly see the same surfaces, reuse their shadows
+        // (in scenes big enough for that to pay)
+        animationTracer->reprojection = true;
+        // To encode: ffmpeg -i rayTrace.y4m -c:v libx264 -crf 25 -movflags +faststart rayTrace.mp4
+        animationSink = openImageSink("rayTrace.y4m", 20, error);
+        if (animationSink != nullptr) {
+            animation.reset(new AnimationRenderer(*animationTracer, path, *animationSink));
+            animation->start();
+        }
+        else {
+            cout << "Error: " << error << endl;
+        }
+        movements = vector<vector<Vec3>>();
+    }
+    // Press C to cancel the background render (frames already rendered are still saved)
+    if (glfwGetKey(window, GLFW_KEY_C) && animation != nullptr) {
+        animation->cancel();
     }
     // If we rendered, transform our vectors based on pitch yaw and roll
     if (render) {
@@ -222,8 +259,9 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
     // height will be significantly larger than specified on retina displays.
     glViewport(0, 0, width, height);
 }
-// Main Function
-int main() {
+// Main Function, takes an optional scene file or scene cache to show instead of the built in
+// scene
+int main(int argc, char** argv) {
     // Code for GLFW/GLEW Setup and 2D Array Display given by professor
     if (!glfwInit()) {
         return -1;
@@ -332,11 +370,32 @@ int main() {
     // Hide cursor for mouse support
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     glfwGetCursorPos(window, &lastCursorPosX, &lastCursorPosY);
-    rayTracer.imgSizeX = highQualitySize;
-    rayTracer.imgSizeY = highQualitySize;
-    rayTracer.projectionDistance = highQualityProjDistance;
+    rayTracer.imgSizeX = imageSize;
+    rayTracer.imgSizeY = imageSize;
+    rayTracer.projectionDistance = projDistance;
+    if (argc > 1) {
+        sceneFile = argv[1];
+        sceneCached = sceneFile.size() > 8 && sceneFile.compare(sceneFile.size() - 8, 8, ".rtscene") == 0;
+        string error;
+        if (sceneCached && !rayTracer.loadSceneCache(sceneFile, error)) {
+            cout << "Error: " << error << endl;
+            sceneCached = false;
+            sceneFile.clear();
+        }
+        else if (!sceneCached) {
+            sceneWatcher.reset(new SceneWatcher(sceneFile));
+            reloadScene();
+        }
+    }
     // Render Loop
     while(!glfwWindowShouldClose(window)) {
+        // Look for scene file changes a few times a second
+        if (sceneWatcher != nullptr && glfwGetTime() - lastSceneCheck > 0.25) {
+            lastSceneCheck = glfwGetTime();
+            if (sceneWatcher->changed()) {
+                reloadScene();
+            }
+        }
         processInput(window);
         glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);
@@ -352,12 +411,32 @@ int main() {
                 cout << "UpVec: " << upVec[0] << " " << upVec[1] << " " << upVec[2]
                      << endl;
             }
-            unsigned char* currImage = rayTracer.produceImage(camera, lookAtVec,
-                                                              upVec);
+            // Restart refinement from a coarse pass for the new view
+            rayTracer.startProgressive(camera, lookAtVec, upVec);
+            refining = true;
+            render = false;
+        }
+        // Refine for part of the frame and show the best image so far
+        if (refining) {
+            refining = !rayTracer.refineProgressive();
             glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, rayTracer.imgSizeX,
-                         rayTracer.imgSizeY, 0, GL_RGB, GL_UNSIGNED_BYTE, currImage);
+                         rayTracer.imgSizeY, 0, GL_RGB, GL_UNSIGNED_BYTE, rayTracer.image);
             glGenerateMipmap(GL_TEXTURE_2D);
-            render = false;
+        }
+        // Background render progress goes in the title
+        if (animation != nullptr && animation->framesWritten() != shownProgress) {
+            shownProgress = animation->framesWritten();
+            string title = "Ray Tracer - saving frame " + to_string(shownProgress) + "/" +
+                           to_string(animation->frameCount()) + " (C to cancel)";
+            glfwSetWindowTitle(window, title.c_str());
+        }
+        if (animation != nullptr && animation->finished()) {
+            animation->wait();
+            animation.reset();
+            animationSink.reset();
+            animationTracer.reset();
+            shownProgress = -1;
+            glfwSetWindowTitle(window, "Ray Tracer");
         }
         // render container
         glUseProgram(shaderProgram);
@@ -0,0 +1,88 @@
+#include <iostream>
+#include <string>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "RayTracer.h"
+using namespace std;
+// Fails (exit code 1) if a warmed up ray tracer allocates while rendering. Whole frames and
+// progressive refinement are checked with one thread and with a pool, warmed up by either a
+// whole frame or a progressive one with a tiny budget (the viewer never calls produceImage),
+// then the budget swings between tiny and huge so batches of every size go through the pool.
+// render is checked the same way, requests borrowing workers that rendered one before.
+atomic<long long> heapAllocations(0);
+void* operator new(size_t size) {
+    void* block = malloc(size > 0 ? size : 1);
+    if (block == nullptr) {
+        throw bad_alloc();
+    }
+    heapAllocations++;
+    return block;
+}
+void operator delete(void* pointer) noexcept {
+    free(pointer);
+}
+void operator delete(void* pointer, size_t) noexcept {
+    free(pointer);
+}
+void renderProgressive(RayTracer& rayTracer, double budgetMs) {
+    rayTracer.progressiveBudgetMs = budgetMs;
+    rayTracer.startProgressive({100, 100, 0}, {0, 0, -1}, {0, 1, 0});
+    while (!rayTracer.refineProgressive()) {
+    }
+}
+int main() {
+    int failures = 0;
+    const int threadCounts[2] = {1, 4};
+    for (int config = 0; config < 8; config++) {
+        int threadCount = threadCounts[config / 4];
+        int size = config % 4 / 2 == 0 ? 64 : 256;
+        bool progressiveOnly = config % 2 == 1;
+        RayTracer rayTracer;
+        rayTracer.imgSizeX = size;
+        rayTracer.imgSizeY = size;
+        rayTracer.orthogonal = false;
+        rayTracer.projectionDistance = 0.5625f * (float)size;
+        rayTracer.threadCount = threadCount;
+        // Setup: BVH, thread pool, framebuffer and trace contexts
+        if (!progressiveOnly) {
+            rayTracer.produceImage({100, 100, 0}, {0, 0, -1}, {0, 1, 0});
+        }
+        renderProgressive(rayTracer, 0.001);
+        long long before = heapAllocations;
+        for (int frame = 0; frame < 3; frame++) {
+            renderProgressive(rayTracer, 1e6);
+            renderProgressive(rayTracer, 0.001);
+            if (!progressiveOnly) {
+                rayTracer.produceImage({100, 100, 0}, {0, 0, -1}, {0, 1, 0});
+            }
+        }
+        long long allocations = heapAllocations - before;
+        string name = string(progressiveOnly ? "progressive" : "frame") + "/" + to_string(size) +
+                      "/threads" + to_string(threadCount);
+        cout << (allocations == 0 ? "ok    " : "FAIL  ") << name << ": " << allocations
+             << " allocations in steady state frames" << endl;
+        failures += allocations != 0;
+    }
+    RayTracer rayTracer;
+    shared_ptr<const RayTracer::Scene> scene = rayTracer.getScene();
+    vector<unsigned char> image(256 * 256 * 3);
+    RayTracer::RenderRequest request;
+    request.camera = {100, 100, 0};
+    request.lookAtVec = {0, 0, -1};
+    request.upVec = {0, 1, 0};
+    request.image = image.data();
+    for (int threadCount = 1; threadCount <= 4; threadCount *= 4) {
+        RayTracer::Workers workers(threadCount);
+        RayTracer::render(scene, request, workers);
+        long long before = heapAllocations;
+        for (int frame = 0; frame < 3; frame++) {
+            RayTracer::render(scene, request, workers);
+        }
+        long long allocations = heapAllocations - before;
+        cout << (allocations == 0 ? "ok    " : "FAIL  ") << "render/threads" << threadCount
+             << ": " << allocations << " allocations in steady state requests" << endl;
+        failures += allocations != 0;
+    }
+    return failures == 0 ? 0 : 1;
+}
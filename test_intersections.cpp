@@ -0,0 +1,298 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <limits>
+#include <cmath>
+#include "RayTracer.h"
+#include "RayPacket.h"
+using namespace std;
+// Checks the compiled scene's intersection kernels (what rendering traces against) against the
+// objects' own intersection methods and a double precision solution, on hit, miss, grazing,
+// edge, parallel and nearly parallel rays, and the SIMD packet kernels against the scalar ones.
+// Prints every failed check and exits with 1 if there was any.
+int failures = 0;
+void check(bool passed, const string& test, const string& detail) {
+    if (!passed) {
+        failures++;
+        if (failures <= 20) {
+            cout << "FAIL  " << test << ": " << detail << endl;
+        }
+    }
+}
+struct Ray {
+    Point p;
+    Vec3 d;
+};
+Vec3 randomDirection(mt19937& rng) {
+    normal_distribution<float> gaussian;
+    return RayTracer::normalizeVec({gaussian(rng), gaussian(rng), gaussian(rng)});
+}
+// Rays from 10 units away in random directions, aimed offsetMin to offsetMax to the side of
+// target
+vector<Ray> aimedRays(mt19937& rng, int count, const Point& target, float offsetMin,
+                      float offsetMax) {
+    vector<Ray> rays;
+    uniform_real_distribution<float> offset(offsetMin, offsetMax);
+    for (int i = 0; i < count; i++) {
+        Point origin = RayTracer::addVec(target, RayTracer::scalarVec(10, randomDirection(rng)));
+        Vec3 toTarget = RayTracer::normalizeVec(RayTracer::addVec(target,
+                                                                  RayTracer::scalarVec(-1, origin)));
+        Vec3 side = RayTracer::normalizeVec(RayTracer::crossVec(toTarget, randomDirection(rng)));
+        Point aim = RayTracer::addVec(target, RayTracer::scalarVec(offset(rng), side));
+        Vec3 d = RayTracer::normalizeVec(RayTracer::addVec(aim, RayTracer::scalarVec(-1, origin)));
+        rays.push_back({origin, d});
+    }
+    return rays;
+}
+// Compiled scene holding just object, and the id it got
+int compileOne(RayTracer::Object& object, CompiledScene& scene, PrimitiveKind kind) {
+    object.compile(scene, 0);
+    scene.finish();
+    return kind << primitiveKindShift;
+}
+// Traces rays in packets with every kernel width the CPU has and checks each lane finds the
+// same closest hit at the same distance as the scalar kernel
+void checkPackets(const CompiledScene& scene, const vector<Ray>& rays, const string& test) {
+    const SceneView& view = scene.view();
+    const int widths[2] = {4, 8};
+    for (int w = 0; w < 2; w++) {
+        const PacketKernels* kernels = selectPacketKernels(widths[w]);
+        if (kernels == nullptr || kernels->width != widths[w]) {
+            continue;
+        }
+        string name = test + "/" + kernels->name;
+        for (size_t first = 0; first + kernels->width <= rays.size(); first += kernels->width) {
+            RayPacket packet;
+            packet.activeMask = (1 << kernels->width) - 1;
+            for (int lane = 0; lane < kernels->width; lane++) {
+                const Ray& ray = rays[first + lane];
+                packet.setRay(lane, ray.p, ray.d, numeric_limits<float>::max());
+            }
+            kernels->closestHit(view, packet, CameraRays, false);
+            for (int lane = 0; lane < kernels->width; lane++) {
+                const Ray& ray = rays[first + lane];
+                int hit = -1;
+                float minT = numeric_limits<float>::max();
+                for (int kind = 0; kind < 3; kind++) {
+                    int count = kind == 0 ? view.spheres.count :
+                                (kind == 1 ? view.triangles.count : view.planes.count);
+                    for (int i = 0; i < count; i++) {
+                        int id = (kind << primitiveKindShift) | i;
+                        float t = scene.intersect(id, ray.p, ray.d);
+                        if (t != -1 && t < minT) {
+                            minT = t;
+                            hit = id;
+                        }
+                    }
+                }
+                check(packet.hit[lane] == hit && (hit == -1 || packet.tMax[lane] == minT), name,
+                      "closest hit " + to_string(packet.hit[lane]) + " scalar " +
+                      to_string(hit));
+            }
+        }
+    }
+}
+// Sphere kernel against Sphere::intersection. The kernel stays in float where
+// Sphere::intersection squares through double (pow), so the two may only disagree on hit or
+// miss for rays within rounding of the silhouette, and distances match to 1e-5 elsewhere.
+void testSphere(mt19937& rng) {
+    RayTracer::ColorPack color({255, 255, 255}, {255, 255, 255}, {255, 255, 255}, 16);
+    RayTracer::Sphere sphere({0, 0, 0}, 1, color);
+    CompiledScene scene;
+    int id = compileOne(sphere, scene, SphereKind);
+    const char* names[3] = {"sphere/hit", "sphere/miss", "sphere/grazing"};
+    vector<Ray> sets[3] = {aimedRays(rng, 20000, {0, 0, 0}, 0.0f, 0.9f),
+                           aimedRays(rng, 20000, {0, 0, 0}, 1.5f, 3.0f),
+                           aimedRays(rng, 20000, {0, 0, 0}, 0.99f, 1.01f)};
+    for (int k = 0; k < 3; k++) {
+        for (const Ray& ray : sets[k]) {
+            float expected = sphere.intersection(ray.p, ray.d);
+            float t = scene.intersect(id, ray.p, ray.d);
+            // Discriminant in double, relative to |p - center|^2 which the float one rounds to
+            double dDotX = (double)ray.d.x * ray.p.x + (double)ray.d.y * ray.p.y +
+                           (double)ray.d.z * ray.p.z;
+            double xDotX = (double)ray.p.x * ray.p.x + (double)ray.p.y * ray.p.y +
+                           (double)ray.p.z * ray.p.z;
+            double discriminant = dDotX * dDotX - xDotX + 1.0;
+            bool silhouette = fabs(discriminant) <= sphereSilhouetteTolerance * xDotX;
+            if ((t == -1) != (expected == -1)) {
+                check(silhouette, names[k], "hit/miss differs off the silhouette, discriminant " +
+                                            to_string(discriminant));
+            }
+            else if (t != -1 && !silhouette) {
+                check(fabs(t - expected) <= 1e-5f * expected, names[k],
+                      "t " + to_string(t) + " expected " + to_string(expected));
+            }
+        }
+    }
+}
+// Double precision Moller Trumbore, -1 for a miss. margin gets the smallest barycentric weight
+// where the ray crosses the triangle's plane, negative outside the triangle.
+double exactTriangle(const Point& a, const Point& b, const Point& c, const Ray& ray,
+                     double& margin) {
+    double e1[3] = {(double)b.x - a.x, (double)b.y - a.y, (double)b.z - a.z};
+    double e2[3] = {(double)c.x - a.x, (double)c.y - a.y, (double)c.z - a.z};
+    double d[3] = {ray.d.x, ray.d.y, ray.d.z};
+    double o[3] = {(double)ray.p.x - a.x, (double)ray.p.y - a.y, (double)ray.p.z - a.z};
+    double s[3] = {d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2],
+                   d[0] * e2[1] - d[1] * e2[0]};
+    double det = e1[0] * s[0] + e1[1] * s[1] + e1[2] * s[2];
+    if (det == 0) {
+        margin = 0;
+        return -1;
+    }
+    double q[3] = {o[1] * e1[2] - o[2] * e1[1], o[2] * e1[0] - o[0] * e1[2],
+                   o[0] * e1[1] - o[1] * e1[0]};
+    double u = (o[0] * s[0] + o[1] * s[1] + o[2] * s[2]) / det;
+    double v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) / det;
+    double t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) / det;
+    margin = min(min(u, v), 1 - u - v);
+    return margin < 0 || t < 0 ? -1 : t;
+}
+// Triangle kernel against Triangle::intersection (plane hit then edge tests) and a double
+// precision solution, on a triangle turned off the axes so its determinant rounds. Rays well
+// off parallel agree on hit or miss unless they pass within rounding of an edge, rays within
+// triangleParallelEpsilon of the plane miss, and nearly parallel rays only disagree with the
+// exact solution as close to an edge as float rounding over 1 / sine of their slope reaches.
+void testTriangle(mt19937& rng) {
+    RayTracer::ColorPack color({255, 255, 255}, {255, 255, 255}, {255, 255, 255}, 16);
+    Point offset = {0.3f, 0.7f, -0.2f};
+    Point a = RayTracer::addVec(RayTracer::transformVector({-1, -1, 0}, 0.4f, 0.9f, 0.2f), offset);
+    Point b = RayTracer::addVec(RayTracer::transformVector({0, 1, 0}, 0.4f, 0.9f, 0.2f), offset);
+    Point c = RayTracer::addVec(RayTracer::transformVector({1, -1, 0}, 0.4f, 0.9f, 0.2f), offset);
+    Vec3 edge1 = RayTracer::addVec(b, RayTracer::scalarVec(-1, a));
+    Vec3 edge2 = RayTracer::addVec(c, RayTracer::scalarVec(-1, a));
+    Vec3 normal = RayTracer::normalizeVec(RayTracer::crossVec(edge1, edge2));
+    RayTracer::Triangle triangle(a, b, c, color);
+    CompiledScene scene;
+    int id = compileOne(triangle, scene, TriangleKind);
+    Point centroid = RayTracer::scalarVec(1.0f / 3.0f, RayTracer::addVec(a, RayTracer::addVec(b,
+                                                                                             c)));
+    uniform_real_distribution<float> unit(0.0f, 1.0f);
+    vector<Ray> edgeRays;
+    for (int i = 0; i < 20000; i++) {
+        // Aimed at the edges and, every tenth ray, right at a corner
+        const Point* corners[3] = {&a, &b, &c};
+        float along = i % 10 == 0 ? 0.0f : unit(rng);
+        Point edgePoint = RayTracer::addVec(RayTracer::scalarVec(1 - along, *corners[i % 3]),
+                                            RayTracer::scalarVec(along, *corners[(i + 1) % 3]));
+        edgeRays.push_back(aimedRays(rng, 1, edgePoint, 0.0f, 0.001f)[0]);
+    }
+    const char* names[3] = {"triangle/hit", "triangle/miss", "triangle/edge"};
+    vector<Ray> sets[3] = {aimedRays(rng, 20000, centroid, 0.0f, 0.4f),
+                           aimedRays(rng, 20000, centroid, 2.0f, 4.0f), edgeRays};
+    for (int k = 0; k < 3; k++) {
+        for (const Ray& ray : sets[k]) {
+            float expected = triangle.intersection(ray.p, ray.d);
+            float t = scene.intersect(id, ray.p, ray.d);
+            double margin;
+            double exact = exactTriangle(a, b, c, ray, margin);
+            if (fabs(margin) <= 1e-5) {
+                continue;
+            }
+            check((t == -1) == (exact == -1) && (expected == -1) == (exact == -1), names[k],
+                  "hit/miss differs " + to_string(margin) + " from an edge");
+            if (t != -1 && exact != -1) {
+                check(fabs(t - exact) <= 1e-5 * exact, names[k],
+                      "t " + to_string(t) + " exact " + to_string(exact));
+            }
+        }
+    }
+    // In the plane and nearly in it, sloping by sine up to 1e-2 (triangleParallelEpsilon is
+    // 1e-5), crossing it all around the triangle
+    vector<Ray> parallelRays;
+    for (int i = 0; i < 40000; i++) {
+        float slope = i % 4 == 0 ? 0.0f : pow(10.0f, -8.0f + 6.0f * unit(rng));
+        Vec3 along = RayTracer::normalizeVec(RayTracer::crossVec(normal, randomDirection(rng)));
+        Vec3 d = RayTracer::normalizeVec(RayTracer::addVec(
+                along, RayTracer::scalarVec(unit(rng) < 0.5f ? slope : -slope, normal)));
+        // Starts up to 2 units before where it crosses the plane, in barycentric -0.5 to 1.5
+        Point crossing = RayTracer::addVec(a, RayTracer::addVec(
+                RayTracer::scalarVec(unit(rng) * 2 - 0.5f, edge1),
+                RayTracer::scalarVec(unit(rng) * 2 - 0.5f, edge2)));
+        Ray ray = {RayTracer::addVec(crossing, RayTracer::scalarVec(-2 * unit(rng), d)), d};
+        parallelRays.push_back(ray);
+        float t = scene.intersect(id, ray.p, ray.d);
+        double margin;
+        double exact = exactTriangle(a, b, c, ray, margin);
+        double sine = fabs((double)d.x * normal.x + (double)d.y * normal.y +
+                           (double)d.z * normal.z);
+        if (sine <= triangleParallelEpsilon * 0.5) {
+            check(t == -1, "triangle/parallel", "hit a ray sloping by " + to_string(sine));
+        }
+        else if (sine > triangleParallelEpsilon * 2 && fabs(margin) > 1e-5 + 1e-6 / sine) {
+            check((t == -1) == (exact == -1), "triangle/nearly-parallel",
+                  string(t == -1 ? "missed" : "made up a hit for") + " a ray sloping by " +
+                  to_string(sine) + ", " + to_string(margin) + " from an edge");
+        }
+    }
+    checkPackets(scene, parallelRays, "triangle/parallel");
+}
+// Plane kernel against Plane::intersection, including rays almost along the plane
+void testPlane(mt19937& rng) {
+    RayTracer::ColorPack color({255, 255, 255}, {255, 255, 255}, {255, 255, 255}, 16);
+    RayTracer::Plane plane({0, 0, 0}, {1, 0, 0}, {0, 0, 1}, color);
+    CompiledScene scene;
+    int id = compileOne(plane, scene, PlaneKind);
+    uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (int i = 0; i < 20000; i++) {
+        Point origin = {unit(rng) * 100, 1 + unit(rng) * 10, unit(rng) * 100};
+        Vec3 d = randomDirection(rng);
+        // Down, up, grazing and exactly parallel
+        d.y = i % 4 == 0 ? -fabs(d.y) - 0.1f : (i % 4 == 1 ? fabs(d.y) + 0.1f :
+                                                (i % 4 == 2 ? -0.001f * unit(rng) : 0.0f));
+        d = RayTracer::normalizeVec(d);
+        float expected = plane.intersection(origin, d);
+        float t = scene.intersect(id, origin, d);
+        if ((t == -1) != (expected == -1)) {
+            check(false, "plane", "hit/miss differs");
+        }
+        else if (t != -1) {
+            check(fabs(t - expected) <= 1e-5f * expected, "plane",
+                  "t " + to_string(t) + " expected " + to_string(expected));
+        }
+    }
+}
+// Packet kernels (every width the CPU has) against the scalar kernel on a few random scenes
+void testPackets(mt19937& rng) {
+    uniform_real_distribution<float> position(-5, 5);
+    uniform_real_distribution<float> size(-1, 1);
+    CompiledScene scene;
+    for (int i = 0; i < 300; i++) {
+        Point p = {position(rng), position(rng), position(rng)};
+        int first = scene.addVertex(p);
+        Point q = {p.x + size(rng), p.y + size(rng), p.z + size(rng)};
+        Point r = {p.x + size(rng), p.y + size(rng), p.z + size(rng)};
+        scene.addVertex(q);
+        scene.addVertex(r);
+        Vec3 normal = RayTracer::normalizeVec(RayTracer::crossVec(
+                RayTracer::addVec(q, RayTracer::scalarVec(-1, p)),
+                RayTracer::addVec(r, RayTracer::scalarVec(-1, p))));
+        scene.addTriangle(first, first + 1, first + 2, normal, 0, AllRays);
+        if (i % 10 == 0) {
+            scene.addSphere({position(rng), position(rng), position(rng)}, fabs(size(rng)), 0,
+                            AllRays);
+        }
+    }
+    scene.addPlane({0, -6, 0}, {0, 1, 0}, 0, AllRays);
+    scene.finish();
+    vector<Ray> rays;
+    for (int i = 0; i < 16000; i++) {
+        rays.push_back({{position(rng), position(rng), 8}, randomDirection(rng)});
+    }
+    checkPackets(scene, rays, "packets");
+}
+int main() {
+    mt19937 rng(7);
+    testSphere(rng);
+    testTriangle(rng);
+    testPlane(rng);
+    testPackets(rng);
+    if (failures > 0) {
+        cout << failures << " checks failed" << endl;
+        return 1;
+    }
+    cout << "all intersection checks passed" << endl;
+    return 0;
+}
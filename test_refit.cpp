@@ -0,0 +1,114 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include "RayTracer.h"
+using namespace std;
+// Objects edited in place get their BVH refit rather than built again (refitAcceleration). A
+// refit scene has to render the same as one built from scratch. Nudging every object keeps the
+// tree, scattering them (so the refit tree would be much worse) or adding one builds it again.
+// Fails (exit code 1) if any image differs from a fresh build or the wrong path was taken.
+const int size = 96;
+int failures = 0;
+void check(bool passed, const string& test) {
+    cout << (passed ? "ok    " : "FAIL  ") << test << endl;
+    failures += !passed;
+}
+vector<unsigned char> render(RayTracer& rayTracer) {
+    unsigned char* image = rayTracer.produceImage({100, 100, 0}, {0, 0, -1}, {0, 1, 0});
+    return vector<unsigned char>(image, image + size * size * 3);
+}
+// Image of the ray tracer's objects with the BVH built from scratch, then built again (so the
+// ray tracer is left as before, minus whatever refit tree it had)
+vector<unsigned char> renderBuilt(RayTracer& rayTracer) {
+    rayTracer.buildAcceleration();
+    return render(rayTracer);
+}
+vector<int> bvhOrder(const RayTracer& rayTracer) {
+    const BVH& bvh = rayTracer.getScene()->compiled->getBVH();
+    int count = rayTracer.getScene()->compiled->view().spheres.count +
+                rayTracer.getScene()->compiled->view().triangles.count;
+    return vector<int>(bvh.getOrder(), bvh.getOrder() + count);
+}
+bool refit(const RayTracer& rayTracer, const vector<int>& oldOrder) {
+    const BVH& bvh = rayTracer.getScene()->compiled->getBVH();
+    return bvhOrder(rayTracer) == oldOrder && bvh.cost() != bvh.getBuiltCost();
+}
+int main() {
+    RayTracer rayTracer;
+    rayTracer.imgSizeX = size;
+    rayTracer.imgSizeY = size;
+    rayTracer.projectionDistance = 0.5625f * (float)size;
+    rayTracer.threadCount = 2;
+    mt19937 rng(5);
+    uniform_real_distribution<float> position(0, 250);
+    uniform_real_distribution<float> offset(-5, 5);
+    uniform_real_distribution<float> nudge(-1, 1);
+    RayTracer::ColorPack color({200, 100, 50}, {200, 100, 50}, {255, 255, 255}, 16);
+    vector<RayTracer::Sphere*> spheres;
+    vector<RayTracer::Triangle*> triangles;
+    for (int i = 0; i < 2000; i++) {
+        Point a = {position(rng), position(rng), -position(rng)};
+        if (i % 4 == 0) {
+            spheres.push_back(rayTracer.sceneArena.make<RayTracer::Sphere>(a, 2.0f, color));
+            rayTracer.objects.push_back(spheres.back());
+            continue;
+        }
+        Point b = {a.x + offset(rng), a.y + offset(rng), a.z + offset(rng)};
+        Point c = {a.x + offset(rng), a.y + offset(rng), a.z + offset(rng)};
+        triangles.push_back(rayTracer.sceneArena.make<RayTracer::Triangle>(a, b, c, color));
+        rayTracer.objects.push_back(triangles.back());
+    }
+    render(rayTracer);
+    // Every object moves a little
+    vector<int> order = bvhOrder(rayTracer);
+    for (RayTracer::Sphere* sphere : spheres) {
+        sphere->center = {sphere->center.x + nudge(rng), sphere->center.y + nudge(rng),
+                          sphere->center.z};
+        sphere->radius += 0.5f * nudge(rng);
+    }
+    for (RayTracer::Triangle* triangle : triangles) {
+        Vec3 shift = {nudge(rng), nudge(rng), nudge(rng)};
+        triangle->a = {triangle->a.x + shift.x, triangle->a.y + shift.y, triangle->a.z + shift.z};
+        triangle->b = {triangle->b.x + shift.x, triangle->b.y + shift.y, triangle->b.z + shift.z};
+        triangle->c.x += nudge(rng);
+    }
+    rayTracer.refitAcceleration();
+    vector<unsigned char> image = render(rayTracer);
+    check(refit(rayTracer, order), "nudged objects refit the tree");
+    check(image == renderBuilt(rayTracer), "refit tree renders like a new one");
+    // A second refit in a row starts from the refit tree and still matches
+    order = bvhOrder(rayTracer);
+    render(rayTracer);
+    for (RayTracer::Sphere* sphere : spheres) {
+        sphere->center.y += nudge(rng);
+    }
+    rayTracer.refitAcceleration();
+    image = render(rayTracer);
+    check(refit(rayTracer, order), "refit again");
+    check(image == renderBuilt(rayTracer), "refit again renders like a new tree");
+    // Every object somewhere else, boxes that overlapped now span the scene
+    order = bvhOrder(rayTracer);
+    for (RayTracer::Sphere* sphere : spheres) {
+        sphere->center = {position(rng), position(rng), -position(rng)};
+    }
+    for (RayTracer::Triangle* triangle : triangles) {
+        Vec3 shift = {position(rng) - triangle->a.x, position(rng) - triangle->a.y,
+                      -position(rng) - triangle->a.z};
+        triangle->a = {triangle->a.x + shift.x, triangle->a.y + shift.y, triangle->a.z + shift.z};
+        triangle->b = {triangle->b.x + shift.x, triangle->b.y + shift.y, triangle->b.z + shift.z};
+        triangle->c = {triangle->c.x + shift.x, triangle->c.y + shift.y, triangle->c.z + shift.z};
+    }
+    rayTracer.refitAcceleration();
+    image = render(rayTracer);
+    check(!refit(rayTracer, order), "scattered objects build a new tree");
+    check(image == renderBuilt(rayTracer), "scattered objects render like a new tree");
+    // One more sphere doesn't fit the old tree at all
+    rayTracer.objects.push_back(rayTracer.sceneArena.make<RayTracer::Sphere>(
+            Point{120, 120, -100}, 10.0f, color));
+    rayTracer.refitAcceleration();
+    image = render(rayTracer);
+    check(bvhOrder(rayTracer).size() == order.size() + 1, "added object builds a new tree");
+    check(image == renderBuilt(rayTracer), "added object renders like a new tree");
+    return failures == 0 ? 0 : 1;
+}
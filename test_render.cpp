@@ -0,0 +1,187 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include "RayTracer.h"
+using namespace std;
+// Renders of one shared scene must come out the same whichever thread renders them, whatever
+// else runs at the same time and whichever workers they borrow. Each request (mixed
+// projections, packet widths, anti-aliasing, reflections and light sampling) is rendered on its
+// own with one thread first. Then renders run side by side, each thread with its own workers
+// (some with a pool of their own), while the RayTracer that made the scene moves a light and
+// renders, and one worker set renders every request in turn. Last, threads call the const
+// produceImage of one RayTracer at once, right after it's made and after each light move, so
+// they bring its scene up to date together. Fails (exit code 1) if any image differs from its
+// single threaded render.
+const int size = 96;
+const int requestCount = 8;
+const int rounds = 3;
+int failures = 0;
+void check(bool passed, const string& test) {
+    cout << (passed ? "ok    " : "FAIL  ") << test << endl;
+    failures += !passed;
+}
+// Default scene plus random triangles, spheres and lights, so light sampling has lights to
+// pick from
+void addRandomScene(RayTracer& rayTracer) {
+    mt19937 rng(3);
+    uniform_real_distribution<float> position(0, 250);
+    uniform_real_distribution<float> size(-5, 5);
+    RayTracer::ColorPack color({200, 100, 50}, {200, 100, 50}, {255, 255, 255}, 16);
+    for (int i = 0; i < 500; i++) {
+        Point a = {position(rng), position(rng), -position(rng)};
+        Point b = {a.x + size(rng), a.y + size(rng), a.z + size(rng)};
+        Point c = {a.x + size(rng), a.y + size(rng), a.z + size(rng)};
+        rayTracer.objects.push_back(rayTracer.sceneArena.make<RayTracer::Triangle>(a, b, c, color));
+    }
+    for (int i = 0; i < 10; i++) {
+        Point center = {position(rng), position(rng), -position(rng)};
+        rayTracer.objects.push_back(rayTracer.sceneArena.make<RayTracer::Sphere>(center,
+                                                                                 fabs(size(rng)),
+                                                                                 color));
+        rayTracer.lights.push_back(rayTracer.sceneArena.make<RayTracer::Light>(
+                Point{position(rng), position(rng), -position(rng)}, 0.05f));
+    }
+}
+RayTracer::RenderRequest makeRequest(int k) {
+    RayTracer::RenderRequest request;
+    float angle = 0.05f * (float)k;
+    request.camera = {100.0f + 5.0f * (float)k, 100, 0};
+    request.lookAtVec = {sin(angle), 0, -cos(angle)};
+    request.upVec = {0, 1, 0};
+    request.settings.imgSizeX = size;
+    request.settings.imgSizeY = size;
+    request.settings.projectionDistance = 0.5625f * (float)size;
+    request.settings.orthogonal = k % 2 == 1;
+    request.settings.packetWidth = k % 3 == 0 ? 1 : 0;
+    request.settings.antialiasSamples = k % 4 == 3 ? 4 : 1;
+    request.settings.reflectionDepth = k % 3;
+    request.settings.lightSamples = k % 5 == 4 ? 1 : 0;
+    // Samples the scene's 12 lights rather than shading them exactly
+    request.settings.lightSampleCost = 1;
+    return request;
+}
+int main() {
+    RayTracer rayTracer;
+    addRandomScene(rayTracer);
+    rayTracer.imgSizeX = size;
+    rayTracer.imgSizeY = size;
+    rayTracer.projectionDistance = 0.5625f * (float)size;
+    rayTracer.threadCount = 2;
+    shared_ptr<const RayTracer::Scene> scene = rayTracer.getScene();
+    vector<RayTracer::RenderRequest> requests;
+    vector<vector<unsigned char>> expected(requestCount);
+    RayTracer::Workers single(1);
+    for (int k = 0; k < requestCount; k++) {
+        requests.push_back(makeRequest(k));
+        expected[k].resize(size * size * 3);
+        RayTracer::RenderRequest request = requests[k];
+        request.image = expected[k].data();
+        RayTracer::render(scene, request, single);
+    }
+    // produceImage with the same settings, and the const one on borrowed workers
+    {
+        RayTracer sceneTracer(scene);
+        static_cast<RenderSettings&>(sceneTracer) = requests[1].settings;
+        const RayTracer::RenderRequest& request = requests[1];
+        unsigned char* image = sceneTracer.produceImage(request.camera, request.lookAtVec,
+                                                        request.upVec);
+        check(vector<unsigned char>(image, image + size * size * 3) == expected[1],
+              "produceImage matches render");
+        vector<unsigned char> constImage(size * size * 3);
+        RayTracer::RenderRequest constRequest = request;
+        constRequest.image = constImage.data();
+        const RayTracer& constTracer = sceneTracer;
+        constTracer.produceImage(constRequest, single);
+        check(constImage == expected[1], "const produceImage matches render");
+    }
+    // Side by side, each thread keeping its workers from round to round
+    int mismatches = 0;
+    int ownerFrames = 0;
+    vector<unique_ptr<RayTracer::Workers>> workers;
+    for (int k = 0; k < requestCount; k++) {
+        workers.emplace_back(new RayTracer::Workers(k % 4 == 0 ? 2 : 1));
+    }
+    for (int round = 0; round < rounds; round++) {
+        vector<vector<unsigned char>> images(requestCount,
+                                             vector<unsigned char>(size * size * 3));
+        atomic<int> running(requestCount);
+        vector<thread> threads;
+        for (int k = 0; k < requestCount; k++) {
+            threads.emplace_back([&, k]() {
+                RayTracer::RenderRequest request = requests[k];
+                request.image = images[k].data();
+                RayTracer::render(scene, request, *workers[k]);
+                running--;
+            });
+        }
+        // The owner's edits make new scenes, the shared one stays as it was
+        while (running > 0) {
+            rayTracer.lights[0]->location.x += 1.0f;
+            rayTracer.produceImage({100, 100, 0}, {0, 0, -1}, {0, 1, 0});
+            ownerFrames++;
+        }
+        for (int k = 0; k < requestCount; k++) {
+            threads[k].join();
+            mismatches += images[k] != expected[k];
+        }
+    }
+    check(mismatches == 0, "concurrent renders match (" + to_string(mismatches) + " of " +
+                           to_string(rounds * requestCount) + " differ, owner rendered " +
+                           to_string(ownerFrames) + " frames)");
+    // One set of workers going from request to request (and scene to scene, the owner's has
+    // moved on) keeps nothing from the last one
+    RayTracer::Workers shared(3);
+    mismatches = 0;
+    for (int round = 0; round < rounds; round++) {
+        for (int k = 0; k < requestCount; k++) {
+            vector<unsigned char> image(size * size * 3);
+            RayTracer::RenderRequest request = requests[k];
+            request.image = image.data();
+            RayTracer::render(scene, request, shared);
+            mismatches += image != expected[k];
+            RayTracer::RenderRequest other = requests[k];
+            other.image = image.data();
+            RayTracer::render(rayTracer.getScene(), other, shared);
+        }
+    }
+    check(mismatches == 0, "renders reusing workers match (" + to_string(mismatches) + " of " +
+                           to_string(rounds * requestCount) + " differ)");
+    // Nothing compiled yet, the first threads in make the scene while the rest wait for it
+    RayTracer viewports;
+    addRandomScene(viewports);
+    mismatches = 0;
+    for (int round = 0; round < rounds; round++) {
+        if (round > 0) {
+            viewports.lights[0]->location.x += 10.0f;
+        }
+        vector<vector<unsigned char>> images(requestCount,
+                                             vector<unsigned char>(size * size * 3));
+        vector<thread> threads;
+        for (int k = 0; k < requestCount; k++) {
+            threads.emplace_back([&, k]() {
+                RayTracer::RenderRequest request = requests[k];
+                request.image = images[k].data();
+                const RayTracer& constTracer = viewports;
+                constTracer.produceImage(request, *workers[k]);
+            });
+        }
+        for (int k = 0; k < requestCount; k++) {
+            threads[k].join();
+        }
+        for (int k = 0; k < requestCount; k++) {
+            vector<unsigned char> image(size * size * 3);
+            RayTracer::RenderRequest request = requests[k];
+            request.image = image.data();
+            RayTracer::render(viewports.getScene(), request, single);
+            mismatches += images[k] != image;
+        }
+    }
+    check(mismatches == 0, "concurrent const produceImage calls match (" +
+                           to_string(mismatches) + " of " + to_string(rounds * requestCount) +
+                           " differ)");
+    return failures == 0 ? 0 : 1;
+}